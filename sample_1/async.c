@@ -0,0 +1,436 @@
+/*
+ * async.c
+ *
+ * Runtime of the CMD_ASYNC handlers, see async.h. A parked task is only
+ * its spp_task: the await macros record what it waits for, task_ready()
+ * checks it after every poll() and the handler is called again once it is
+ * satisfied. A command (SPP_TASK_SH) is waited for in two steps, its stdout
+ * pipe until EOF and then the child itself through a pidfd, or a short
+ * waitpid() tick on kernels without pidfd_open.
+ *
+ */
+
+#define _GNU_SOURCE     /* vasprintf, pipe2 */
+#include <config.h>
+#include <sppCtrl.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <async.h>
+#include <memstat.h>
+#include <timestamp.h>
+#include <shutils.h>
+
+#define TASK_SH_PATH    "/bin/sh"
+#define TASK_TICK_MS    10      /* waitpid() interval without pidfd */
+#define TASK_READ_CHUNK 4096
+
+static spp_task *tasks[SPP_TASK_MAX];
+static spp_task *polled[SPP_TASK_MAX];  /* pfd entry i belongs to polled[i] */
+static int task_count = 0;
+static uint64_t task_started = 0;
+static uint64_t task_finished = 0;
+static uint64_t task_offloaded = 0;
+static int task_max = 0;
+
+extern void *cmd_tables[CMD_NUM][CMD_LEN];
+
+void *spp_task_locals(spp_task *t, size_t size)
+{
+    if (t->locals == NULL) {
+        t->locals = calloc(1, size);
+    }
+    return t->locals;
+}
+
+static uint64_t task_deadline(int timeout_ms)
+{
+    return timeout_ms > 0 ? spp_mono_ns() + timeout_ms * 1000000ULL : 0;
+}
+
+void spp_task_wait_fd(spp_task *t, int fd, short events, int timeout_ms)
+{
+    t->kind = SPP_TASK_FD;
+    t->fd = fd;
+    t->events = events;
+    t->deadline = task_deadline(timeout_ms);
+}
+
+void spp_task_wait_sleep(spp_task *t, int ms)
+{
+    t->kind = SPP_TASK_SLEEP;
+    t->fd = -1;
+    // 0 still needs a deadline, the task resumes on the next turn
+    t->deadline = spp_mono_ns() + (ms > 0 ? ms * 1000000ULL : 0);
+}
+
+static int task_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+int spp_task_wait_sh(spp_task *t, int timeout_ms, spp_out *out, const char *fmt, ...)
+{
+    char *cmd = NULL;
+    va_list args;
+    int fds[2] = {-1, -1}, null = -1, n = 0;
+    pid_t pid;
+
+    va_start(args, fmt);
+    n = vasprintf(&cmd, fmt, args);
+    va_end(args);
+    if (n < 0 || (out && pipe2(fds, O_CLOEXEC) < 0)) {
+        free(n < 0 ? NULL : cmd);
+        t->result = -1;
+        return -1;
+    }
+
+    switch (pid = fork()) {
+        case -1:
+            if (out) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            free(cmd);
+            t->result = -1;
+            return -1;
+        case 0:
+            // own process group, a timeout kills what the command started
+            setpgid(0, 0);
+            if ((null = open("/dev/null", O_RDWR)) >= 0) {
+                dup2(null, STDIN_FILENO);
+                dup2(out ? fds[1] : null, STDOUT_FILENO);
+            }
+            execl(TASK_SH_PATH, "sh", "-c", cmd, (char *)NULL);
+            _exit(127);
+        default:
+            break;
+    }
+    setpgid(pid, pid);
+    free(cmd);
+    if (out) {
+        close(fds[1]);
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    }
+    t->kind = SPP_TASK_SH;
+    t->fd = fds[0];
+    t->events = POLLIN;
+    t->deadline = task_deadline(timeout_ms);
+    t->pid = pid;
+    t->pidfd = task_pidfd(pid);
+    t->killed = 0;
+    t->sh_out = out;
+    return 0;
+}
+
+/* The command is over one way or another: release what it held */
+static void task_sh_close(spp_task *t)
+{
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+    if (t->pidfd >= 0) {
+        close(t->pidfd);
+        t->pidfd = -1;
+    }
+    t->pid = 0;
+}
+
+/* Pipe readable: take what is there, 1 at EOF */
+static int task_sh_read(spp_task *t)
+{
+    char buf[TASK_READ_CHUNK];
+    ssize_t n;
+
+    for (;;) {
+        n = read(t->fd, buf, sizeof(buf));
+        if (n > 0) {
+            if (t->sh_out != SPP_TASK_PRINT) {
+                spp_out_append(t->sh_out, buf, n);
+            } else if (t->out) {
+                spp_out_append(t->out, buf, n);
+            } else {
+                fwrite(buf, 1, n, stdout);
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        // EAGAIN: more later, 0 or an error: the command closed its stdout
+        if (n < 0 && errno == EAGAIN) {
+            return 0;
+        }
+        close(t->fd);
+        t->fd = -1;
+        return 1;
+    }
+}
+
+/*
+ * Whether what t waits for has happened, result is set if so
+ * @param	now	spp_mono_ns()
+ */
+static int task_ready(spp_task *t, uint64_t now)
+{
+    int status = 0;
+
+    switch (t->kind) {
+        case SPP_TASK_FD:
+            if (t->revents) {
+                t->result = t->revents;
+                return 1;
+            }
+            break;
+        case SPP_TASK_SLEEP:
+            if (now >= t->deadline) {
+                t->result = 0;
+                return 1;
+            }
+            return 0;
+        case SPP_TASK_SH:
+            if (t->fd >= 0 && (t->revents & (POLLIN | POLLHUP | POLLERR)) && task_sh_read(t) == 0) {
+                break;
+            }
+            if (t->fd < 0 && waitpid(t->pid, &status, WNOHANG) == t->pid) {
+                task_sh_close(t);
+                t->result = t->killed ? EVAL_TIMEDOUT : WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+                return 1;
+            }
+            break;
+        default:
+            // parked without saying on what: resume on the next turn
+            t->result = 0;
+            return 1;
+    }
+
+    if (t->deadline && now >= t->deadline) {
+        if (t->kind == SPP_TASK_SH) {
+            // never block the loop on the child, it is reaped as on exit
+            kill(-t->pid, SIGKILL);
+            t->killed = 1;
+            t->deadline = 0;
+            if (t->fd >= 0) {
+                close(t->fd);
+                t->fd = -1;
+            }
+            return 0;
+        }
+        t->result = EVAL_TIMEDOUT;
+        return 1;
+    }
+    return 0;
+}
+
+/* Descriptor t is parked on, -1 for none */
+static int task_fd(spp_task *t)
+{
+    if (t->kind == SPP_TASK_FD) {
+        return t->fd;
+    }
+    if (t->kind == SPP_TASK_SH) {
+        return t->fd >= 0 ? t->fd : t->pidfd;
+    }
+    return -1;
+}
+
+/* Milliseconds until t has to be looked at again, -1 for never */
+static int task_wait_ms(spp_task *t, uint64_t now)
+{
+    int ms = -1;
+
+    if (t->kind == SPP_TASK_NONE) {
+        return 0;
+    }
+    if (t->deadline) {
+        ms = t->deadline > now ? (t->deadline - now + 999999) / 1000000 : 0;
+    }
+    // no pidfd: the end of the child is only seen by polling waitpid()
+    if (t->kind == SPP_TASK_SH && t->fd < 0 && t->pidfd < 0 && (ms < 0 || ms > TASK_TICK_MS)) {
+        ms = TASK_TICK_MS;
+    }
+    return ms;
+}
+
+/*
+ * Call the handler once with its output selected; a loop task is charged
+ * to its feature here, spp_task_run() is inside run_vector()'s scope
+ */
+static int task_resume(spp_task *t)
+{
+    spp_out *prev = spp_out_select(t->out);
+    int scope = 0, ret;
+
+    t->kind = SPP_TASK_NONE;
+    t->revents = 0;
+    if (t->loop) {
+        scope = spp_mem_resume(t->feature, cmd_tables[t->feature][0]);
+    }
+    ret = t->fn(t, t->argc, t->argv);
+    if (t->loop) {
+        spp_mem_leave(scope);
+    }
+    spp_out_select(prev);
+    return ret;
+}
+
+static void task_init(spp_task *t, spp_async_fn fn, int argc, char **argv, spp_out *out)
+{
+    memset(t, 0, sizeof(spp_task));
+    t->fd = -1;
+    t->pidfd = -1;
+    t->fn = fn;
+    t->argc = argc;
+    t->argv = argv;
+    t->out = out;
+}
+
+static void task_cleanup(spp_task *t)
+{
+    free(t->locals);
+    t->locals = NULL;
+}
+
+int spp_task_run(spp_async_fn fn, int argc, char **argv)
+{
+    struct pollfd pfd;
+    spp_task t;
+    int ret;
+
+    task_init(&t, fn, argc, argv, spp_out_cur);
+    while ((ret = task_resume(&t)) == SPP_TASK_WAIT) {
+        while (!task_ready(&t, spp_mono_ns())) {
+            pfd.fd = task_fd(&t);
+            pfd.events = t.kind == SPP_TASK_FD ? t.events : POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, pfd.fd >= 0, task_wait_ms(&t, spp_mono_ns())) < 0 && errno != EINTR) {
+                ret = SPP_FAIL;
+                break;
+            }
+            t.revents = pfd.revents;
+        }
+    }
+    task_cleanup(&t);
+    return ret;
+}
+
+/* Handler returned: hand the result over and forget the task */
+static void task_finish(int i, int ret)
+{
+    spp_task *t = tasks[i];
+
+    tasks[i] = tasks[--task_count];
+    task_finished++;
+    task_cleanup(t);
+    t->done(t->arg, ret);
+    free(t);
+}
+
+int spp_task_start(int feature, int argc, char **argv, spp_out *out,
+        void (*done)(void *arg, int ret), void *arg)
+{
+    spp_task *t = NULL;
+    int ret;
+
+    if (task_count == SPP_TASK_MAX || (t = malloc(sizeof(spp_task))) == NULL) {
+        return -1;
+    }
+    task_init(t, (spp_async_fn)cmd_tables[feature][2], argc, argv, out);
+    t->done = done;
+    t->arg = arg;
+    t->loop = 1;
+    t->feature = feature;
+    tasks[task_count++] = t;
+
+    if ((ret = task_resume(t)) == SPP_TASK_OFFLOAD) {
+        tasks[--task_count] = NULL;
+        task_offloaded++;
+        task_cleanup(t);
+        free(t);
+        return -1;
+    }
+    // an offloaded request is counted by run_vector() on the worker
+    spp_mem_request(feature);
+    task_started++;
+    if (task_count > task_max) {
+        task_max = task_count;
+    }
+    if (ret != SPP_TASK_WAIT) {
+        task_finish(task_count - 1, ret);
+    }
+    return 0;
+}
+
+int spp_task_pollfds(struct pollfd *pfd, int max)
+{
+    int i = 0, n = 0;
+
+    for (i = 0; i < task_count && n < max; i++) {
+        tasks[i]->revents = 0;
+        if ((pfd[n].fd = task_fd(tasks[i])) < 0) {
+            continue;
+        }
+        pfd[n].events = tasks[i]->kind == SPP_TASK_FD ? tasks[i]->events : POLLIN;
+        pfd[n].revents = 0;
+        polled[n++] = tasks[i];
+    }
+    return n;
+}
+
+void spp_task_poll(struct pollfd *pfd, int n)
+{
+    uint64_t now = spp_mono_ns();
+    spp_task *t = NULL;
+    int i = 0, ret;
+
+    for (i = 0; i < n; i++) {
+        polled[i]->revents = pfd[i].revents;
+    }
+    // task_finish() moves the last task to i, look at i again
+    for (i = 0; i < task_count; ) {
+        t = tasks[i];
+        if (!task_ready(t, now) || (ret = task_resume(t)) == SPP_TASK_WAIT) {
+            i++;
+            continue;
+        }
+        // too late to move to the pool
+        task_finish(i, ret == SPP_TASK_OFFLOAD ? SPP_FAIL : ret);
+    }
+}
+
+int spp_task_timeout(void)
+{
+    uint64_t now = spp_mono_ns();
+    int i = 0, ms = -1, t = 0;
+
+    for (i = 0; i < task_count; i++) {
+        if ((t = task_wait_ms(tasks[i], now)) >= 0 && (ms < 0 || t < ms)) {
+            ms = t;
+        }
+    }
+    return ms;
+}
+
+void spp_task_stats(spp_out *o)
+{
+    spp_out *prev = spp_out_select(o);
+
+    SPP_PRINT("spp_task_running=%d\n", task_count);
+    SPP_PRINT("spp_task_max_running=%d\n", task_max);
+    SPP_PRINT("spp_task_started=%llu\n", (unsigned long long)task_started);
+    SPP_PRINT("spp_task_finished=%llu\n", (unsigned long long)task_finished);
+    SPP_PRINT("spp_task_offloaded=%llu\n", (unsigned long long)task_offloaded);
+    spp_out_select(prev);
+}
@@ -0,0 +1,514 @@
+/*
+ * bench.c
+ *
+ * Throughput benchmarks for the helpers, build with "make bench".
+ *
+ * Usage: sppBench <bench> [MB] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <kvparse.h>
+#include <timestamp.h>
+#include <nvcache.h>
+#include <ring.h>
+#include <ifstats.h>
+#include <shutils.h>
+#include <coproc.h>
+#include <ifctl.h>
+#include <nlbatch.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_MB        4
+#define BENCH_ROUNDS    20
+
+typedef int (*BENCH)(size_t, int);
+
+static double now_sec(void)
+{
+    return spp_mono_ns() / 1e9;
+}
+
+static void report(const char *name, size_t bytes, int rounds, double sec)
+{
+    printf("%-24s %8.1f MB/s  (%d x %zu bytes in %.3fs)\n", name,
+            (double)bytes * rounds / sec / (1024 * 1024), rounds, bytes, sec);
+}
+
+/* spp_status like document: spp_<if>_<field>=<value> */
+static char *gen_status(size_t size, size_t *len)
+{
+    char *buf = malloc(size + 128);
+    size_t n = 0;
+    int i = 0;
+
+    if (buf == NULL) {
+        return NULL;
+    }
+    while (n < size) {
+        n += sprintf(buf + n, "spp_if%d_field%d=value-%08x-%d\n", i % 97, i % 13, i * 2654435761u, i);
+        i++;
+    }
+    *len = n;
+    return buf;
+}
+
+static int bench_kv_strtok(const char *doc, size_t len, int rounds)
+{
+    char *copy = malloc(len + 1);
+    char *line, *save, *eq;
+    long pairs = 0;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        memcpy(copy, doc, len + 1);
+        for (line = strtok_r(copy, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            if ((eq = strstr(line, "=")) != NULL) {
+                pairs++;
+            }
+        }
+    }
+    free(copy);
+    return (int)(pairs / rounds);
+}
+
+static int bench_kv(size_t size, int rounds)
+{
+    static const char *const keys[] = {"spp_if0_field0", "spp_if96_field12", "spp_if_missing"};
+    spp_tok vals[3];
+    spp_kvlist l;
+    size_t len;
+    char *doc = gen_status(size, &len);
+    double t;
+    int r, n = 0;
+
+    if (doc == NULL) {
+        return -1;
+    }
+
+    t = now_sec();
+    n = bench_kv_strtok(doc, len, rounds);
+    report("strtok+strstr", len, rounds, now_sec() - t);
+
+    t = now_sec();
+    for (r = 0; r < rounds; r++) {
+        n = spp_kv_parse(&l, doc, len, KV_SEP_EQ);
+        spp_kv_free(&l);
+    }
+    report("spp_kv_parse", len, rounds, now_sec() - t);
+
+    t = now_sec();
+    for (r = 0; r < rounds; r++) {
+        spp_kv_lookup(doc, len, KV_SEP_EQ, keys, vals, 3);
+    }
+    report("spp_kv_lookup (3 keys)", len, rounds, now_sec() - t);
+
+    printf("%d pairs per document\n", n);
+    free(doc);
+    return 0;
+}
+
+/* MB is the number of variables in thousands, set once per round */
+static int bench_nvram(size_t size, int rounds)
+{
+    char name[32], value[32];
+    size_t vars = size / 1024, i;
+    double t;
+    int r, commits = 0;
+
+    spp_nvram_file("/tmp/spp_nvram_bench");
+
+    t = now_sec();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < vars; i++) {
+            sprintf(name, "bench_var%zu", i);
+            sprintf(value, "%d-%zu", r, i);
+            spp_nvram_set(name, value);
+            commits += spp_nvram_commit() > 0;
+        }
+    }
+    t = now_sec() - t;
+    printf("%-24s %8.0f sets/s  (%d commits in %.3fs)\n", "commit per set", vars * rounds / t, commits, t);
+
+    commits = 0;
+    t = now_sec();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < vars; i++) {
+            sprintf(name, "bench_var%zu", i);
+            sprintf(value, "%d-%zu-b", r, i);
+            spp_nvram_set(name, value);
+            spp_nvram_get(name, value, sizeof(value));
+        }
+        commits += spp_nvram_commit() > 0;
+    }
+    t = now_sec() - t;
+    printf("%-24s %8.0f sets/s  (%d commits in %.3fs)\n", "commit per batch", vars * rounds / t, commits, t);
+
+    unlink("/tmp/spp_nvram_bench");
+    return 0;
+}
+
+typedef struct {
+    spp_ring *ring;
+    int fd;                 /* socketpair end, -1 for the ring */
+    size_t count;           /* records per producer */
+    int producers;
+    int flags;              /* SPP_RING_F_DONE: wait for every record */
+} RING_BENCH;
+
+/* The daemon side: drain, sleep on the eventfd when empty */
+static void *ring_consumer(void *arg)
+{
+    RING_BENCH *b = arg;
+    struct pollfd pfd = { spp_ring_evfd(b->ring), POLLIN, 0 };
+    spp_ring_rec rec;
+    size_t total = b->count * b->producers, n = 0;
+    uint32_t ticket;
+
+    while (n < total) {
+        if (spp_ring_pop(b->ring, &rec, &ticket)) {
+            if (rec.flags & SPP_RING_F_DONE) {
+                spp_ring_complete(b->ring, ticket, n);
+            }
+            n++;
+            continue;
+        }
+        pfd.revents = 0;
+        if (spp_ring_idle(b->ring)) {
+            poll(&pfd, 1, 100);
+        }
+        spp_ring_woken(b->ring, pfd.revents & POLLIN);
+    }
+    return NULL;
+}
+
+static void *ring_producer(void *arg)
+{
+    RING_BENCH *b = arg;
+    char *argv[] = {"on", "led1"};
+    uint32_t ticket;
+    size_t i = 0;
+    int code;
+
+    for (i = 0; i < b->count; i++) {
+        while (spp_ring_push(b->ring, 1, 2, argv, b->flags, &ticket) == -EAGAIN) {
+            sched_yield();
+        }
+        if (b->flags & SPP_RING_F_DONE) {
+            spp_ring_wait(b->ring, ticket, -1, &code);
+        }
+    }
+    return NULL;
+}
+
+/* The same records over a socket, one write() each, as a baseline */
+static void *sock_consumer(void *arg)
+{
+    RING_BENCH *b = arg;
+    spp_ring_rec rec;
+    size_t i = 0;
+    int code = 0;
+
+    for (i = 0; i < b->count; i++) {
+        if (read(b->fd, &rec, sizeof(rec)) != sizeof(rec)) {
+            break;
+        }
+        if ((b->flags & SPP_RING_F_DONE) && write(b->fd, &code, sizeof(code)) < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double ring_run(RING_BENCH *b, int socket_pair)
+{
+    pthread_t cons, prod[4];
+    RING_BENCH peer = *b;
+    spp_ring_rec rec = { 0 };
+    int sv[2], code;
+    size_t i = 0;
+    double t;
+
+    if (socket_pair) {
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+            return -1;
+        }
+        peer.fd = sv[1];
+        pthread_create(&cons, NULL, sock_consumer, &peer);
+        t = now_sec();
+        for (i = 0; i < b->count; i++) {
+            if (write(sv[0], &rec, sizeof(rec)) < 0 ||
+                    ((b->flags & SPP_RING_F_DONE) && read(sv[0], &code, sizeof(code)) < 0)) {
+                break;
+            }
+        }
+        pthread_join(cons, NULL);
+        t = now_sec() - t;
+        close(sv[0]);
+        close(sv[1]);
+        return t;
+    }
+
+    pthread_create(&cons, NULL, ring_consumer, b);
+    t = now_sec();
+    for (i = 0; i < (size_t)b->producers; i++) {
+        pthread_create(&prod[i], NULL, ring_producer, b);
+    }
+    for (i = 0; i < (size_t)b->producers; i++) {
+        pthread_join(prod[i], NULL);
+    }
+    pthread_join(cons, NULL);
+    return now_sec() - t;
+}
+
+/* MB of 64 byte records per producer and round */
+static int bench_ring(size_t size, int rounds)
+{
+    static const struct {
+        const char *name;
+        int socket_pair, producers, flags;
+    } runs[] = {
+        {"socket, 1 producer", 1, 1, 0},
+        {"ring, 1 producer", 0, 1, 0},
+        {"ring, 4 producers", 0, 4, 0},
+        {"socket round trip", 1, 1, SPP_RING_F_DONE},
+        {"ring round trip", 0, 1, SPP_RING_F_DONE},
+    };
+    const char *names[] = {"help", "sample"};
+    RING_BENCH b;
+    double t, sec;
+    size_t k = 0;
+    int r;
+
+    memset(&b, 0, sizeof(b));
+    if ((b.ring = spp_ring_create(names, 2)) == NULL) {
+        printf("ring create fail: %s\n", strerror(errno));
+        return 1;
+    }
+    b.count = size / sizeof(spp_ring_rec);
+
+    for (k = 0; k < sizeof(runs) / sizeof(runs[0]); k++) {
+        b.producers = runs[k].producers;
+        b.flags = runs[k].flags;
+        // a round trip per record is slow, fewer of them
+        b.count = size / sizeof(spp_ring_rec) / (b.flags ? 16 : 1);
+        for (r = 0, sec = 0; r < rounds; r++) {
+            if ((t = ring_run(&b, runs[k].socket_pair)) < 0) {
+                printf("%s: %s\n", runs[k].name, strerror(errno));
+                break;
+            }
+            sec += t;
+        }
+        printf("%-24s %8.2f Mrec/s  (%d x %zu records in %.3fs)\n", runs[k].name,
+                (double)b.count * b.producers * rounds / sec / 1e6, rounds, b.count * b.producers, sec);
+    }
+    spp_ring_close(b.ring);
+    return 0;
+}
+
+/* fork, exec and wait for one command, its output goes to /dev/null */
+static int run_once(char **argv)
+{
+    pid_t pid;
+    int status = 0, fd;
+
+    switch (pid = fork()) {
+        case -1:
+            return -1;
+        case 0:
+            if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+            }
+            execv(argv[0], argv);
+            _exit(127);
+        default:
+            waitpid(pid, &status, 0);
+            return WIFEXITED(status) && WEXITSTATUS(status) == 127 ? -1 : 0;
+    }
+}
+
+/*
+ * Startup cost of the builds in the current directory ("make x86 links
+ * x86-static"), rounds x 10 runs of the cheapest command each
+ */
+static int bench_startup(size_t size, int rounds)
+{
+    static char *runs[][3] = {
+        {"./sppCtrl", "version", NULL},
+        {"./spp-version", NULL, NULL},
+        {"./sppCtrl-static", "version", NULL},
+    };
+    size_t k = 0;
+    int i = 0, count = rounds * 10;
+    double t;
+
+    for (k = 0; k < sizeof(runs) / sizeof(runs[0]); k++) {
+        if (access(runs[k][0], X_OK) < 0) {
+            printf("%-24s not built\n", runs[k][0]);
+            continue;
+        }
+        t = now_sec();
+        for (i = 0; i < count; i++) {
+            if (run_once(runs[k]) < 0) {
+                break;
+            }
+        }
+        t = now_sec() - t;
+        printf("%-24s %8.0f us/run  (%d runs in %.3fs)\n", runs[k][0], t / i * 1e6, i, t);
+    }
+    return 0;
+}
+
+/* Cost of one traffic counter sample of all interfaces, rounds x 100 */
+static int bench_ifstats(size_t size, int rounds)
+{
+    spp_ifstat st[IFSTATS_MAX];
+    int i = 0, n = 0, count = rounds * 100;
+    double t;
+
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        if ((n = spp_ifstats_sample(st, IFSTATS_MAX)) < 0) {
+            printf("spp_ifstats_sample fail: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    t = now_sec() - t;
+    printf("%-24s %8.1f us/sample  (%d interfaces, %d samples in %.3fs)\n", "rtnetlink dump", t / count * 1e6, n, count, t);
+    return 0;
+}
+
+/* A shell command through fork + exec + sh startup and through the coprocess */
+static int bench_coproc(size_t size, int rounds)
+{
+    spp_sh *sh = spp_sh_new();
+    int i = 0, count = rounds * 100;
+    double t, fork_us;
+
+    if (sh == NULL) {
+        return 1;
+    }
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        _evalsh("true");
+    }
+    t = now_sec() - t;
+    fork_us = t / count * 1e6;
+    printf("%-24s %8.1f us/cmd  (%d cmds in %.3fs)\n", "_evalsh", fork_us, count, t);
+
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        if (spp_sh_run(sh, NULL, 0, "true") != 0) {
+            printf("spp_sh_run fail\n");
+            spp_sh_free(sh);
+            return 1;
+        }
+    }
+    t = now_sec() - t;
+    printf("%-24s %8.1f us/cmd  (%d cmds in %.3fs, %.1fx)\n", "spp_sh_run", t / count * 1e6, count, t,
+            fork_us / (t / count * 1e6));
+    spp_sh_free(sh);
+    return 0;
+}
+
+/*
+ * 16 link changes one ioctl() each and as one netlink batch. The MTU of lo
+ * goes one down and back so every op is a real change and lo ends as it
+ * was, needs CAP_NET_ADMIN.
+ */
+static int bench_nlbatch(size_t size, int rounds)
+{
+    spp_nl_batch *b = spp_nl_batch_new();
+    struct ifreq req;
+    int i = 0, k = 0, ops = 16, count = rounds * 100, mtu = 0;
+    double t;
+
+    memset(&req, 0, sizeof(req));
+    strcpy(req.ifr_name, "lo");
+    if (b == NULL || ioctl(spp_if_sock(), SIOCGIFMTU, &req) < 0) {
+        printf("lo: %s\n", strerror(errno));
+        spp_nl_batch_free(b);
+        return 1;
+    }
+    mtu = req.ifr_mtu;
+
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < ops; k++) {
+            if (spp_if_set_mtu("lo", mtu - (~k & 1)) < 0) {
+                printf("spp_if_set_mtu fail: %s\n", strerror(errno));
+                spp_nl_batch_free(b);
+                return 1;
+            }
+        }
+    }
+    t = now_sec() - t;
+    printf("%-24s %8.1f us/%d ops  (%d rounds in %.3fs)\n", "ioctl", t / count * 1e6, ops, count, t);
+
+    for (k = 0; k < ops; k++) {
+        spp_nl_link(b, "lo", -1, mtu - (~k & 1));
+    }
+    t = now_sec();
+    for (i = 0; i < count; i++) {
+        if (spp_nl_batch_commit(b) != 0) {
+            printf("spp_nl_batch_commit fail\n");
+            spp_nl_batch_free(b);
+            return 1;
+        }
+    }
+    t = now_sec() - t;
+    printf("%-24s %8.1f us/%d ops  (%d rounds in %.3fs)\n", "netlink batch", t / count * 1e6, ops, count, t);
+    spp_nl_batch_free(b);
+    return 0;
+}
+
+static void *bench_tables[][2] = {
+    {"kv", &bench_kv},
+    {"nvram", &bench_nvram},
+    {"ring", &bench_ring},
+    {"startup", &bench_startup},
+    {"ifstats", &bench_ifstats},
+    {"coproc", &bench_coproc},
+    {"nlbatch", &bench_nlbatch},
+    {NULL, NULL}
+};
+
+int main(int argc, char **argv)
+{
+    size_t mb = BENCH_MB;
+    int rounds = BENCH_ROUNDS;
+    int i;
+
+    if (argc < 2) {
+        printf("Usage: %s <bench> [MB] [rounds]\nBench:\n", argv[0]);
+        for (i = 0; bench_tables[i][0]; i++) {
+            printf("\t%s\n", (char *)bench_tables[i][0]);
+        }
+        return 1;
+    }
+    if (argc > 2) {
+        mb = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        rounds = atoi(argv[3]);
+    }
+
+    for (i = 0; bench_tables[i][0]; i++) {
+        if (!strcmp(argv[1], bench_tables[i][0])) {
+            return ((BENCH)bench_tables[i][1])(mb * 1024 * 1024, rounds > 0 ? rounds : 1);
+        }
+    }
+    printf("%s: unknown bench '%s'\n", argv[0], argv[1]);
+    return 1;
+}
@@ -0,0 +1,314 @@
+/*
+ * coproc.c
+ *
+ * The shell reads commands from one end of a socketpair and writes to it,
+ * see coproc.h. Every command is wrapped as
+ *
+ *	{
+ *	<command line>
+ *	} </dev/null; printf '\n%s %d\n' __spp_<token>_<seq>__ "$?"
+ *
+ * and its output ends at the sentinel line. The token is random per
+ * shell, so command output can not end a frame by accident. A shell that
+ * exits (syntax error, "exit") is reaped and started again on the next
+ * command; one that does not answer in time is killed with its process
+ * group.
+ *
+ */
+
+#define _GNU_SOURCE     /* memmem */
+#include <config.h>
+#include <sppCtrl.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <coproc.h>
+#include <timestamp.h>
+
+#define SH_PATH         "/bin/sh"
+#define SH_MARK_LEN     64
+#define SH_READ_CHUNK   4096
+
+struct spp_sh {
+    pthread_mutex_t lock;
+    pid_t pid;
+    int fd;                 /* our end of the socketpair, -1 when not running */
+    unsigned long long token;
+    unsigned int seq;
+};
+
+static unsigned long long sh_token(pid_t pid)
+{
+    unsigned long long token = 0;
+    int fd;
+
+    if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) >= 0) {
+        if (read(fd, &token, sizeof(token)) != sizeof(token)) {
+            token = 0;
+        }
+        close(fd);
+    }
+    return token ^ spp_mono_ns() ^ ((unsigned long long)pid << 40);
+}
+
+static int sh_start(spp_sh *sh)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        return -1;
+    }
+    switch (pid = fork()) {
+        case -1:
+            close(sv[0]);
+            close(sv[1]);
+            return -1;
+        case 0:
+            // own process group, a hung command goes down with the shell
+            setpgid(0, 0);
+            dup2(sv[1], STDIN_FILENO);
+            dup2(sv[1], STDOUT_FILENO);
+            execl(SH_PATH, "sh", (char *)NULL);
+            _exit(127);
+        default:
+            break;
+    }
+    setpgid(pid, pid);
+    close(sv[1]);
+    sh->pid = pid;
+    sh->fd = sv[0];
+    sh->token = sh_token(pid);
+    sh->seq = 0;
+    return 0;
+}
+
+/*
+ * Reap the shell and whatever it left running
+ * @return	wait status of the shell
+ */
+static int sh_stop(spp_sh *sh, int force)
+{
+    int status = 0;
+
+    if (sh->fd < 0) {
+        return 0;
+    }
+    close(sh->fd);
+    sh->fd = -1;
+    if (force) {
+        kill(-sh->pid, SIGKILL);
+    }
+    // without force the shell has closed the socket and is exiting anyway
+    while (waitpid(sh->pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    kill(-sh->pid, SIGKILL);
+    sh->pid = 0;
+    return status;
+}
+
+spp_sh *spp_sh_new(void)
+{
+    spp_sh *sh = calloc(1, sizeof(spp_sh));
+
+    if (sh == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sh->lock, NULL);
+    sh->fd = -1;
+    return sh;
+}
+
+void spp_sh_free(spp_sh *sh)
+{
+    if (sh == NULL) {
+        return;
+    }
+    sh_stop(sh, 1);
+    pthread_mutex_destroy(&sh->lock);
+    free(sh);
+}
+
+static int sh_send(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Wait for input until deadline (0: forever), 0 at the deadline */
+static int sh_wait(int fd, uint64_t deadline)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint64_t now;
+    int n;
+
+    do {
+        if (deadline == 0) {
+            n = poll(&pfd, 1, -1);
+        } else if ((now = spp_mono_ns()) >= deadline) {
+            return 0;
+        } else {
+            n = poll(&pfd, 1, (deadline - now + 999999) / 1000000);
+        }
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/*
+ * Read command output into acc until the sentinel line
+ * @param	keep	0 to drop the output, acc then only holds a tail
+ * @return	exit code, EVAL_TIMEDOUT, or -2 when the shell went away
+ */
+static int sh_collect(spp_sh *sh, spp_out *acc, int keep, const char *mark, size_t marklen, uint64_t deadline)
+{
+    char buf[SH_READ_CHUNK];
+    char *p = NULL;
+    size_t scan = acc->len;
+    ssize_t n;
+
+    for (;;) {
+        if ((n = sh_wait(sh->fd, deadline)) == 0) {
+            return EVAL_TIMEDOUT;
+        }
+        n = n < 0 ? -1 : read(sh->fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0 || spp_out_append(acc, buf, n) < 0) {
+            return -2;
+        }
+
+        // the sentinel may straddle two reads
+        if ((p = memmem(acc->buf + scan, acc->len - scan, mark, marklen)) != NULL) {
+            if (memchr(p + marklen, '\n', acc->buf + acc->len - p - marklen) == NULL) {
+                // the exit code is still on its way
+                scan = p - acc->buf;
+                continue;
+            }
+            acc->len = p - acc->buf;
+            acc->buf[acc->len] = '\0';
+            return atoi(p + marklen);
+        }
+        scan = acc->len > scan + marklen ? acc->len - marklen : scan;
+        if (!keep && scan) {
+            memmove(acc->buf, acc->buf + scan, acc->len - scan);
+            acc->len -= scan;
+            scan = 0;
+        }
+    }
+}
+
+int spp_sh_run(spp_sh *sh, spp_out *out, int timeout_ms, const char *cmd)
+{
+    uint64_t deadline = timeout_ms > 0 ? spp_mono_ns() + timeout_ms * 1000000ULL : 0;
+    spp_out script = {0}, drop = {0};
+    spp_out *acc = out ? out : &drop;
+    char mark[SH_MARK_LEN];
+    size_t base = acc->len;
+    int marklen = 0, ret = -1, status = 0;
+
+    pthread_mutex_lock(&sh->lock);
+    if (sh->fd < 0 && sh_start(sh) < 0) {
+        pthread_mutex_unlock(&sh->lock);
+        return -1;
+    }
+    sh->seq++;
+    marklen = snprintf(mark, sizeof(mark), "\n__spp_%016llx_%u__ ", sh->token, sh->seq);
+    if (spp_out_puts(&script, "{\n") < 0 || spp_out_puts(&script, cmd) < 0 ||
+            spp_out_puts(&script, "\n} </dev/null; printf '\\n%s %d\\n' ") < 0 ||
+            spp_out_append(&script, mark + 1, marklen - 2) < 0 || spp_out_puts(&script, " \"$?\"\n") < 0) {
+        spp_out_free(&script);
+        pthread_mutex_unlock(&sh->lock);
+        return -1;
+    }
+
+    if (sh_send(sh->fd, script.buf, script.len) < 0) {
+        ret = -2;
+    } else {
+        ret = sh_collect(sh, acc, out != NULL, mark, marklen, deadline);
+    }
+
+    if (ret == EVAL_TIMEDOUT) {
+        sh_stop(sh, 1);
+    } else if (ret == -2) {
+        // the command ended the shell: report how, like sh -c would
+        status = sh_stop(sh, 0);
+        ret = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+    if (out && ret < 0 && ret != EVAL_TIMEDOUT) {
+        // half an output is no output
+        out->len = base;
+        if (out->buf) {
+            out->buf[base] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    spp_out_free(&script);
+    spp_out_free(&drop);
+    return ret;
+}
+
+int spp_sh_evalsh(spp_sh *sh, int timeout_ms, const char *fmt, ...)
+{
+    spp_out cmd = {0}, out = {0};
+    va_list args;
+    int ret = -1;
+
+    va_start(args, fmt);
+    ret = vasprintf(&cmd.buf, fmt, args);
+    va_end(args);
+    if (ret < 0) {
+        return -1;
+    }
+    ret = spp_sh_run(sh, &out, timeout_ms, cmd.buf);
+    if (out.len < SPP_CHAN_FLUSH) {
+        SPP_PRINT("%.*s", (int)out.len, out.buf ? out.buf : "");
+    } else {
+        spp_putref(out.buf, out.len);
+        spp_flush();
+    }
+    free(cmd.buf);
+    spp_out_free(&out);
+    return ret;
+}
+
+char *spp_sh_backticksh(spp_sh *sh, int timeout_ms, const char *fmt, ...)
+{
+    spp_out out = {0};
+    va_list args;
+    char *cmd = NULL;
+    int ret = -1;
+
+    va_start(args, fmt);
+    ret = vasprintf(&cmd, fmt, args);
+    va_end(args);
+    if (ret < 0) {
+        return NULL;
+    }
+    ret = spp_sh_run(sh, &out, timeout_ms, cmd);
+    free(cmd);
+    if (ret == EVAL_TIMEDOUT || ret == -1) {
+        spp_out_free(&out);
+        errno = ret == EVAL_TIMEDOUT ? ETIMEDOUT : EIO;
+        return NULL;
+    }
+    // backticksh() returns "" for a silent command as well
+    if (out.buf == NULL && spp_out_append(&out, "", 0) < 0) {
+        return NULL;
+    }
+    return out.buf;
+}
@@ -0,0 +1,1103 @@
+/*
+ * daemon.c
+ *
+ * Single poll() loop: accepts connections, cuts frames and hands requests
+ * to the worker pool. Completed requests come back through a pipe and their
+ * SPP_PRINT() output is sent from the loop. A request with more output
+ * than SPP_CHAN_FLUSH streams it: the worker takes the socket for one frame
+ * at a time and writes it with writev() or splice(), without going through
+ * the connection buffer. Commands queued on the shared ring (ring.h) are
+ * drained from the same loop, up to DAEMON_RING_BATCH per turn. Features
+ * flagged CMD_ASYNC run on the loop itself as tasks (async.h) and answer
+ * once they return, their output is not streamed.
+ *
+ */
+
+#define _GNU_SOURCE     /* splice */
+#include <config.h>
+#include <sppCtrl.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <async.h>
+#include <daemon.h>
+#include <journal.h>
+#include <memstat.h>
+#include <pool.h>
+#include <ring.h>
+#include <sppclient.h>
+#include <timestamp.h>
+
+#define DAEMON_MAX_ARGS 32
+#define DAEMON_STREAM_TIMEOUT_MS    5000    /* a client this slow is dropped */
+#define DAEMON_RING_BATCH   64      /* ring commands per loop turn */
+
+extern void *cmd_tables[CMD_NUM][CMD_LEN];
+
+/*
+ * lock protects wbuf, woff, busy and closed; workers streaming a frame set
+ * busy and own fd until they clear it. refs is only used by the loop.
+ */
+struct spp_conn {
+    int fd;
+    int refs;           /* conns table and requests in the pool */
+    spp_out rbuf;
+    spp_out wbuf;
+    size_t woff;        /* bytes of wbuf already written */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int busy;
+    int closed;
+    pid_t pid;          /* peer, for the journal */
+    uid_t uid;
+};
+
+static spp_conn *conns[DAEMON_MAX_CONN];
+static spp_ring *ring = NULL;     /* created by the first SPP_MSG_RING */
+static volatile sig_atomic_t daemon_quit = 0;
+static int daemon_is_self = 0;
+
+static int help(int, char **);
+static char *help_str[] = {
+"Example:\n"
+"\t[CMD] daemon start\n"
+"Command:\n"
+};
+
+typedef int (*FUNC)(int, char **);
+
+int spp_daemon_self(void)
+{
+    return daemon_is_self;
+}
+
+static void conn_put(spp_conn *c)
+{
+    if (--c->refs > 0) {
+        return;
+    }
+    close(c->fd);
+    spp_out_free(&c->rbuf);
+    spp_out_free(&c->wbuf);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c);
+}
+
+static void conn_close(spp_conn *c)
+{
+    int i = 0;
+
+    watch_remove(c);
+    for (i = 0; i < DAEMON_MAX_CONN; i++) {
+        if (conns[i] == c) {
+            conns[i] = NULL;
+        }
+    }
+    pthread_mutex_lock(&c->lock);
+    c->closed = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    // the socket stays open while a worker may still write to it
+    conn_put(c);
+}
+
+/* Write as much of wbuf as the socket takes, -1 if the peer is gone */
+static int conn_flush_locked(spp_conn *c)
+{
+    ssize_t n;
+
+    // a worker is in the middle of a frame
+    if (c->busy) {
+        return 0;
+    }
+    while (c->woff < c->wbuf.len) {
+        n = write(c->fd, c->wbuf.buf + c->woff, c->wbuf.len - c->woff);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->woff += n;
+    }
+    spp_out_reset(&c->wbuf);
+    c->woff = 0;
+    // streaming workers wait for an empty wbuf
+    pthread_cond_broadcast(&c->cond);
+    return 0;
+}
+
+static int conn_flush(spp_conn *c)
+{
+    int ret;
+
+    pthread_mutex_lock(&c->lock);
+    ret = conn_flush_locked(c);
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+int spp_conn_send(spp_conn *c, spp_msg_hdr *hdr, const void *data, size_t len)
+{
+    int ret = -1;
+
+    hdr->len = len;
+    pthread_mutex_lock(&c->lock);
+    if (!c->closed && spp_out_append(&c->wbuf, hdr, sizeof(spp_msg_hdr)) == 0 &&
+            (len == 0 || spp_out_append(&c->wbuf, data, len) == 0)) {
+        ret = conn_flush_locked(c);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+size_t spp_conn_pending(spp_conn *c)
+{
+    size_t n;
+
+    pthread_mutex_lock(&c->lock);
+    n = c->wbuf.len - c->woff;
+    pthread_mutex_unlock(&c->lock);
+    return n;
+}
+
+/* Bytes the loop should wait to write, none while a worker owns the socket */
+static int conn_want_write(spp_conn *c)
+{
+    int ret;
+
+    pthread_mutex_lock(&c->lock);
+    ret = !c->busy && c->wbuf.len > c->woff;
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+/*
+ * Take the socket for one frame, after everything the loop queued
+ * @return	0 on success and -1 if the connection is closed
+ */
+static int conn_claim(spp_conn *c)
+{
+    pthread_mutex_lock(&c->lock);
+    while (!c->closed && (c->busy || c->wbuf.len > c->woff)) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if (c->closed) {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    c->busy = 1;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+static void conn_release(spp_conn *c, int broken)
+{
+    int queued = 0;
+
+    if (broken) {
+        // half a frame went out, the loop sees the hangup and drops it
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    pthread_mutex_lock(&c->lock);
+    c->busy = 0;
+    queued = c->wbuf.len > c->woff;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    if (queued) {
+        // the loop skipped this connection while it was busy
+        spp_pool_wake();
+    }
+}
+
+static int conn_wait_writable(int fd)
+{
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    int n;
+
+    while ((n = poll(&pfd, 1, DAEMON_STREAM_TIMEOUT_MS)) < 0 && errno == EINTR)
+        ;
+    return n > 0 && !(pfd.revents & (POLLERR | POLLHUP)) ? 0 : -1;
+}
+
+/* writev() all of iov to the nonblocking socket */
+static int conn_writev_all(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t n;
+    int idx = 0;
+
+    while (idx < cnt) {
+        n = writev(fd, iov + idx, cnt - idx);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (conn_wait_writable(fd) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        while (idx < cnt && (size_t)n >= iov[idx].iov_len) {
+            n -= iov[idx].iov_len;
+            idx++;
+        }
+        if (idx < cnt) {
+            iov[idx].iov_base = (char *)iov[idx].iov_base + n;
+            iov[idx].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Output chunk of a streaming request to each client, cut into OUT frames
+ * of at most DAEMON_MAX_FRAME bytes as the clients refuse longer ones
+ */
+static int stream_writev(spp_chan *ch, const struct iovec *iov, int cnt, size_t len)
+{
+    struct iovec frame[SPP_CHAN_SEGS], v[SPP_CHAN_SEGS + 1];
+    spp_req *r = ch->priv, *j = NULL;
+    spp_msg_hdr hdr;
+    size_t size = 0, left = 0, off = 0;
+    int i = 0, n = 0;
+
+    spp_pool_streaming(r);
+    while (len) {
+        size = MIN(len, DAEMON_MAX_FRAME);
+        for (n = 0, left = size; left && i < cnt; ) {
+            frame[n].iov_base = (char *)iov[i].iov_base + off;
+            frame[n].iov_len = MIN(iov[i].iov_len - off, left);
+            left -= frame[n].iov_len;
+            off += frame[n].iov_len;
+            if (frame[n].iov_len) {
+                n++;
+            }
+            if (off == iov[i].iov_len) {
+                i++;
+                off = 0;
+            }
+        }
+        size -= left;
+        if (size == 0) {
+            break;
+        }
+        for (j = r; j; j = j->join) {
+            // a command from the ring has nobody to print to
+            if (j->conn == NULL || conn_claim(j->conn) < 0) {
+                continue;
+            }
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.len = size;
+            hdr.id = j->id;
+            hdr.type = SPP_MSG_OUT;
+            v[0].iov_base = &hdr;
+            v[0].iov_len = sizeof(hdr);
+            memcpy(v + 1, frame, n * sizeof(struct iovec));
+            conn_release(j->conn, conn_writev_all(j->conn->fd, v, n + 1) < 0);
+        }
+        len -= size;
+    }
+    return 0;
+}
+
+/* Read len bytes of fd into o, or drop them when o is NULL */
+static ssize_t stream_read(int fd, spp_out *o, size_t len)
+{
+    char buf[4096];
+    ssize_t n;
+    size_t left = len;
+
+    while (left && (n = read(fd, buf, MIN(left, sizeof(buf)))) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || (o && spp_out_append(o, buf, n) < 0)) {
+            return -1;
+        }
+        left -= n;
+    }
+    return len - left;
+}
+
+/* Child output of a streaming request, moved from the pipe to the socket */
+static ssize_t stream_splice(spp_chan *ch, int fd, size_t len)
+{
+    spp_req *r = ch->priv;
+    spp_msg_hdr hdr;
+    struct iovec iov;
+    spp_out copy = {0};
+    size_t left = len;
+    ssize_t n = 0;
+    int broken = 0;
+
+    // one frame, the rest stays in the pipe for the next call
+    len = MIN(len, DAEMON_MAX_FRAME);
+    left = len;
+    spp_pool_streaming(r);
+    if (r->join) {
+        // one pipe can not be spliced to several sockets
+        if ((n = stream_read(fd, &copy, len)) > 0) {
+            iov.iov_base = copy.buf;
+            iov.iov_len = copy.len;
+            stream_writev(ch, &iov, 1, copy.len);
+        }
+        spp_out_free(&copy);
+        return n;
+    }
+    if (conn_claim(r->conn) < 0) {
+        return stream_read(fd, NULL, len);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = len;
+    hdr.id = r->id;
+    hdr.type = SPP_MSG_OUT;
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    broken = conn_writev_all(r->conn->fd, &iov, 1) < 0;
+
+    while (!broken && left) {
+        n = splice(fd, NULL, r->conn->fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            broken = conn_wait_writable(r->conn->fd) < 0;
+            continue;
+        }
+        if (n <= 0) {
+            broken = 1;
+            break;
+        }
+        left -= n;
+    }
+    conn_release(r->conn, broken);
+    // the rest of the chunk is still in the pipe
+    if (left) {
+        stream_read(fd, NULL, left);
+    }
+    return len;
+}
+
+/* Split NUL separated payload into argv, returns argc */
+static int msg_argv(char *data, size_t len, char **argv, int max)
+{
+    char *p = data, *end = data + len;
+    int argc = 0;
+
+    while (p < end && argc < max - 1) {
+        argv[argc++] = p;
+        p += strlen(p) + 1;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/* Send the output of r and its joined requests, the client may be gone already */
+static void req_reply(spp_req *r)
+{
+    spp_msg_hdr hdr;
+    spp_req *j = NULL;
+    size_t off = 0, n = 0;
+
+    for (j = r; j; j = j->join) {
+        if (j->conn == NULL) {
+            if (j->ring_flags & SPP_RING_F_DONE) {
+                spp_ring_complete(ring, j->id, r->ret);
+            }
+            continue;
+        }
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.id = j->id;
+        // a streamed request has sent all of its output already
+        for (off = 0; off < r->out.len; off += n) {
+            n = MIN(r->out.len - off, DAEMON_MAX_FRAME);
+            hdr.type = SPP_MSG_OUT;
+            spp_conn_send(j->conn, &hdr, r->out.buf + off, n);
+        }
+        hdr.type = SPP_MSG_END;
+        hdr.code = r->ret;
+        spp_conn_send(j->conn, &hdr, NULL, 0);
+        conn_put(j->conn);
+    }
+}
+
+/* An async request returned, see run_request() */
+static void task_done(void *arg, int ret)
+{
+    spp_req *r = arg;
+
+    r->ret = ret;
+    spp_journal_caller(r->pid, r->uid, 0);
+    spp_journal_log(r->argc, r->argv, r->queued_ns, ret);
+    spp_journal_caller(0, 0, 0);
+    req_reply(r);
+    spp_req_free(r);
+    spp_nvram_commit_later();
+    watch_changed();
+}
+
+static void run_request(spp_conn *c, spp_msg_hdr *req, char *data)
+{
+    spp_msg_hdr hdr;
+    spp_req *r = NULL;
+
+    if ((r = spp_req_new(data, req->len)) != NULL) {
+        r->id = req->id;
+        r->conn = c;
+        r->pid = c->pid;
+        r->uid = c->uid;
+        r->queued_ns = spp_mono_ns();
+        c->refs++;
+        if (r->feature >= 0 && r->feature < CMD_NUM && ((long)cmd_tables[r->feature][3] & CMD_ASYNC)
+                && spp_task_start(r->feature, r->argc, r->argv, &r->out, task_done, r) == 0) {
+            return;
+        }
+        // table full or a blocking subcommand: the pool runs it from the start
+        spp_out_reset(&r->out);
+        r->chan.writev = stream_writev;
+        r->chan.splice = stream_splice;
+        r->chan.priv = r;
+        r->out.chan = &r->chan;
+        if (spp_pool_submit(r) == 0) {
+            return;
+        }
+        c->refs--;
+        spp_req_free(r);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.id = req->id;
+    hdr.type = SPP_MSG_END;
+    hdr.code = SPP_FAIL;
+    spp_conn_send(c, &hdr, NULL, 0);
+}
+
+/* Send the output of completed requests */
+static void run_done(void)
+{
+    spp_req *r = NULL;
+    int count = 0;
+
+    while ((r = spp_pool_done()) != NULL) {
+        req_reply(r);
+        spp_req_free(r);
+        count++;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    // coalesce NVRAM commits of back to back requests
+    spp_nvram_commit_later();
+
+    // the requests may have changed what watchers see
+    watch_changed();
+}
+
+static void run_watch(spp_conn *c, spp_msg_hdr *req, char *data)
+{
+    char *features[DAEMON_MAX_ARGS];
+    spp_msg_hdr hdr;
+    int count = 0;
+
+    count = msg_argv(data, req->len, features, DAEMON_MAX_ARGS);
+    if (watch_add(c, req->id, features, count) == SPP_FAIL) {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.id = req->id;
+        hdr.type = SPP_MSG_END;
+        hdr.code = SPP_FAIL;
+        spp_conn_send(c, &hdr, NULL, 0);
+    }
+}
+
+/*
+ * Send a frame with fds attached to its first byte, only on a connection
+ * with nothing queued before it
+ * @return	0 on success and -1 on failure
+ */
+static int conn_send_fds(spp_conn *c, spp_msg_hdr *hdr, int *fds, int count)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } ctl;
+    struct msghdr msg;
+    struct cmsghdr *cm = NULL;
+    struct iovec iov;
+    ssize_t n = -1;
+
+    hdr->len = 0;
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof(spp_msg_hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, count * sizeof(int));
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->closed && !c->busy && c->wbuf.len == c->woff) {
+        while ((n = sendmsg(c->fd, &msg, 0)) < 0 && errno == EINTR)
+            ;
+    }
+    // the fds went with the first byte, the rest of the header is plain data
+    if (n > 0 && (size_t)n < sizeof(spp_msg_hdr)) {
+        spp_out_append(&c->wbuf, (char *)hdr + n, sizeof(spp_msg_hdr) - n);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return n > 0 ? 0 : -1;
+}
+
+/* Hand the ring to a client, the ring is created on first use */
+static void run_ring(spp_conn *c, spp_msg_hdr *req)
+{
+    const char *names[SPP_RING_FEATURES];
+    spp_msg_hdr hdr;
+    int fds[2];
+    int i = 0;
+
+    if (ring == NULL) {
+        for (i = 0; i < SPP_RING_FEATURES && cmd_tables[i][0]; i++) {
+            names[i] = cmd_tables[i][0];
+        }
+        ring = spp_ring_create(names, i);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.id = req->id;
+    hdr.type = SPP_MSG_END;
+    hdr.code = SPP_OK;
+    if (ring) {
+        fds[0] = spp_ring_memfd(ring);
+        fds[1] = spp_ring_evfd(ring);
+        if (conn_send_fds(c, &hdr, fds, 2) == 0) {
+            return;
+        }
+    }
+    hdr.code = SPP_FAIL;
+    spp_conn_send(c, &hdr, NULL, 0);
+}
+
+/* Queue up to DAEMON_RING_BATCH ring commands on the pool */
+static void ring_drain(void)
+{
+    spp_ring_rec rec;
+    spp_req *r = NULL;
+    char data[32 + SPP_RING_ARGS];
+    const char *name = NULL;
+    uint32_t ticket = 0;
+    size_t len = 0;
+    int i = 0;
+
+    for (i = 0; i < DAEMON_RING_BATCH && spp_ring_pop(ring, &rec, &ticket); i++) {
+        // the same payload a client would have sent: sppCtrl <feature> args
+        r = NULL;
+        name = rec.feature < SPP_RING_FEATURES ? cmd_tables[rec.feature][0] : NULL;
+        if (name && (len = strlen(name)) < 24) {
+            memcpy(data, "sppCtrl", 8);
+            memcpy(data + 8, name, len + 1);
+            memcpy(data + 8 + len + 1, rec.args, rec.len);
+            r = spp_req_new(data, 8 + len + 1 + rec.len);
+        }
+        if (r) {
+            r->id = ticket;
+            r->ring_flags = rec.flags;
+            if (spp_pool_submit(r) == 0) {
+                continue;
+            }
+            spp_req_free(r);
+        }
+        if (rec.flags & SPP_RING_F_DONE) {
+            spp_ring_complete(ring, ticket, SPP_FAIL);
+        }
+    }
+}
+
+/* Handle every complete frame in rbuf, -1 drops the connection */
+static int conn_input(spp_conn *c)
+{
+    spp_msg_hdr hdr;
+    size_t off = 0;
+    char *data = NULL;
+
+    while (c->rbuf.len - off >= sizeof(spp_msg_hdr)) {
+        memcpy(&hdr, c->rbuf.buf + off, sizeof(hdr));
+        if (hdr.len > DAEMON_MAX_FRAME) {
+            return -1;
+        }
+        if (c->rbuf.len - off < sizeof(hdr) + hdr.len) {
+            break;
+        }
+        // payload is handed out as strings
+        data = c->rbuf.buf + off + sizeof(hdr);
+        if (hdr.len && data[hdr.len - 1] != '\0') {
+            return -1;
+        }
+        switch (hdr.type) {
+            case SPP_MSG_REQ:
+                run_request(c, &hdr, data);
+                break;
+            case SPP_MSG_WATCH:
+                run_watch(c, &hdr, data);
+                break;
+            case SPP_MSG_RING:
+                run_ring(c, &hdr);
+                break;
+            default:
+                return -1;
+        }
+        off += sizeof(hdr) + hdr.len;
+    }
+    if (off) {
+        memmove(c->rbuf.buf, c->rbuf.buf + off, c->rbuf.len - off);
+        c->rbuf.len -= off;
+    }
+    return 0;
+}
+
+static int conn_read(spp_conn *c)
+{
+    char buf[4096];
+    ssize_t n;
+
+    n = read(c->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return 0;
+    }
+    if (n <= 0 || spp_out_append(&c->rbuf, buf, n) < 0) {
+        return -1;
+    }
+    return conn_input(c);
+}
+
+static void conn_accept(int lfd)
+{
+    struct ucred cred = { -1, (uid_t)-1, (gid_t)-1 };
+    socklen_t len = sizeof(cred);
+    spp_conn *c = NULL;
+    int fd, i = 0;
+
+    if ((fd = accept(lfd, NULL, NULL)) < 0) {
+        return;
+    }
+    for (i = 0; i < DAEMON_MAX_CONN && conns[i]; i++)
+        ;
+    if (i == DAEMON_MAX_CONN || (c = calloc(1, sizeof(spp_conn))) == NULL) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    c->fd = fd;
+    c->refs = 1;
+    // unknown rather than root if the kernel does not tell
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        cred.pid = -1;
+        cred.uid = (uid_t)-1;
+    }
+    c->pid = cred.pid;
+    c->uid = cred.uid;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    conns[i] = c;
+}
+
+static int daemon_listen(void)
+{
+    struct sockaddr_un addr;
+    mode_t mask;
+    int fd, ret;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return SPP_FAIL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DAEMON_SOCK_PATH, sizeof(addr.sun_path) - 1);
+    unlink(DAEMON_SOCK_PATH);
+    // requests run as the daemon user, whatever umask it was started with
+    mask = umask(0777 & ~DAEMON_SOCK_MODE);
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (ret < 0 || chmod(DAEMON_SOCK_PATH, DAEMON_SOCK_MODE) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return SPP_FAIL;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void daemon_signal(int sig)
+{
+    daemon_quit = 1;
+}
+
+/* poll() timeout: the nearest of watch refresh, NVRAM commit and task deadline */
+static int daemon_timeout(void)
+{
+    int w = watch_timeout(), nv = spp_nvram_timeout(), t = spp_task_timeout();
+
+    if (w < 0 || (nv >= 0 && nv < w)) {
+        w = nv;
+    }
+    if (w < 0 || (t >= 0 && t < w)) {
+        w = t;
+    }
+    return w;
+}
+
+static int daemon_loop(void)
+{
+    struct pollfd pfd[DAEMON_MAX_CONN + 3 + SPP_TASK_MAX];
+    spp_conn *pc[DAEMON_MAX_CONN + 3];
+    FILE *fp = NULL;
+    char drain[64];
+    int wake[2] = {-1, -1};
+    int lfd, n, nconn, timeout, i = 0;
+
+    if ((lfd = daemon_listen()) < 0) {
+        SPP_PRINT("Listen on %s fail: %s\n", DAEMON_SOCK_PATH, strerror(errno));
+        return SPP_FAIL;
+    }
+    if (pipe(wake) < 0 || spp_pool_start(0, wake[1]) < 0) {
+        SPP_PRINT("Worker pool start fail: %s\n", strerror(errno));
+        close(wake[0]);
+        close(wake[1]);
+        close(lfd);
+        return SPP_FAIL;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(wake[i], F_SETFL, fcntl(wake[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+    }
+    if ((fp = fopen(DAEMON_PID_FILE, "w")) != NULL) {
+        fprintf(fp, "%d", getpid());
+        fclose(fp);
+    }
+    daemon_is_self = 1;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, daemon_signal);
+    signal(SIGINT, daemon_signal);
+
+    while (!daemon_quit) {
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = wake[0];
+        pfd[1].events = POLLIN;
+        pfd[2].fd = ring ? spp_ring_evfd(ring) : -1;
+        pfd[2].events = POLLIN;
+        pfd[2].revents = 0;
+        for (i = 0, n = 3; i < DAEMON_MAX_CONN; i++) {
+            if (conns[i]) {
+                pc[n] = conns[i];
+                pfd[n].fd = conns[i]->fd;
+                pfd[n].events = POLLIN | (conn_want_write(conns[i]) ? POLLOUT : 0);
+                pfd[n].revents = 0;
+                n++;
+            }
+        }
+        nconn = n;
+        n += spp_task_pollfds(pfd + nconn, SPP_TASK_MAX);
+
+        // producers only signal the eventfd once the ring is idle
+        timeout = ring && !spp_ring_idle(ring) ? 0 : daemon_timeout();
+        if (poll(pfd, n, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // the web UI or a one-shot sppCtrl may have set NVRAM meanwhile
+        spp_nvram_refresh();
+        if (pfd[1].revents & POLLIN) {
+            while (read(wake[0], drain, sizeof(drain)) > 0)
+                ;
+            run_done();
+        }
+        // before new requests start tasks, pfd + nconn matches the table
+        spp_task_poll(pfd + nconn, n - nconn);
+        if (ring) {
+            spp_ring_woken(ring, pfd[2].revents & POLLIN);
+            ring_drain();
+        }
+        for (i = 3; i < nconn; i++) {
+            if (pfd[i].revents & POLLOUT) {
+                if (conn_flush(pc[i]) < 0) {
+                    conn_close(pc[i]);
+                    continue;
+                }
+                watch_writable(pc[i]);
+            }
+            if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (conn_read(pc[i]) < 0) {
+                    conn_close(pc[i]);
+                }
+            }
+        }
+        if (pfd[0].revents & POLLIN) {
+            conn_accept(lfd);
+        }
+        if (watch_timeout() == 0) {
+            watch_refresh();
+        }
+        spp_nvram_tick();
+    }
+
+    spp_pool_stop();
+    spp_nvram_commit();
+    // clients keep their mapping, nothing drains it any more
+    spp_ring_close(ring);
+    ring = NULL;
+
+    for (i = 0; i < DAEMON_MAX_CONN; i++) {
+        if (conns[i]) {
+            conn_close(conns[i]);
+        }
+    }
+    close(wake[0]);
+    close(wake[1]);
+    close(lfd);
+    unlink(DAEMON_SOCK_PATH);
+    unlink(DAEMON_PID_FILE);
+    return SPP_OK;
+}
+
+static int run(int argc, char **argv)
+{
+    if (spp_daemon_self()) {
+        return SPP_FAIL;
+    }
+    spp_unlock();
+    return daemon_loop();
+}
+
+static int start(int argc, char **argv)
+{
+    pid_t pid;
+    int fd = -1, i = 0;
+
+    if (spp_daemon_self()) {
+        return SPP_FAIL;
+    }
+    if ((fd = spp_daemon_connect()) >= 0) {
+        close(fd);
+        SPP_PRINT("sppCtrl daemon is already running\n");
+        return SPP_OK;
+    }
+    spp_unlock();
+
+    switch (pid = fork()) {
+        case -1:
+            SPP_PRINT("fork fail: %s\n", strerror(errno));
+            return SPP_FAIL;
+        case 0:
+            if (daemon(0, 0) < 0) {
+                exit(SPP_FAIL);
+            }
+            exit(daemon_loop() == SPP_OK ? 0 : 1);
+        default:
+            waitpid(pid, NULL, 0);
+            break;
+    }
+
+    // wait for the socket so the next command can use it
+    for (i = 0; i < 50; i++) {
+        if ((fd = spp_daemon_connect()) >= 0) {
+            close(fd);
+            SPP_PRINT("sppCtrl daemon started\n");
+            return SPP_OK;
+        }
+        usleep(100 * 1000);
+    }
+    SPP_PRINT("sppCtrl daemon start fail\n");
+    return SPP_FAIL;
+}
+
+static int stop(int argc, char **argv)
+{
+    if (spp_daemon_self()) {
+        return SPP_FAIL;
+    }
+    if (kill_pidfile(DAEMON_PID_FILE)) {
+        SPP_PRINT("sppCtrl daemon is not running\n");
+        return SPP_FAIL;
+    }
+    return SPP_OK;
+}
+
+/* Worker pool queue depths and counters, heap use per feature */
+static int stats(int argc, char **argv)
+{
+    if (!spp_daemon_self()) {
+        return spp_daemon_call(argc, argv);
+    }
+    spp_pool_stats(spp_out_cur);
+    spp_task_stats(spp_out_cur);
+    if (ring) {
+        spp_ring_stats(ring, spp_out_cur);
+    }
+    spp_mem_report(spp_out_cur);
+    return SPP_OK;
+}
+
+static void *cmd[CMD_NUM][CMD_LEN] = {
+    {"help", "Show this help page", &help},
+    {"start", "Run sppCtrl daemon in background", &start},
+    {"stop", "Stop sppCtrl daemon", &stop},
+    {"run", "Run sppCtrl daemon in foreground", &run},
+    {"stats", "Show worker pool, ring and memory counters", &stats},
+    {NULL, NULL, NULL}
+};
+
+static int help(int argc, char **argv)
+{
+    int i = 0;
+    SPP_PRINT("%s", help_str[0]);
+    for (i = 0; cmd[i][0]; i++) {
+        SPP_PRINT("%s,       \t%s\n", (char *)cmd[i][0], (char *)cmd[i][1]);
+    }
+    return SPP_OK;
+}
+
+int daemon_ctrl(int argc, char **argv)
+{
+    int cmdVector = 0;
+
+    if (argc < 3) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+
+    cmdVector = sppcmd_check(cmd, argv[2]);
+    if (cmdVector == SPP_FAIL) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+
+    return ((FUNC)cmd[cmdVector][2])(argc, argv);
+}
+
+int spp_daemon_connect(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DAEMON_SOCK_PATH, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int spp_msg_write(int fd, spp_msg_hdr *hdr, const void *data, size_t len)
+{
+    struct iovec iov[2];
+    ssize_t n;
+    int idx = 0, cnt = len ? 2 : 1;
+
+    hdr->len = len;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(spp_msg_hdr);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    while (idx < cnt) {
+        n = writev(fd, iov + idx, cnt - idx);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        // partial write, advance the iovecs
+        while (idx < cnt && (size_t)n >= iov[idx].iov_len) {
+            n -= iov[idx].iov_len;
+            idx++;
+        }
+        if (idx < cnt) {
+            iov[idx].iov_base = (char *)iov[idx].iov_base + n;
+            iov[idx].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+int spp_msg_read(int fd, spp_msg_hdr *hdr, spp_out *payload)
+{
+    char buf[4096];
+    size_t left = 0, n = 0;
+
+    spp_out_reset(payload);
+    if (read_full(fd, hdr, sizeof(spp_msg_hdr)) < 0 || hdr->len > DAEMON_MAX_FRAME) {
+        return -1;
+    }
+    for (left = hdr->len; left; left -= n) {
+        n = MIN(left, sizeof(buf));
+        if (read_full(fd, buf, n) < 0 || spp_out_append(payload, buf, n) < 0) {
+            return -1;
+        }
+    }
+    // keep payload->buf a valid string even when empty
+    return spp_out_append(payload, "", 0);
+}
+
+int spp_daemon_call(int argc, char **argv)
+{
+    spp_client *c = NULL;
+    spp_out out = {0};
+    int ret = SPP_FAIL;
+
+    if ((c = spp_client_open(NULL)) == NULL) {
+        SPP_PRINT("sppCtrl daemon is not running, try '%s daemon start'\n", argv[0]);
+        return SPP_FAIL;
+    }
+    spp_client_call(c, argc, argv, &out, &ret);
+    if (out.len) {
+        SPP_PRINT("%s", out.buf);
+    }
+    spp_out_free(&out);
+    spp_client_close(c);
+    return ret;
+}
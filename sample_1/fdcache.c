@@ -0,0 +1,217 @@
+/*
+ * fdcache.c
+ *
+ * Small open addressing table of path -> fd. Files that disappear (device
+ * unplugged) fail pread() and are reopened once before giving up.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <fdcache.h>
+
+#define FDC_SLOTS   64  /* power of 2 */
+#define FDC_PROBE   8   /* past this the file is read uncached */
+
+typedef struct {
+    char *path;
+    uint32_t hash;
+    int fd;
+} FDC_ENT;
+
+static FDC_ENT fdc_tbl[FDC_SLOTS];
+static pthread_mutex_t fdc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t fdc_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static void fdc_drop(FDC_ENT *e)
+{
+    close(e->fd);
+    free(e->path);
+    memset(e, 0, sizeof(FDC_ENT));
+}
+
+/* Look up or open path, called with fdc_lock held */
+static FDC_ENT *fdc_get(const char *path)
+{
+    uint32_t h = fdc_hash(path);
+    FDC_ENT *free_ent = NULL;
+    int i, fd;
+
+    for (i = 0; i < FDC_PROBE; i++) {
+        FDC_ENT *e = &fdc_tbl[(h + i) & (FDC_SLOTS - 1)];
+
+        if (e->path == NULL) {
+            if (free_ent == NULL) {
+                free_ent = e;
+            }
+            continue;
+        }
+        if (e->hash == h && !strcmp(e->path, path)) {
+            return e;
+        }
+    }
+    if (free_ent == NULL) {
+        return NULL;
+    }
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if ((free_ent->path = strdup(path)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    free_ent->hash = h;
+    free_ent->fd = fd;
+    return free_ent;
+}
+
+static ssize_t fdc_pread(int fd, char *buf, size_t size)
+{
+    ssize_t n, len = 0;
+
+    if (size == 0) {
+        return -1;
+    }
+    while ((size_t)len < size - 1) {
+        n = pread(fd, buf + len, size - 1 - len, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* Read one path, called with fdc_lock held */
+static ssize_t fdc_read_locked(const char *path, char *buf, size_t size)
+{
+    FDC_ENT *e;
+    ssize_t len;
+    int fd, retry;
+
+    for (retry = 0; retry < 2; retry++) {
+        if ((e = fdc_get(path)) == NULL) {
+            break;
+        }
+        if ((len = fdc_pread(e->fd, buf, size)) >= 0) {
+            return len;
+        }
+        fdc_drop(e);
+    }
+
+    /* table full or file gone, fall back to a plain read */
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    len = fdc_pread(fd, buf, size);
+    close(fd);
+    return len;
+}
+
+ssize_t spp_fdc_read(const char *path, char *buf, size_t size)
+{
+    ssize_t len;
+
+    pthread_mutex_lock(&fdc_lock);
+    len = fdc_read_locked(path, buf, size);
+    pthread_mutex_unlock(&fdc_lock);
+    return len;
+}
+
+int spp_fdc_read_batch(spp_fdc_req *reqs, int n)
+{
+    int i, ok = 0;
+
+    pthread_mutex_lock(&fdc_lock);
+    for (i = 0; i < n; i++) {
+        reqs[i].len = fdc_read_locked(reqs[i].path, reqs[i].buf, reqs[i].size);
+        if (reqs[i].len >= 0) {
+            ok++;
+        }
+    }
+    pthread_mutex_unlock(&fdc_lock);
+    return ok;
+}
+
+int spp_fdc_poll(spp_fdc_req *reqs, int n, int timeout_ms)
+{
+    struct pollfd *pfd;
+    int i, ret, changed = 0;
+
+    if ((pfd = calloc(n, sizeof(struct pollfd))) == NULL) {
+        return -1;
+    }
+
+    /*
+     * sysfs arms the notification on read, so read everything first. The
+     * poll goes on dup()s: a cached fd may be closed and its number reused
+     * by another thread while this one waits.
+     */
+    pthread_mutex_lock(&fdc_lock);
+    for (i = 0; i < n; i++) {
+        FDC_ENT *e = fdc_get(reqs[i].path);
+
+        reqs[i].changed = 0;
+        pfd[i].fd = e ? fcntl(e->fd, F_DUPFD_CLOEXEC, 0) : -1;
+        pfd[i].events = POLLPRI | POLLERR;
+        if (pfd[i].fd >= 0) {
+            reqs[i].len = fdc_pread(pfd[i].fd, reqs[i].buf, reqs[i].size);
+        } else {
+            reqs[i].len = fdc_read_locked(reqs[i].path, reqs[i].buf, reqs[i].size);
+        }
+    }
+    pthread_mutex_unlock(&fdc_lock);
+
+    do {
+        ret = poll(pfd, n, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    for (i = 0; i < n; i++) {
+        if (pfd[i].fd < 0) {
+            continue;
+        }
+        if (ret > 0 && pfd[i].revents) {
+            reqs[i].changed = 1;
+            reqs[i].len = fdc_pread(pfd[i].fd, reqs[i].buf, reqs[i].size);
+            changed++;
+        }
+        close(pfd[i].fd);
+    }
+    free(pfd);
+    return ret < 0 ? -1 : changed;
+}
+
+void spp_fdc_close(const char *path)
+{
+    int i;
+
+    pthread_mutex_lock(&fdc_lock);
+    for (i = 0; i < FDC_SLOTS; i++) {
+        if (fdc_tbl[i].path && (path == NULL || !strcmp(fdc_tbl[i].path, path))) {
+            fdc_drop(&fdc_tbl[i]);
+        }
+    }
+    pthread_mutex_unlock(&fdc_lock);
+}
@@ -0,0 +1,129 @@
+/*
+ * ifctl.c
+ *
+ * SPP_EXEC("ifconfig %s up") costs system(), a shell and ifconfig for one
+ * ioctl(). Here the ioctl() is issued directly on a socket that is opened
+ * once; ioctl()s on a shared socket need no lock.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifctl.h>
+
+static int ifc_fd = -1;
+static pthread_mutex_t ifc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int spp_if_sock(void)
+{
+    int fd = __atomic_load_n(&ifc_fd, __ATOMIC_ACQUIRE);
+
+    if (fd >= 0) {
+        return fd;
+    }
+    pthread_mutex_lock(&ifc_lock);
+    if ((fd = ifc_fd) < 0) {
+        if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+            fd = -errno;
+        } else {
+            __atomic_store_n(&ifc_fd, fd, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&ifc_lock);
+    return fd;
+}
+
+/* Socket and request for ifname, -errno if either is not usable */
+static int ifc_open_req(const char *ifname, struct ifreq *req)
+{
+    int fd = spp_if_sock();
+
+    if (fd < 0) {
+        return fd;
+    }
+    if (ifname == NULL || *ifname == '\0' || strlen(ifname) >= IFNAMSIZ) {
+        return -EINVAL;
+    }
+    memset(req, 0, sizeof(struct ifreq));
+    strcpy(req->ifr_name, ifname);
+    return fd;
+}
+
+static int ifc_ioctl(int fd, unsigned long op, struct ifreq *req)
+{
+    return ioctl(fd, op, req) < 0 ? -errno : 0;
+}
+
+int spp_if_set_up(const char *ifname, int up)
+{
+    struct ifreq req;
+    short flags;
+    int fd = 0, ret = 0;
+
+    if ((fd = ifc_open_req(ifname, &req)) < 0) {
+        return fd;
+    }
+    if ((ret = ifc_ioctl(fd, SIOCGIFFLAGS, &req)) < 0) {
+        return ret;
+    }
+    flags = up ? (req.ifr_flags | IFF_UP) : (req.ifr_flags & ~IFF_UP);
+    if (flags == req.ifr_flags) {
+        return 0;
+    }
+    req.ifr_flags = flags;
+    return ifc_ioctl(fd, SIOCSIFFLAGS, &req);
+}
+
+static int ifc_set_inet(int fd, unsigned long op, struct ifreq *req, const char *addr)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *)&req->ifr_addr;
+
+    memset(sin, 0, sizeof(struct sockaddr_in));
+    sin->sin_family = AF_INET;
+    if (inet_pton(AF_INET, addr, &sin->sin_addr) != 1) {
+        return -EINVAL;
+    }
+    return ifc_ioctl(fd, op, req);
+}
+
+int spp_if_set_addr(const char *ifname, const char *addr, const char *mask)
+{
+    struct ifreq req;
+    int fd = 0, ret = 0;
+
+    if ((fd = ifc_open_req(ifname, &req)) < 0) {
+        return fd;
+    }
+    if (addr == NULL) {
+        return -EINVAL;
+    }
+    // SIOCSIFADDR resets the mask to the classful one, so it goes first
+    if ((ret = ifc_set_inet(fd, SIOCSIFADDR, &req, addr)) < 0 || mask == NULL) {
+        return ret;
+    }
+    return ifc_set_inet(fd, SIOCSIFNETMASK, &req, mask);
+}
+
+int spp_if_set_mtu(const char *ifname, int mtu)
+{
+    struct ifreq req;
+    int fd = 0;
+
+    if ((fd = ifc_open_req(ifname, &req)) < 0) {
+        return fd;
+    }
+    if (mtu <= 0) {
+        return -EINVAL;
+    }
+    req.ifr_mtu = mtu;
+    return ifc_ioctl(fd, SIOCSIFMTU, &req);
+}
@@ -0,0 +1,240 @@
+/*
+ * ifstats.c
+ *
+ * One NETLINK_ROUTE socket, opened on first use and kept. A sample is a
+ * single RTM_GETLINK dump: IFLA_STATS64 of every link arrives in a few
+ * recv() calls, whatever the number of interfaces. Every interface keeps
+ * the counters of the sample its rates were last computed from.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <ifstats.h>
+#include <timestamp.h>
+
+#define IFS_RECV_BUF    (32 * 1024)
+
+typedef struct {
+    spp_ifstat cur;
+    spp_ifstat base;        /* counters at base_ns */
+    uint64_t base_ns;
+    uint32_t seen;          /* sample number it was last in the dump */
+} IFS_ENT;
+
+static IFS_ENT ifs_tbl[IFSTATS_MAX];
+static int ifs_count = 0;
+static int ifs_fd = -1;
+static uint32_t ifs_seq = 0;
+static pthread_mutex_t ifs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int ifs_open(void)
+{
+    struct sockaddr_nl addr;
+
+    if (ifs_fd >= 0) {
+        return 0;
+    }
+    if ((ifs_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(ifs_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(ifs_fd);
+        ifs_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static IFS_ENT *ifs_find(int index, const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < ifs_count; i++) {
+        if (ifs_tbl[i].cur.index == index && !strcmp(ifs_tbl[i].cur.name, name)) {
+            return &ifs_tbl[i];
+        }
+    }
+    if (ifs_count == IFSTATS_MAX) {
+        return NULL;
+    }
+    memset(&ifs_tbl[ifs_count], 0, sizeof(IFS_ENT));
+    return &ifs_tbl[ifs_count++];
+}
+
+/* Counters went backwards: the driver reset them */
+static uint64_t ifs_delta(uint64_t cur, uint64_t base)
+{
+    return cur >= base ? cur - base : cur;
+}
+
+/* Per second rate of cur - base over dt_us, without overflow for any interval */
+static uint64_t ifs_rate(uint64_t cur, uint64_t base, uint64_t dt_us)
+{
+    uint64_t delta = ifs_delta(cur, base);
+
+    return delta / dt_us * 1000000ULL + delta % dt_us * 1000000ULL / dt_us;
+}
+
+static void ifs_update(IFS_ENT *e, uint64_t now)
+{
+    uint64_t dt = now - e->base_ns, dt_us = dt / 1000;
+
+    if (e->base_ns == 0) {
+        e->base = e->cur;
+        e->base_ns = now;
+        return;
+    }
+    if (dt < IFSTATS_RATE_MS * 1000000ULL) {
+        // too close to the last one, keep the previous rates
+        e->cur.rx_bps = e->base.rx_bps;
+        e->cur.tx_bps = e->base.tx_bps;
+        e->cur.rx_pps = e->base.rx_pps;
+        e->cur.tx_pps = e->base.tx_pps;
+        e->cur.rated = e->base.rated;
+        return;
+    }
+    e->cur.rx_bps = ifs_rate(e->cur.rx_bytes, e->base.rx_bytes, dt_us);
+    e->cur.tx_bps = ifs_rate(e->cur.tx_bytes, e->base.tx_bytes, dt_us);
+    e->cur.rx_pps = ifs_rate(e->cur.rx_packets, e->base.rx_packets, dt_us);
+    e->cur.tx_pps = ifs_rate(e->cur.tx_packets, e->base.tx_packets, dt_us);
+    e->cur.rated = 1;
+    e->base = e->cur;
+    e->base_ns = now;
+}
+
+/* One RTM_NEWLINK of the dump */
+static void ifs_link(struct nlmsghdr *nh, uint64_t now)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    struct rtattr *rta = IFLA_RTA(ifi);
+    struct rtnl_link_stats64 s64 = { 0 };
+    struct rtnl_link_stats s32 = { 0 };
+    int len = IFLA_PAYLOAD(nh), have = 0;
+    const char *name = NULL;
+    IFS_ENT *e = NULL;
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            name = RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_STATS64 && RTA_PAYLOAD(rta) >= sizeof(s64)) {
+            memcpy(&s64, RTA_DATA(rta), sizeof(s64));
+            have = 64;
+        } else if (rta->rta_type == IFLA_STATS && have == 0 && RTA_PAYLOAD(rta) >= sizeof(s32)) {
+            // old kernels, 32 bit counters
+            memcpy(&s32, RTA_DATA(rta), sizeof(s32));
+            have = 32;
+        }
+    }
+    if (name == NULL || have == 0 || (e = ifs_find(ifi->ifi_index, name)) == NULL) {
+        return;
+    }
+
+    e->cur.index = ifi->ifi_index;
+    strncpy(e->cur.name, name, IFNAMSIZ - 1);
+    if (have == 64) {
+        e->cur.rx_bytes = s64.rx_bytes;
+        e->cur.rx_packets = s64.rx_packets;
+        e->cur.rx_errors = s64.rx_errors;
+        e->cur.tx_bytes = s64.tx_bytes;
+        e->cur.tx_packets = s64.tx_packets;
+        e->cur.tx_errors = s64.tx_errors;
+    } else {
+        e->cur.rx_bytes = s32.rx_bytes;
+        e->cur.rx_packets = s32.rx_packets;
+        e->cur.rx_errors = s32.rx_errors;
+        e->cur.tx_bytes = s32.tx_bytes;
+        e->cur.tx_packets = s32.tx_packets;
+        e->cur.tx_errors = s32.tx_errors;
+    }
+    e->seen = ifs_seq;
+    ifs_update(e, now);
+}
+
+/* Send the dump request and walk the replies, called with ifs_lock held */
+static int ifs_dump(void)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct nlmsghdr *nh = NULL;
+    static char buf[IFS_RECV_BUF];
+    uint64_t now = spp_mono_ns();
+    ssize_t n;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++ifs_seq;
+    req.ifi.ifi_family = AF_UNSPEC;
+    if (sendto(ifs_fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        return -1;
+    }
+
+    for (;;) {
+        n = recv(ifs_fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+            if (nh->nlmsg_seq != ifs_seq) {
+                // left over from a dump that failed half way
+                continue;
+            }
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                return 0;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                return -1;
+            }
+            if (nh->nlmsg_type == RTM_NEWLINK) {
+                ifs_link(nh, now);
+            }
+        }
+    }
+}
+
+int spp_ifstats_sample(spp_ifstat *st, int max)
+{
+    int i = 0, n = 0;
+
+    pthread_mutex_lock(&ifs_lock);
+    if (ifs_open() < 0 || ifs_dump() < 0) {
+        // the socket may be out of step, start over next time
+        if (ifs_fd >= 0) {
+            close(ifs_fd);
+            ifs_fd = -1;
+        }
+        pthread_mutex_unlock(&ifs_lock);
+        return -1;
+    }
+    for (i = 0; i < ifs_count; i++) {
+        // gone from the dump: interface removed
+        if (ifs_tbl[i].seen != ifs_seq) {
+            ifs_tbl[i] = ifs_tbl[--ifs_count];
+            i--;
+            continue;
+        }
+        if (n < max) {
+            st[n++] = ifs_tbl[i].cur;
+        }
+    }
+    pthread_mutex_unlock(&ifs_lock);
+    return n;
+}
@@ -0,0 +1,162 @@
+/*
+ * async.h
+ *
+ * Stackless handlers for features flagged CMD_ASYNC. A handler is called
+ * again and again with the same spp_task until it returns something other
+ * than SPP_TASK_WAIT; SPP_AWAIT_*() park it on a descriptor, a child or a
+ * timer and resume it on the line after, protothread style:
+ *
+ *	int probe(spp_task *t, int argc, char **argv)
+ *	{
+ *	    SPP_ASYNC_BEGIN(t);
+ *	    SPP_AWAIT_SH(t, 3000, SPP_TASK_PRINT, "ifconfig %s", argv[3]);
+ *	    if (t->result == EVAL_TIMEDOUT) {
+ *	        SPP_ASYNC_RETURN(t, SPP_FAIL);
+ *	    }
+ *	    SPP_AWAIT_SLEEP(t, 100);
+ *	    SPP_ASYNC_END(t, SPP_OK);
+ *	}
+ *
+ * Local variables do not survive an await, keep state in
+ * SPP_ASYNC_LOCALS(). A switch statement must not span an await.
+ *
+ * In the daemon the tasks run on the poll loop, hundreds in flight on one
+ * thread, and requests of one async feature are not ordered against each
+ * other. Anywhere else spp_task_run() drives a single task to the end.
+ *
+ */
+#ifndef __ASYNC_H__
+#define __ASYNC_H__
+
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <output.h>
+
+#define SPP_TASK_MAX    256         /* tasks in flight on the daemon loop */
+#define SPP_TASK_WAIT   INT_MIN     /* handler return: parked on an await */
+#define SPP_TASK_OFFLOAD (INT_MIN + 1)  /* see SPP_ASYNC_BLOCKING() */
+#define SPP_TASK_PRINT  ((spp_out *)-1) /* SPP_AWAIT_SH() to SPP_PRINT() */
+
+typedef struct spp_task spp_task;
+typedef int (*spp_async_fn)(spp_task *t, int argc, char **argv);
+
+enum {
+    SPP_TASK_NONE = 0,
+    SPP_TASK_FD,            /* fd polls events */
+    SPP_TASK_SLEEP,         /* deadline passes */
+    SPP_TASK_SH,            /* command exits, its stdout goes to sh_out */
+};
+
+struct spp_task {
+    int lc;                 /* resume point, 0 on the first call */
+    int result;             /* of the last await, see SPP_AWAIT_*() */
+    void *locals;           /* SPP_ASYNC_LOCALS(), freed at the end */
+    /* what the task waits for, set by the await macros */
+    int kind;
+    int fd;                 /* for SPP_TASK_SH the stdout pipe until EOF */
+    short events;
+    short revents;          /* of the last poll() */
+    uint64_t deadline;      /* spp_mono_ns(), 0 for none */
+    pid_t pid;
+    int pidfd;
+    int killed;             /* timed out, waiting to reap the child */
+    spp_out *sh_out;
+    /* owner */
+    spp_out *out;           /* selected while the handler runs */
+    void (*done)(void *arg, int ret);
+    void *arg;
+    int argc;
+    char **argv;
+    spp_async_fn fn;
+    int loop;               /* started by spp_task_start() */
+    int feature;            /* cmd_tables index of a loop task */
+};
+
+#define SPP_ASYNC_BEGIN(t)      switch ((t)->lc) { case 0:
+#define SPP_ASYNC_END(t, ret)   } (t)->lc = -1; return (ret)
+#define SPP_ASYNC_RETURN(t, ret) do { (t)->lc = -1; return (ret); } while (0)
+
+/*
+ * The rest of the handler blocks: on the daemon loop the request is handed
+ * to the worker pool and the handler runs again there from the start.
+ * Only before the first await and the first output.
+ */
+#define SPP_ASYNC_BLOCKING(t) do { \
+    if ((t)->loop) { \
+        return SPP_TASK_OFFLOAD; \
+    } \
+} while (0)
+
+/* calloc()'ed on first use, the same block on every resume */
+#define SPP_ASYNC_LOCALS(t, type)   ((type *)spp_task_locals((t), sizeof(type)))
+
+#define SPP_AWAIT_(t)   do { (t)->lc = __LINE__; return SPP_TASK_WAIT; case __LINE__:; } while (0)
+
+/*
+ * Wait until fd polls one of events, result is the revents or
+ * EVAL_TIMEDOUT; timeout_ms 0 waits forever
+ */
+#define SPP_AWAIT_FD(t, _fd, _events, timeout_ms) do { \
+    spp_task_wait_fd((t), (_fd), (_events), (timeout_ms)); \
+    SPP_AWAIT_(t); \
+} while (0)
+
+/* result 0 */
+#define SPP_AWAIT_SLEEP(t, ms) do { \
+    spp_task_wait_sleep((t), (ms)); \
+    SPP_AWAIT_(t); \
+} while (0)
+
+/*
+ * Run a command line with /bin/sh, its stdout is appended to out, goes
+ * where SPP_PRINT() does for SPP_TASK_PRINT or is dropped for NULL. result
+ * is the exit code, EVAL_TIMEDOUT or -1 if it could not be started.
+ */
+#define SPP_AWAIT_SH(t, timeout_ms, out, fmt, args...) do { \
+    if (spp_task_wait_sh((t), (timeout_ms), (out), fmt, ##args) == 0) { \
+        SPP_AWAIT_(t); \
+    } \
+} while (0)
+
+extern void *spp_task_locals(spp_task *t, size_t size);
+extern void spp_task_wait_fd(spp_task *t, int fd, short events, int timeout_ms);
+extern void spp_task_wait_sleep(spp_task *t, int ms);
+
+/* @return	0 if the task has to wait, -1 with result set otherwise */
+extern int spp_task_wait_sh(spp_task *t, int timeout_ms, spp_out *out, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/*
+ * Drive fn to the end on this thread, for one-shot runs and pool workers
+ * @return	the handler's return value
+ */
+extern int spp_task_run(spp_async_fn fn, int argc, char **argv);
+
+/*
+ * Start the handler of cmd_tables[feature] on the daemon loop, output goes
+ * to out and allocations are charged to the feature (memstat.h). done is
+ * called with the handler's return value once it finished, possibly before
+ * this returns.
+ * @return	0 on success and -1 if SPP_TASK_MAX tasks are in flight or
+ *		the handler asked for SPP_ASYNC_BLOCKING(), done is not called
+ */
+extern int spp_task_start(int feature, int argc, char **argv, spp_out *out,
+        void (*done)(void *arg, int ret), void *arg);
+
+/*
+ * Daemon loop integration: add the descriptors of parked tasks to pfd,
+ * then hand the same pfd back to spp_task_poll() after poll()
+ * @return	number of entries used
+ */
+extern int spp_task_pollfds(struct pollfd *pfd, int max);
+extern void spp_task_poll(struct pollfd *pfd, int n);
+
+/* Milliseconds to the nearest task deadline or -1 for none */
+extern int spp_task_timeout(void);
+
+/* Tasks in flight and counters as key=value lines */
+extern void spp_task_stats(spp_out *o);
+
+#endif /* __ASYNC_H__ */
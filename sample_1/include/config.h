@@ -16,11 +16,13 @@
 
 #define SPP_OK  1
 #define SPP_FAIL    -1
-#define SPP_PRINT(fmt, args...) printf(fmt, ##args)
+#define SPP_PRINT(fmt, args...) spp_printf(fmt, ##args)
 #define PID_FILE    "/tmp/spp.pid"
+/* File that spp_unlock() appends "<wait ns> <kills>" to, set by sppLoad */
+#define SPP_LOCK_STATS_ENV  "SPP_LOCK_STATS"
 
 #ifdef X86_TEST
-#define SPP_EXEC(fmt, args...) ({printf("[JUST PRINT]" fmt"\n", ##args); strdup("Just Print on X86\n");})
+#define SPP_EXEC(fmt, args...) ({spp_printf("[JUST PRINT]" fmt"\n", ##args); strdup("Just Print on X86\n");})
 #else
 //#define SPP_EXEC    backticksh
 #define SPP_EXEC(fmt, args...) ( \
@@ -32,9 +34,22 @@
 #endif
 
 #define CMD_NUM 256
-#define CMD_LEN 3
-#define CMD_VER "0.1"
+#define CMD_LEN 4
 
-#define STATUS_BUF 256
+/*
+ * cmd_tables column 3: scheduling class for the daemon worker pool,
+ * interactive before control before bulk, or'ed with CMD_IDEMPOTENT and
+ * CMD_ASYNC. Empty means control.
+ */
+#define CMD_CLASS_CONTROL       0
+#define CMD_CLASS_INTERACTIVE   1
+#define CMD_CLASS_BULK          2
+#define CMD_CLASSES             3
+#define CMD_CLASS_MASK          0x3
+#define CMD_CLASS(attr)         ((attr) & CMD_CLASS_MASK)
+#define CMD_IDEMPOTENT          0x4     /* same argv gives same output, runs may be shared */
+#define CMD_ASYNC               0x8     /* handler is an spp_async_fn, see async.h */
+#define CMD_ATTR(attr)          ((void *)(long)(attr))
+#define CMD_VER "0.1"
 
 #endif /* __CONFIG_H__ */
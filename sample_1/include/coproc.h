@@ -0,0 +1,50 @@
+/*
+ * coproc.h
+ *
+ * Persistent /bin/sh for features that run many shell snippets in a row:
+ * a command costs a round trip on a socket instead of fork, exec and shell
+ * startup. Commands run in one shell one after the other, so shell state
+ * (cd, variables) carries over from one command to the next.
+ *
+ */
+#ifndef __COPROC_H__
+#define __COPROC_H__
+
+#include <output.h>
+
+typedef struct spp_sh spp_sh;
+
+/*
+ * The shell is started on first use and restarted when it died or a
+ * command timed out
+ * @return	handle or NULL on failure
+ */
+extern spp_sh *spp_sh_new(void);
+
+/* Stop the shell and free the handle */
+extern void spp_sh_free(spp_sh *sh);
+
+/*
+ * Run a command line in the shell, stdin is /dev/null and stderr is
+ * inherited as with evalsh()
+ * @param	out	stdout of the command, NULL to drop it
+ * @param	timeout_ms	milliseconds before the shell and its children
+ *		are killed or 0 for no timeout
+ * @return	exit code of the command, EVAL_TIMEDOUT or -1 if the shell
+ *		could not run it
+ */
+extern int spp_sh_run(spp_sh *sh, spp_out *out, int timeout_ms, const char *cmd);
+
+/*
+ * evalsh() through the shell, stdout goes to the SPP_PRINT() output
+ * @return	exit code of the command, EVAL_TIMEDOUT or -1
+ */
+extern int spp_sh_evalsh(spp_sh *sh, int timeout_ms, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/*
+ * backticksh() through the shell
+ * @return	stdout of the command or NULL on failure, free() it
+ */
+extern char *spp_sh_backticksh(spp_sh *sh, int timeout_ms, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#endif /* __COPROC_H__ */
@@ -0,0 +1,94 @@
+/*
+ * daemon.h
+ *
+ * Resident sppCtrl: requests arrive as frames on a unix socket and run
+ * in-process, without the fork/exec and the PID file lock of a one-shot
+ * command.
+ *
+ */
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <stdint.h>
+#include <output.h>
+
+#define DAEMON_SOCK_PATH    "/tmp/spp.sock"
+#define DAEMON_SOCK_MODE    0600    /* owner only, requests run as the daemon user */
+#define DAEMON_PID_FILE     "/tmp/sppd.pid"
+#define DAEMON_MAX_CONN     64
+#define DAEMON_MAX_FRAME    (64 * 1024)
+
+/*
+ * Every message is a header followed by len bytes of payload, all fields
+ * in host byte order (both ends are on the same box)
+ */
+typedef struct {
+    uint32_t len;
+    uint32_t id;        /* chosen by the client, echoed in every reply */
+    uint16_t type;
+    uint16_t flags;
+    int32_t code;
+} spp_msg_hdr;
+
+enum {
+    SPP_MSG_REQ = 1,    /* client: argv, NUL separated */
+    SPP_MSG_OUT,        /* daemon: output bytes of request id */
+    SPP_MSG_END,        /* daemon: request id done, code = handler return */
+    SPP_MSG_WATCH,      /* client: status features to watch, NUL separated */
+    SPP_MSG_EVT,        /* daemon: watch event, code = sequence number */
+    SPP_MSG_RING,       /* client: attach to the command ring, the END reply
+                         * carries its memfd and eventfd (SCM_RIGHTS) */
+};
+
+/* SPP_MSG_EVT flags */
+#define SPP_EVT_FULL    0x1 /* full snapshot, replaces everything seen so far */
+
+typedef struct spp_conn spp_conn;
+
+/*
+ * Queue a frame on a connection
+ * @param	c	connection
+ * @param	hdr	header, len is taken from the len argument
+ * @param	data	payload
+ * @param	len	payload length
+ * @return	0 on success and -1 if the connection is gone
+ */
+extern int spp_conn_send(spp_conn *c, spp_msg_hdr *hdr, const void *data, size_t len);
+
+/* Bytes queued on a connection and not yet written */
+extern size_t spp_conn_pending(spp_conn *c);
+
+/*
+ * Client side helpers
+ * @return	connected socket or -1 if the daemon is not running
+ */
+extern int spp_daemon_connect(void);
+extern int spp_msg_write(int fd, spp_msg_hdr *hdr, const void *data, size_t len);
+
+/*
+ * Read one frame, payload is NUL terminated
+ * @return	0 on success and -1 on failure or end of stream
+ */
+extern int spp_msg_read(int fd, spp_msg_hdr *hdr, spp_out *payload);
+
+/*
+ * Run argv in the daemon and print its output
+ * @return	handler return value or SPP_FAIL if the daemon is not running
+ */
+extern int spp_daemon_call(int argc, char **argv);
+
+/* sppCtrl "daemon" command */
+extern int daemon_ctrl(int, char **);
+
+/* 1 when called from a request running inside the daemon */
+extern int spp_daemon_self(void);
+
+/* Status watch (watch.c), driven by the daemon loop */
+extern int watch_add(spp_conn *c, uint32_t id, char **features, int count);
+extern void watch_remove(spp_conn *c);
+extern void watch_refresh(void);
+extern void watch_changed(void);     /* refresh soon, rate limited */
+extern void watch_writable(spp_conn *c);
+extern int watch_timeout(void);
+
+#endif /* __DAEMON_H__ */
@@ -0,0 +1,51 @@
+/*
+ * fdcache.h
+ *
+ * Keeps /proc and /sys files open and re-reads them with pread(fd, ..., 0).
+ *
+ */
+#ifndef __FDCACHE_H__
+#define __FDCACHE_H__
+
+#include <sys/types.h>
+
+typedef struct {
+    const char *path;
+    char *buf;
+    size_t size;
+    ssize_t len;    /* bytes read (buf is NUL terminated) or -1 */
+    int changed;    /* set by spp_fdc_poll() */
+} spp_fdc_req;
+
+/*
+ * Read a file through the cache
+ * @param	path	file path
+ * @param	buf	destination, NUL terminated
+ * @param	size	destination size
+ * @return	bytes read or -1 on failure
+ */
+extern ssize_t spp_fdc_read(const char *path, char *buf, size_t size);
+
+/*
+ * Read several files while holding the cache lock once
+ * @param	reqs	requests, len is filled for each
+ * @param	n	number of requests
+ * @return	number of files read successfully
+ */
+extern int spp_fdc_read_batch(spp_fdc_req *reqs, int n);
+
+/*
+ * Wait for sysfs change notification (sysfs_notify) on any of the files
+ * and re-read the ones that changed. Attributes that never notify only
+ * wake up on timeout.
+ * @param	reqs	requests, changed/len/buf are updated
+ * @param	n	number of requests
+ * @param	timeout_ms	milliseconds to wait or -1 for no timeout
+ * @return	number of changed files, 0 on timeout and -1 on failure
+ */
+extern int spp_fdc_poll(spp_fdc_req *reqs, int n, int timeout_ms);
+
+/* Drop one cached file, or all of them when path is NULL */
+extern void spp_fdc_close(const char *path);
+
+#endif /* __FDCACHE_H__ */
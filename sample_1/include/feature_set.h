@@ -10,14 +10,19 @@
 #ifndef __FEATURE_SET_H__
 #define __FEATURE_SET_H__
 
+#include <output.h>
+#include <async.h>
 
 
 extern int interface(int, char **);
-extern char *interface_status(void);
+extern ssize_t interface_status(spp_sink *);
 
-extern char *sample_status(void);
-extern int sample(int, char **);
+extern ssize_t sample_status(spp_sink *);
+extern int sample(spp_task *, int, char **);
 
 extern int status(int, char **);
+extern const char *status_feature_name(int);
+extern int status_lookup(const char *);
+extern int status_collect(int, spp_out *);
 
 #endif /* __FEATURE_SET_H__ */
@@ -0,0 +1,37 @@
+/*
+ * ifctl.h
+ *
+ * Interface control without ifconfig: link up/down, IPv4 address and MTU
+ * are set with ioctl()s on one AF_INET socket that is kept open. Every
+ * call returns 0 or -errno, so callers can tell ENODEV from EPERM.
+ *
+ */
+#ifndef __IFCTL_H__
+#define __IFCTL_H__
+
+/*
+ * Socket for SIOCGIF and SIOCSIF ioctls, opened on first use and kept
+ * @return	socket or -errno
+ */
+extern int spp_if_sock(void);
+
+/*
+ * Bring a link up or down, nothing is written if it already is
+ * @return	0 or -errno
+ */
+extern int spp_if_set_up(const char *ifname, int up);
+
+/*
+ * Set the IPv4 address and, unless mask is NULL, the netmask
+ * @param	addr	dotted quad
+ * @return	0, -EINVAL for an address that does not parse or -errno
+ */
+extern int spp_if_set_addr(const char *ifname, const char *addr, const char *mask);
+
+/*
+ * Set the MTU
+ * @return	0 or -errno
+ */
+extern int spp_if_set_mtu(const char *ifname, int mtu);
+
+#endif /* __IFCTL_H__ */
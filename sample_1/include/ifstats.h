@@ -0,0 +1,43 @@
+/*
+ * ifstats.h
+ *
+ * Traffic counters of every interface from one RTM_GETLINK dump, with
+ * rates computed against the previous sample. No ifconfig, no /sys files.
+ *
+ */
+#ifndef __IFSTATS_H__
+#define __IFSTATS_H__
+
+#include <stdint.h>
+#include <net/if.h>
+
+#define IFSTATS_MAX     64      /* interfaces tracked */
+#define IFSTATS_RATE_MS 1000    /* shortest interval rates are computed over */
+
+typedef struct {
+    char name[IFNAMSIZ];
+    int index;
+    uint64_t rx_bytes;
+    uint64_t rx_packets;
+    uint64_t rx_errors;
+    uint64_t tx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_errors;
+    /* per second, over at least IFSTATS_RATE_MS, valid once rated is set */
+    int rated;              /* 0 until two samples exist */
+    uint64_t rx_bps;
+    uint64_t tx_bps;
+    uint64_t rx_pps;
+    uint64_t tx_pps;
+} spp_ifstat;
+
+/*
+ * Sample the counters of all interfaces, safe to call from several
+ * threads
+ * @param	st	filled with a copy of each interface
+ * @param	max	entries in st
+ * @return	number of interfaces or -1 on failure
+ */
+extern int spp_ifstats_sample(spp_ifstat *st, int max);
+
+#endif /* __IFSTATS_H__ */
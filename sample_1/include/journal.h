@@ -0,0 +1,70 @@
+/*
+ * journal.h
+ *
+ * Audit journal of control commands: who ran what, for how long and with
+ * which result. Records have a fixed size and are written through a shared
+ * mapping of JOURNAL_PATH; a writer takes its slot by an atomic add on the
+ * tail kept in the file header, so one-shot processes and the daemon
+ * workers append without a lock and without a syscall per record.
+ *
+ * Nothing is fsync()'ed per record. A record is valid once its checksum
+ * matches, a torn or unfinished one is skipped by the reader and a tail
+ * the crash lost is moved past the last written slot on the next open.
+ * A full file is renamed to JOURNAL_PATH.1 and synced once.
+ *
+ */
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define JOURNAL_PATH        "/tmp/spp_journal"
+#define JOURNAL_RECORDS     16384   /* per file, 4 MB */
+#define JOURNAL_CMD_LEN     16
+#define JOURNAL_ARGS_LEN    192
+
+/* 256 bytes, the header of the file is one more record in size */
+typedef struct {
+    uint32_t crc;           /* CRC-32 of the record with crc 0, written last */
+    uint32_t magic;         /* JOURNAL_MAGIC, 0 for a slot never written */
+    uint64_t seq;           /* slot number in the file */
+    int64_t time_ns;        /* CLOCK_REALTIME at the start of the command */
+    uint32_t dur_us;
+    int32_t ret;
+    int32_t pid;            /* caller, -1 if unknown */
+    uint32_t uid;           /* JOURNAL_UID_UNKNOWN if unknown */
+    uint16_t flags;         /* JOURNAL_F_* */
+    uint16_t argc;
+    uint32_t reserved;
+    char cmd[JOURNAL_CMD_LEN];      /* feature */
+    char args[JOURNAL_ARGS_LEN];    /* argv[2..], space separated */
+} spp_jrec;
+
+#define JOURNAL_F_DAEMON    0x1     /* ran in the daemon */
+#define JOURNAL_F_TRUNC     0x2     /* args did not fit */
+#define JOURNAL_F_RING      0x4     /* from the shared ring, caller unknown */
+
+#define JOURNAL_UID_UNKNOWN ((uint32_t)-1)
+
+/*
+ * Requests of this thread come from pid/uid until the next call, as the
+ * daemon learns them from the socket; pid 0 is this process, pid -1 and
+ * uid (uid_t)-1 are unknown
+ * @param	flags	JOURNAL_F_RING or 0
+ */
+extern void spp_journal_caller(pid_t pid, uid_t uid, int flags);
+
+/*
+ * Append a record for a command of the caller
+ * @param	argv	argv[1] is the feature
+ * @param	start_ns	spp_mono_ns() when it started
+ * @param	ret	handler return value
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_journal_log(int argc, char **argv, uint64_t start_ns, int ret);
+
+/* "sppCtrl journal ..." */
+extern int journal(int, char **);
+
+#endif /* __JOURNAL_H__ */
@@ -0,0 +1,61 @@
+/*
+ * kvparse.h
+ *
+ * Bulk parser for key=value and whitespace separated files such as
+ * /tmp/spp_status, /tmp/spp_status_* and most of /proc and /sys.
+ *
+ */
+#ifndef __KVPARSE_H__
+#define __KVPARSE_H__
+
+#include <tokenize.h>
+
+/* Separator: '=' for spp_status, ':' for /proc/meminfo, ' ' for any blank run */
+#define KV_SEP_EQ       '='
+#define KV_SEP_COLON    ':'
+#define KV_SEP_BLANK    ' '
+
+typedef struct {
+    spp_tok key;
+    spp_tok val;
+} spp_kv;
+
+typedef struct {
+    spp_kv *kv;
+    int count;
+    int size;
+} spp_kvlist;
+
+/*
+ * Split buf into key/value slices, blank lines and lines starting with '#'
+ * are skipped, lines without separator get an empty value
+ * @param	l	list to fill, release with spp_kv_free()
+ * @param	buf	input, must stay valid while the slices are used
+ * @param	len	input length
+ * @param	sep	KV_SEP_EQ, KV_SEP_COLON or KV_SEP_BLANK
+ * @return	number of pairs or -1 on failure
+ */
+extern int spp_kv_parse(spp_kvlist *l, const char *buf, size_t len, char sep);
+
+extern void spp_kv_free(spp_kvlist *l);
+
+/*
+ * Find a key in a parsed list
+ * @return	value slice or NULL if not found
+ */
+extern const spp_tok *spp_kv_get(const spp_kvlist *l, const char *key);
+
+/*
+ * Look up a fixed set of keys in one pass without building a list
+ * @param	buf	input
+ * @param	len	input length
+ * @param	sep	separator as for spp_kv_parse()
+ * @param	keys	keys to look for
+ * @param	vals	value slices, entries not found get ptr == NULL
+ * @param	nkeys	number of keys, at most 64
+ * @return	number of keys found or -1 on failure
+ */
+extern int spp_kv_lookup(const char *buf, size_t len, char sep,
+        const char *const keys[], spp_tok vals[], int nkeys);
+
+#endif /* __KVPARSE_H__ */
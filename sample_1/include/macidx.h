@@ -0,0 +1,109 @@
+/*
+ * macidx.h
+ *
+ * Fixed width MAC conversion and an open addressing map keyed by the
+ * 48-bit address, for station, ARP and bridge FDB tables.
+ *
+ */
+#ifndef __MACIDX_H__
+#define __MACIDX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* MAC address in the low 48 bits, first octet most significant */
+typedef uint64_t spp_mac;
+
+/* xx:xx:xx:xx:xx:xx */
+#define SPP_MAC_STRLEN  17
+
+typedef struct {
+    uint64_t key;   /* MAC | SPP_MACIDX_USED, 0 for an empty slot */
+    uint64_t val;
+} spp_macent;
+
+typedef struct {
+    spp_macent *ent;
+    size_t cap;     /* power of 2 */
+    size_t count;
+} spp_macidx;
+
+#define SPP_MACIDX_USED     (1ULL << 63)
+#define SPP_MACIDX_MAC(e)   ((e)->key & 0xffffffffffffULL)
+
+/* Walk every entry, e is a spp_macent pointer */
+#define spp_macidx_foreach(idx, e) \
+    for (e = (idx)->ent; e && e < (idx)->ent + (idx)->cap; e++) \
+        if (e->key & SPP_MACIDX_USED)
+
+/* ARP loader value: IPv4 address in network order, see spp_macidx_load_arp() */
+#define SPP_ARP_IP(val)     ((uint32_t)(val))
+/* FDB loader value: bridge port and local flag, see spp_macidx_load_fdb() */
+#define SPP_FDB_PORT(val)   ((int)((val) & 0xffff))
+#define SPP_FDB_LOCAL(val)  ((int)(((val) >> 16) & 1))
+
+/*
+ * Parse fixed width xx:xx:xx:xx:xx:xx or xx-xx-xx-xx-xx-xx
+ * @param	s	string, at least SPP_MAC_STRLEN bytes
+ * @param	mac	parsed address
+ * @return	0 on success and -1 if s is not a MAC address
+ */
+extern int spp_mac_parse(const char *s, spp_mac *mac);
+
+/*
+ * Format address as xx:xx:xx:xx:xx:xx
+ * @param	mac	address
+ * @param	a	buffer of at least SPP_MAC_STRLEN + 1 bytes
+ * @param	upper	non zero for upper case hex digits
+ * @return	a
+ */
+extern char *spp_mac_format(spp_mac mac, char *a, int upper);
+
+extern spp_mac spp_mac_from_bytes(const unsigned char *e);
+extern void spp_mac_to_bytes(spp_mac mac, unsigned char *e);
+
+/*
+ * @param	idx	index to set up
+ * @param	hint	expected number of entries, 0 for default
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_macidx_init(spp_macidx *idx, size_t hint);
+extern void spp_macidx_free(spp_macidx *idx);
+
+/*
+ * Insert or update an entry
+ * @return	1 if added, 0 if updated and -1 on failure
+ */
+extern int spp_macidx_put(spp_macidx *idx, spp_mac mac, uint64_t val);
+
+/*
+ * @param	val	value of the entry, may be NULL
+ * @return	1 if found and 0 otherwise
+ */
+extern int spp_macidx_get(const spp_macidx *idx, spp_mac mac, uint64_t *val);
+
+/*
+ * @return	1 if removed and 0 if not found
+ */
+extern int spp_macidx_del(spp_macidx *idx, spp_mac mac);
+
+/*
+ * Load /proc/net/arp format, incomplete entries are skipped
+ * @param	idx	index
+ * @param	buf	file content
+ * @param	len	content length
+ * @param	dev	only take entries of this device, NULL for all
+ * @return	number of entries loaded or -1 on failure
+ */
+extern int spp_macidx_load_arp(spp_macidx *idx, const char *buf, size_t len, const char *dev);
+
+/*
+ * Load "brctl showmacs" format
+ * @param	idx	index
+ * @param	buf	command output
+ * @param	len	output length
+ * @return	number of entries loaded or -1 on failure
+ */
+extern int spp_macidx_load_fdb(spp_macidx *idx, const char *buf, size_t len);
+
+#endif /* __MACIDX_H__ */
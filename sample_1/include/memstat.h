@@ -0,0 +1,55 @@
+/*
+ * memstat.h
+ *
+ * Heap accounting per feature. Built with "make x86 MEM_STATS=1", the
+ * linker routes malloc, calloc, realloc, free, strdup, strndup and
+ * vasprintf of sppCtrl through memstat.c (-Wl,--wrap), every block
+ * remembers the feature it was allocated for and is counted at its
+ * malloc_usable_size(). Without it the calls below cost nothing and only
+ * the RSS is reported.
+ *
+ * Allocations made inside libc (stdio buffers, getaddrinfo) are not seen.
+ * Their free() is told apart by a magic in the 16 bytes before the
+ * pointer, which for such a block are glibc's own chunk header: only build
+ * MEM_STATS=1 against glibc on a 64 bit target, not with another
+ * allocator or a sanitizer.
+ *
+ * The counters change on every command, they are not a status provider
+ * but printed by "sppCtrl --mem-stats <cmd>" and "sppCtrl daemon stats".
+ *
+ */
+#ifndef __MEMSTAT_H__
+#define __MEMSTAT_H__
+
+#include <sys/types.h>
+#include <output.h>
+
+#define SPP_MEM_SCOPES  32      /* features counted apart, the rest is core */
+
+/*
+ * Count the allocations of this thread for feature from now on and start
+ * a new request of it
+ * @param	feature	cmd_tables index
+ * @param	name	feature name for the report
+ * @return	scope to hand to spp_mem_leave()
+ */
+extern int spp_mem_enter(int feature, const char *name);
+
+/* The request of spp_mem_enter() is done, its peak is recorded */
+extern void spp_mem_leave(int prev);
+
+/*
+ * Count the allocations of this thread for feature again without starting
+ * a request, for an async task resumed on the daemon loop; the peak taken
+ * by spp_mem_leave() is the one of this resume
+ * @return	scope to hand to spp_mem_leave()
+ */
+extern int spp_mem_resume(int feature, const char *name);
+
+/* One more request of feature, for tasks charged through spp_mem_resume() */
+extern void spp_mem_request(int feature);
+
+/* Print the counters as key=value lines to o, NULL for stdout */
+extern void spp_mem_report(spp_out *o);
+
+#endif /* __MEMSTAT_H__ */
@@ -0,0 +1,66 @@
+/*
+ * nlbatch.h
+ *
+ * rtnetlink transactions: link, address and route changes are packed into
+ * one buffer, sent with one sendmsg() and acknowledged one by one. The
+ * kernel applies the messages in order and keeps going after a failure, so
+ * a commit reports a result per operation; nothing is rolled back.
+ *
+ */
+#ifndef __NLBATCH_H__
+#define __NLBATCH_H__
+
+#define SPP_NL_OPS      64          /* operations in one batch */
+#define SPP_NL_BUF      (16 * 1024) /* bytes of requests in one batch */
+#define SPP_NL_LABEL    48
+
+typedef struct spp_nl_batch spp_nl_batch;
+
+/* @return	empty batch or NULL on failure */
+extern spp_nl_batch *spp_nl_batch_new(void);
+extern void spp_nl_batch_free(spp_nl_batch *b);
+
+/* Drop the queued operations and their results */
+extern void spp_nl_batch_reset(spp_nl_batch *b);
+
+/*
+ * Queue a link change
+ * @param	up	1 up, 0 down, -1 leave the state alone
+ * @param	mtu	new MTU or 0 to leave it alone
+ * @return	operation index or -errno
+ */
+extern int spp_nl_link(spp_nl_batch *b, const char *ifname, int up, int mtu);
+
+/*
+ * Queue adding (or replacing) an IPv4 address
+ * @param	del	1 to remove the address instead
+ * @return	operation index or -errno
+ */
+extern int spp_nl_addr(spp_nl_batch *b, const char *ifname, const char *addr, int prefix, int del);
+
+/*
+ * Queue adding (or replacing) an IPv4 route in the main table
+ * @param	gw	gateway or NULL for a route on the link
+ * @param	ifname	output interface or NULL when gw is enough
+ * @return	operation index or -errno
+ */
+extern int spp_nl_route(spp_nl_batch *b, const char *dst, int prefix, const char *gw, const char *ifname);
+
+/*
+ * Send every queued operation with one sendmsg() and collect the ACKs
+ * @return	number of operations that failed or -errno if the batch could
+ *		not be sent
+ */
+extern int spp_nl_batch_commit(spp_nl_batch *b);
+
+/* @return	number of queued operations */
+extern int spp_nl_batch_count(spp_nl_batch *b);
+
+/*
+ * Result of one operation after a commit
+ * @param	label	set to a description such as "addr br0 192.168.1.1/24"
+ * @return	0 or -errno
+ */
+extern int spp_nl_batch_result(spp_nl_batch *b, int op, const char **label);
+
+#endif /* __NLBATCH_H__ */
@@ -0,0 +1,71 @@
+/*
+ * nvcache.h
+ *
+ * NVRAM access for features: reads come from an in-process snapshot and
+ * sets are buffered, so many sets end in a single flash commit. The daemon
+ * marks the snapshot stale once per loop turn: values other processes
+ * wrote meanwhile are read again, buffered sets are kept.
+ *
+ * The backend is the vendor libnvram, or a key=value file when built
+ * with X86_TEST or NVRAM_FILE so the tool runs on a PC.
+ *
+ */
+#ifndef __NVCACHE_H__
+#define __NVCACHE_H__
+
+#if defined(X86_TEST) && !defined(NVRAM_FILE)
+#define NVRAM_FILE
+#endif
+
+#define NVRAM_FILE_PATH         "/tmp/spp_nvram"
+#define NVRAM_COMMIT_DELAY_MS   2000    /* daemon: commit after sets settle */
+#define NVRAM_COMMIT_MAX_MS     10000   /* daemon: but never later than this */
+
+#include <sys/types.h>
+
+/*
+ * Copy the value of name, workers may set it right after
+ * @param	name	variable name
+ * @param	buf	value, NUL terminated and truncated to size
+ * @param	size	buffer size
+ * @return	value length as with snprintf() or -1 if unset
+ */
+extern ssize_t spp_nvram_get(const char *name, char *buf, size_t size);
+
+/*
+ * Buffer a set, nothing reaches the backend before a commit
+ * @param	name	variable name
+ * @param	value	new value, NULL to unset
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_nvram_set(const char *name, const char *value);
+extern int spp_nvram_unset(const char *name);
+
+/*
+ * Write buffered sets to the backend with one commit
+ * @return	number of variables written, 0 if nothing was pending, -1 on failure
+ */
+extern int spp_nvram_commit(void);
+
+/* Daemon: commit once sets stop coming, see NVRAM_COMMIT_DELAY_MS */
+extern void spp_nvram_commit_later(void);
+
+/*
+ * Daemon loop helpers
+ * @return	milliseconds until the debounced commit is due, -1 if none
+ */
+extern int spp_nvram_timeout(void);
+extern void spp_nvram_tick(void);
+
+/* Forget the snapshot, the next get reads the backend again */
+extern void spp_nvram_drop(void);
+
+/* Read values without a pending set from the backend again on next use */
+extern void spp_nvram_refresh(void);
+
+#ifdef NVRAM_FILE
+/* Use another file than NVRAM_FILE_PATH */
+extern void spp_nvram_file(const char *path);
+#endif
+
+#endif /* __NVCACHE_H__ */
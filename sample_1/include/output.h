@@ -0,0 +1,146 @@
+/*
+ * output.h
+ *
+ * Handler output. SPP_PRINT() goes to stdout for a one-shot command and
+ * into the calling thread's spp_out buffer when the daemon runs a request.
+ * A buffer with a channel streams: it never holds more than about
+ * SPP_CHAN_FLUSH bytes, the rest has already gone to the channel.
+ *
+ */
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SPP_CHAN_SEGS   16
+#define SPP_CHAN_FLUSH  (16 * 1024)    /* buffered bytes that start a flush */
+
+typedef struct {
+    const char *ptr;    /* NULL: bytes at off in the spp_out buffer */
+    size_t off;
+    size_t len;
+} spp_seg;
+
+typedef struct spp_chan {
+    /* send iov as one chunk, 0 on success */
+    int (*writev)(struct spp_chan *ch, const struct iovec *iov, int cnt, size_t len);
+    /* send len bytes readable on pipe fd as one chunk, bytes taken or -1 */
+    ssize_t (*splice)(struct spp_chan *ch, int fd, size_t len);
+    void *priv;
+    spp_seg seg[SPP_CHAN_SEGS];
+    int nseg;
+    size_t sealed;      /* bytes of the buffer already in seg */
+    size_t pending;     /* bytes in seg */
+    size_t sent;        /* bytes handed to writev/splice so far */
+} spp_chan;
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+    spp_chan *chan;     /* NULL: everything stays in buf */
+} spp_out;
+
+/* Output of the running request, NULL for stdout */
+extern __thread spp_out *spp_out_cur;
+
+/*
+ * printf() to the current output
+ * @return	number of bytes written or -1 on failure
+ */
+extern int spp_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+extern int spp_vprintf(const char *fmt, va_list args);
+
+/*
+ * Append bytes to a buffer
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_out_append(spp_out *o, const void *data, size_t len);
+extern int spp_out_puts(spp_out *o, const char *s);
+
+/* Drop buffered bytes but keep the memory */
+extern void spp_out_reset(spp_out *o);
+extern void spp_out_free(spp_out *o);
+
+/*
+ * Queue data without copying it, data must stay valid until the next
+ * spp_out_flush(). Without a channel the data is copied.
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_out_ref(spp_out *o, const void *data, size_t len);
+
+/*
+ * Send everything queued on the channel with one writev
+ * @return	0 on success, nothing to do or no channel, and -1 on failure
+ */
+extern int spp_out_flush(spp_out *o);
+
+/*
+ * spp_out_ref() and spp_out_flush() on the current output, stdout for a
+ * one-shot command
+ */
+extern int spp_putref(const void *data, size_t len);
+extern int spp_flush(void);
+
+/*
+ * Forward everything readable on fd up to end of file to the current
+ * output. A streaming output gets the bytes spliced from the pipe, stdout
+ * gets them spliced when it supports it.
+ * @param	fd	pipe, child stdout
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @return	bytes forwarded or -1 on failure, errno ETIMEDOUT on timeout
+ */
+extern ssize_t spp_putpipe(int fd, int timeout_ms);
+
+/*
+ * Where status providers write: text goes into a buffer, and with seg
+ * space constant data is only referenced, so the document can go out as
+ * an iovec chain. Not tied to the calling thread, any number of sinks can
+ * be filled at the same time.
+ */
+typedef struct {
+    spp_out *out;
+    spp_seg *seg;       /* NULL: referenced data is copied too */
+    int nseg;
+    int max;
+    size_t sealed;      /* bytes of out already in seg */
+    size_t len;         /* bytes written to the sink */
+} spp_sink;
+
+/*
+ * @param	o	buffer, may already hold data that is not part of the sink
+ * @param	seg	segments for spp_sink_ref() and spp_sink_iov(), may be NULL
+ */
+extern void spp_sink_init(spp_sink *s, spp_out *o, spp_seg *seg, int max);
+
+/*
+ * Append to a sink
+ * @return	bytes written or -1 on failure
+ */
+extern ssize_t spp_sink_printf(spp_sink *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+extern ssize_t spp_sink_write(spp_sink *s, const void *data, size_t len);
+
+/*
+ * Append data without copying it when there is a free segment, data must
+ * stay valid as long as the sink is used
+ * @return	bytes written or -1 on failure
+ */
+extern ssize_t spp_sink_ref(spp_sink *s, const void *data, size_t len);
+
+/*
+ * Everything written to the sink, in order
+ * @return	number of iovecs or -1 if max is too small
+ */
+extern int spp_sink_iov(spp_sink *s, struct iovec *iov, int max);
+
+/*
+ * Select the output of the calling thread
+ * @param	o	buffer, NULL for stdout
+ * @return	previous output
+ */
+extern spp_out *spp_out_select(spp_out *o);
+
+#endif /* __OUTPUT_H__ */
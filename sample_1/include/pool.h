@@ -0,0 +1,85 @@
+/*
+ * pool.h
+ *
+ * Daemon worker pool. Every feature of cmd_tables is an actor with its own
+ * FIFO: requests of one feature run one at a time and in order, so handlers
+ * written for a one-shot process need no locking, while different features
+ * run in parallel on different workers.
+ *
+ */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <output.h>
+
+#define POOL_MAX_WORKERS    8
+#define POOL_MAX_ARGS       32
+
+typedef struct spp_req {
+    struct spp_req *next;
+    int feature;            /* cmd_tables index, CMD_NUM for unknown commands */
+    int argc;
+    char *argv[POOL_MAX_ARGS];
+    char *data;             /* owns the argv strings */
+    size_t len;
+    uint32_t id;            /* client request id, ring position without conn */
+    struct spp_conn *conn;  /* daemon connection, referenced until done */
+    int ring_flags;         /* SPP_RING_F_* of a command from the ring */
+    pid_t pid;              /* caller for the journal, -1 if unknown */
+    uid_t uid;              /* (uid_t)-1 if unknown */
+    uint64_t queued_ns;
+    spp_out out;            /* handler output */
+    spp_chan chan;          /* where out streams to, set by the daemon */
+    int streamed;           /* output went out before completion */
+    int ret;                /* handler return value */
+    struct spp_req *join;   /* identical requests answered with this one */
+    struct spp_req *flight_next;
+} spp_req;
+
+/*
+ * @param	workers	number of threads, 0 for one per CPU (2 to POOL_MAX_WORKERS)
+ * @param	wakefd	written to whenever a request completes
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_pool_start(int workers, int wakefd);
+
+/* Stop and join the workers, queued requests are dropped */
+extern void spp_pool_stop(void);
+
+/*
+ * Queue a request on the actor of req->feature. A request of a
+ * CMD_IDEMPOTENT feature identical to one that has not completed or
+ * started streaming yet is put on its join list instead of running again.
+ * @return	0 on success and -1 if the pool is not running
+ */
+extern int spp_pool_submit(spp_req *req);
+
+/*
+ * Take one completed request, called from the daemon loop
+ * @return	request or NULL, the requests on its join list share its
+ *		output and ret. Release it with spp_req_free().
+ */
+extern spp_req *spp_pool_done(void);
+
+/* Wake the daemon loop as if a request completed */
+extern void spp_pool_wake(void);
+
+/*
+ * Called by the channel before the first chunk of req goes out: from
+ * then on identical requests can not join it
+ */
+extern void spp_pool_streaming(spp_req *req);
+
+/*
+ * Build a request from a NUL separated argv payload
+ * @return	request or NULL on failure
+ */
+extern spp_req *spp_req_new(const char *data, size_t len);
+extern void spp_req_free(spp_req *req);
+
+/* Queue depths and counters as key=value lines */
+extern void spp_pool_stats(spp_out *o);
+
+#endif /* __POOL_H__ */
@@ -0,0 +1,110 @@
+/*
+ * ring.h
+ *
+ * Shared memory command ring for callers that run the same few commands
+ * many times a second (LEDs, relays). The daemon creates a memfd and an
+ * eventfd and passes both to clients over its socket; clients then queue
+ * fixed size records without a syscall and the daemon drains them in
+ * batches. Any number of producers, the daemon is the only consumer.
+ * Ring commands run on the worker pool like any request, their output is
+ * dropped.
+ *
+ */
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdint.h>
+#include <output.h>
+
+#define SPP_RING_SLOTS      1024    /* power of 2 */
+#define SPP_RING_ARGS       56      /* bytes of arguments per record */
+#define SPP_RING_FEATURES   32      /* feature names published in the ring */
+#define SPP_RING_NAME_LEN   16
+
+/* record flags */
+#define SPP_RING_F_DONE     0x1     /* report the return value, see spp_ring_wait() */
+
+/*
+ * One cache line per command: a cmd_tables index and the arguments that
+ * follow the feature name, NUL separated
+ */
+typedef struct {
+    uint32_t seq;           /* slot sequence, owned by the ring */
+    uint16_t feature;       /* cmd_tables index */
+    uint8_t flags;          /* SPP_RING_F_* */
+    uint8_t len;            /* bytes used in args */
+    char args[SPP_RING_ARGS];
+} spp_ring_rec;
+
+typedef struct spp_ring spp_ring;
+
+/*
+ * Daemon: create the ring
+ * @param	names	feature names in cmd_tables order, clients look them up
+ *		with spp_ring_feature()
+ * @return	ring or NULL on failure
+ */
+extern spp_ring *spp_ring_create(const char **names, int count);
+
+/*
+ * Client: map a ring received from the daemon, takes over both fds even
+ * on failure
+ * @return	ring or NULL on failure
+ */
+extern spp_ring *spp_ring_map(int memfd, int evfd);
+
+extern void spp_ring_close(spp_ring *r);
+
+/* memfd and eventfd to pass to clients, the eventfd is polled by the daemon */
+extern int spp_ring_memfd(spp_ring *r);
+extern int spp_ring_evfd(spp_ring *r);
+
+/*
+ * @param	name	feature name as typed on the command line
+ * @return	cmd_tables index or -1 if the daemon has no such feature
+ */
+extern int spp_ring_feature(spp_ring *r, const char *name);
+
+/*
+ * Queue a command, the eventfd is only written when the daemon sleeps
+ * @param	feature	spp_ring_feature() index
+ * @param	argc	arguments after the feature name
+ * @param	flags	SPP_RING_F_*
+ * @param	ticket	ring position for spp_ring_wait(), may be NULL
+ * @return	0 on success, -EAGAIN if the ring is full, -E2BIG if the
+ *		arguments do not fit in a record
+ */
+extern int spp_ring_push(spp_ring *r, int feature, int argc, char **argv, int flags, uint32_t *ticket);
+
+/*
+ * Wait for a command queued with SPP_RING_F_DONE. The result slot is
+ * reused SPP_RING_SLOTS commands later, collect it before that.
+ * @param	timeout_ms	-1 to wait forever
+ * @param	code	handler return value
+ * @return	0 on success and -1 on timeout
+ */
+extern int spp_ring_wait(spp_ring *r, uint32_t ticket, int timeout_ms, int *code);
+
+/*
+ * Daemon: take the oldest record
+ * @param	ticket	its ring position
+ * @return	1 if rec was filled and 0 if the ring is empty
+ */
+extern int spp_ring_pop(spp_ring *r, spp_ring_rec *rec, uint32_t *ticket);
+
+/* Daemon: publish the return value of a SPP_RING_F_DONE record */
+extern void spp_ring_complete(spp_ring *r, uint32_t ticket, int code);
+
+/*
+ * Daemon: announce that it is about to sleep on the eventfd
+ * @return	1 if the ring is empty and it may sleep, 0 if records arrived
+ */
+extern int spp_ring_idle(spp_ring *r);
+
+/* Daemon: awake again, drains the eventfd if it was signalled */
+extern void spp_ring_woken(spp_ring *r, int signalled);
+
+/* Counters as key=value lines */
+extern void spp_ring_stats(spp_ring *r, spp_out *o);
+
+#endif /* __RING_H__ */
@@ -17,7 +17,9 @@
 
 #include <signal.h>
 #include <sys/wait.h>
+#include <errno.h>
 #include <string.h>
+#include <tokenize.h>
 
 #ifdef REDIRECT_NULL_DEVICE
 #define NULL_DEVICE ">/dev/null"
@@ -76,6 +78,33 @@ extern int waitfor(int fd, int timeout);
  */
 extern int _eval(char *const argv[], char *path, int timeout, pid_t *ppid);
 
+/* _eval_ms() and waitpid_ms() result when the child was killed on timeout */
+#define EVAL_TIMEDOUT	(-ETIMEDOUT)
+
+/* Time between SIGTERM and SIGKILL to a process group that timed out */
+#define EVAL_KILL_GRACE_MS	200
+
+/* 
+ * Concatenates NULL-terminated list of arguments into a single
+ * commmand and executes it. The child leads a new process group; on
+ * timeout the whole group gets SIGTERM and then SIGKILL.
+ * @param	argv	argument list
+ * @param	path	NULL, ">output", or ">>output"
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @param	ppid	NULL to wait for child termination or pointer to pid
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
+ */
+extern int _eval_ms(char *const argv[], char *path, int timeout_ms, pid_t *ppid);
+
+/*
+ * Waits for child termination, the child must lead its own process group
+ * @param	pid	child pid
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @param	status	wait status
+ * @return	0 on success, EVAL_TIMEDOUT if the process group was killed or errno
+ */
+extern int waitpid_ms(pid_t pid, int timeout_ms, int *status);
+
 /* 
  * Concatenates NULL-terminated list of arguments into a single
  * commmand and executes it
@@ -84,6 +113,24 @@ extern int _eval(char *const argv[], char *path, int timeout, pid_t *ppid);
  */
 extern char * _backtick(char *const argv[]);
 
+/* 
+ * _backtick() with the child in a new process group
+ * @param	argv	argument list
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @return	stdout of executed command or NULL if an error occurred,
+ *		errno is ETIMEDOUT if the process group was killed
+ */
+extern char * _backtick_ms(char *const argv[], int timeout_ms);
+
+/* 
+ * _backtick_ms() with stdout forwarded to the SPP_PRINT() output instead
+ * of returned, large outputs do not pile up in memory
+ * @param	argv	argument list
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
+ */
+extern int _backtick_out(char *const argv[], int timeout_ms);
+
 /* 
  * Signal process whose PID is stored in plaintext in pidfile
  * @param	pidfile	PID file
@@ -158,6 +205,14 @@ extern int evalsh(const char *fmt,...);
 
 extern int evalsh_nowait(const char *fmt,...);
 
+/* 
+ * shell execution with _eval_ms
+ * @param	timeout_ms	milliseconds before the shell and its children are killed
+ * @param	fmt	argument string
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
+ */
+extern int evalsh_ms(int timeout_ms, const char *fmt,...);
+
 /* 
  * shell execution with _backtick
  * @param	fmt	argument string
@@ -211,6 +266,21 @@ extern char *backticksh(const char *fmt,...);
 	_eval(argv, NULL_DEVICE, 0, NULL); \
 })
 
+#define _evalsh_ms(timeout_ms, cmd, args...)({ \
+	char *argv[] = { "sh", "-c", cmd, ## args, NULL }; \
+	_eval_ms(argv, NULL_DEVICE, timeout_ms, NULL); \
+})
+
+#define _backticksh_ms(timeout_ms, cmd, args...)({ \
+	char *argv[] = { "sh", "-c", cmd, ## args, NULL }; \
+	_backtick_ms(argv, timeout_ms); \
+})
+
+#define _backticksh_out(timeout_ms, cmd, args...)({ \
+	char *argv[] = { "sh", "-c", cmd, ## args, NULL }; \
+	_backtick_out(argv, timeout_ms); \
+})
+
 #define _evalsh_nowait(cmd, args...)({ \
 	char *argv[] = { "sh", "-c", cmd, ## args, NULL }; \
 	_eval_nowait(argv, NULL_DEVICE, 0, NULL); \
@@ -233,31 +303,18 @@ extern char *backticksh(const char *fmt,...);
 
 /* Copy each token in wordlist delimited by space into word */
 #define foreach(word, wordlist, next) \
-	for (next = &wordlist[strspn(wordlist, " ")], \
-	     strncpy(word, next, sizeof(word)), \
-	     word[strcspn(word, " ")] = '\0', \
-	     word[sizeof(word) - 1] = '\0', \
-	     next = strchr(next, ' '); \
-	     strlen(word); \
-	     next = next ? &next[strspn(next, " ")] : "", \
-	     strncpy(word, next, sizeof(word)), \
-	     word[strcspn(word, " ")] = '\0', \
-	     word[sizeof(word) - 1] = '\0', \
-	     next = strchr(next, ' '))
-
-/* Copy each token in wordlist delimited by delim into word */
+	foreachby(word, wordlist, " ", next)
+
+/*
+ * Copy each token in wordlist delimited by any byte of delim into word,
+ * see tokenize.h for the zero-copy interface. The outer for only holds
+ * the loop state, a break leaves both.
+ */
 #define foreachby(word, wordlist, delim, next) \
-	for (next = &wordlist[strspn(wordlist, delim)], \
-	     strncpy(word, next, sizeof(word)), \
-	     word[strcspn(word, delim)] = '\0', \
-	     word[sizeof(word) - 1] = '\0', \
-	     next = strstr(next, delim); \
-	     strlen(word); \
-	     next = next ? &next[strspn(next, delim)] : "", \
-	     strncpy(word, next, sizeof(word)), \
-	     word[strcspn(word, delim)] = '\0', \
-	     word[sizeof(word) - 1] = '\0', \
-	     next = strstr(next, delim))
+	for (spp_tokenizer _fe_t, *_fe_p = spp_tok_words(&_fe_t, wordlist, delim); _fe_p; _fe_p = NULL) \
+		for (next = (char *)spp_tok_word(_fe_p, word, sizeof(word)); \
+		     next; \
+		     next = (char *)spp_tok_word(_fe_p, word, sizeof(word)))
 
 /* Return NUL instead of NULL if undefined */
 #define safe_getenv(s) (getenv(s) ? : "")
@@ -266,11 +323,28 @@ extern char *backticksh(const char *fmt,...);
  * get content of index by delim from src string
  * @param	src	argument string
  * @return	content	content of index
+ * @param	size	content buffer size
  * @param	delmin	delmin token
  * @param  index get index value
  * @return	return 0 on success and -1 on failure 
+ *
+ * A field longer than size - 1 bytes is truncated. Every call walks src
+ * from the start, use spp_tok_index_build() to read several fields.
+ */
+extern int getContentOfIndexByDelim(char *src, char *content, size_t size, char *delim, int index);
+
+/*
+ * get current time string YYYY-MM-DDThh:mm:ss+hh:mm, see timestamp.h
+ * @param	buf	store time string
+ * @param	size	indicate buf size
+ */
+extern void get_current_time(char *buf, int size);
+
+/*
+ * get current time string YYYY-MM-DDThh:mm:ss+hh:mm
+ * @return	per thread string, valid until the next call from the same thread
  */
-extern int getContentOfIndexByDelim(char *src, char *content, char *delim, int index);
+extern char *current_time(void);
 
 #ifdef linux
 /* Print directly to the console */
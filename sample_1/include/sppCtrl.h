@@ -14,9 +14,18 @@
 #include <stdio.h>	/* stderr */
 #include <string.h>	/* strcmp */
 #include <errno.h>
+#include <unistd.h>
 #include <shutils.h> /* backtick */
 #include <utils.h>
+#include <output.h> /* SPP_PRINT */
 
+#include <nvcache.h> /* spp_nvram_get/set, snapshot over nvram.h */
+#ifndef NVRAM_FILE
 #include <nvram.h> /* nvram usr/nvram/include/ */
+#endif
+
+extern int spp_usage(int, char **);
+extern void spp_unlock(void);
+extern int spp_dispatch(int, char **, int *);
 
 #endif /* __SPPCTRL_H__ */
@@ -0,0 +1,80 @@
+/*
+ * sppclient.h
+ *
+ * libsppctrl: run sppCtrl commands in the resident daemon over one
+ * persistent connection instead of system("sppCtrl ..."). Requests are
+ * pipelined, replies are matched by request id. A client belongs to one
+ * thread at a time.
+ *
+ */
+#ifndef __SPPCLIENT_H__
+#define __SPPCLIENT_H__
+
+#include <stdint.h>
+#include <output.h>
+#include <ring.h>
+
+typedef struct spp_client spp_client;
+
+/*
+ * Completion of an async request
+ * @param	id	request id returned by spp_client_send()
+ * @param	code	handler return value, SPP_FAIL if the connection broke
+ * @param	out	everything the handler printed
+ */
+typedef void (*spp_client_cb)(spp_client *c, uint32_t id, int code, const char *out, size_t len, void *arg);
+
+/*
+ * @param	path	daemon socket, NULL for DAEMON_SOCK_PATH
+ * @return	client or NULL if the daemon is not running
+ */
+extern spp_client *spp_client_open(const char *path);
+
+/* Requests still in flight complete with SPP_FAIL */
+extern void spp_client_close(spp_client *c);
+
+/* Socket to poll() for POLLIN before spp_client_process() */
+extern int spp_client_fd(spp_client *c);
+
+/* Requests sent and not completed yet */
+extern int spp_client_pending(spp_client *c);
+
+/*
+ * Send a request without waiting for it, argv[0] is the program name as
+ * for main()
+ * @param	cb	called from spp_client_process() or spp_client_call(), NULL drops the reply
+ * @return	request id or 0 on failure
+ */
+extern uint32_t spp_client_send(spp_client *c, int argc, char **argv, spp_client_cb cb, void *arg);
+
+/*
+ * Read replies and run callbacks of completed requests
+ * @param	timeout_ms	milliseconds to wait for data, 0 to not wait and -1 forever
+ * @return	requests completed or -1 if the connection is gone
+ */
+extern int spp_client_process(spp_client *c, int timeout_ms);
+
+/*
+ * Send a request and wait for it, other requests complete meanwhile
+ * @param	out	handler output, may be NULL
+ * @param	code	handler return value
+ * @return	0 on success and -1 on failure
+ */
+extern int spp_client_call(spp_client *c, int argc, char **argv, spp_out *out, int *code);
+
+/*
+ * spp_client_call() with a NULL terminated argument list, the program
+ * name is added
+ * @return	handler return value or SPP_FAIL
+ */
+extern int spp_client_run(spp_client *c, spp_out *out, const char *arg, ...) __attribute__((sentinel));
+
+/*
+ * Attach to the daemon's command ring, for commands run too often for a
+ * round trip each. Ring commands print nothing, their return value is
+ * reported with SPP_RING_F_DONE.
+ * @return	ring, independent of the client once returned, or NULL
+ */
+extern spp_ring *spp_client_ring(spp_client *c);
+
+#endif /* __SPPCLIENT_H__ */
@@ -0,0 +1,43 @@
+/*
+ * timestamp.h
+ *
+ * Cached wall clock strings and monotonic clocks for logging and latency.
+ *
+ */
+#ifndef __TIMESTAMP_H__
+#define __TIMESTAMP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* YYYY-MM-DDThh:mm:ss+hh:mm plus NUL */
+#define SPP_ISO8601_LEN 32
+
+/*
+ * Monotonic clock for measuring latency
+ * @return	nanoseconds since an arbitrary start point
+ */
+extern uint64_t spp_mono_ns(void);
+
+/*
+ * Cheaper monotonic clock with tick resolution (CLOCK_MONOTONIC_COARSE)
+ * @return	nanoseconds since an arbitrary start point
+ */
+extern uint64_t spp_mono_coarse_ns(void);
+
+/*
+ * Local time as YYYY-MM-DDThh:mm:ss+hh:mm (or Z for UTC), the string is
+ * formatted at most once per second per thread
+ * @param	buf	caller buffer, SPP_ISO8601_LEN bytes is always enough
+ * @param	size	buffer size
+ * @return	string length, a value >= size means buf was truncated
+ */
+extern size_t spp_time_iso8601(char *buf, size_t size);
+
+/*
+ * Same as spp_time_iso8601() without copying
+ * @return	per-thread string, valid until the next call from this thread
+ */
+extern const char *spp_time_iso8601_cached(void);
+
+#endif /* __TIMESTAMP_H__ */
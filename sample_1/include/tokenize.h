@@ -0,0 +1,132 @@
+/*
+ * tokenize.h
+ *
+ * Zero-copy tokenizer: tokens are (pointer, length) views into the
+ * source string, nothing is copied unless the caller asks for it.
+ *
+ */
+#ifndef __TOKENIZE_H__
+#define __TOKENIZE_H__
+
+#include <stddef.h>
+
+/* A token is a view into the source string, it is NOT NUL terminated */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} spp_tok;
+
+/* Precomputed delimiter set, every byte in the set splits tokens */
+typedef struct {
+    unsigned char map[32];
+    unsigned char chars[4];
+    int nchars;     /* number of delimiter bytes if <= 4, else -1 (map only) */
+} spp_delim;
+
+typedef struct {
+    const char *cur;
+    const char *end;
+    spp_delim delim;
+} spp_tokenizer;
+
+/* One-pass offset index for random field access */
+typedef struct {
+    const char *src;
+    size_t *off;    /* off[2*i] = start of field i, off[2*i+1] = length */
+    int count;
+    int size;
+} spp_tok_index;
+
+/*
+ * Build delimiter set from NUL terminated string of delimiter bytes
+ * @param	d	delimiter set to fill
+ * @param	delim	delimiter bytes, NULL or "" means blank (space)
+ */
+extern void spp_delim_init(spp_delim *d, const char *delim);
+
+/*
+ * Find first delimiter byte in s[0..n)
+ * @param	s	buffer
+ * @param	n	buffer length
+ * @param	d	delimiter set
+ * @return	pointer to the delimiter or s + n if none
+ */
+extern const char *spp_delim_find(const char *s, size_t n, const spp_delim *d);
+
+/*
+ * Skip leading delimiter bytes in s[0..n)
+ * @return	pointer to the first non delimiter byte or s + n
+ */
+extern const char *spp_delim_skip(const char *s, size_t n, const spp_delim *d);
+
+/*
+ * Start tokenizing s[0..n)
+ * @param	t	tokenizer state
+ * @param	s	source, must stay valid while tokens are used
+ * @param	n	source length
+ * @param	delim	delimiter bytes
+ */
+extern void spp_tok_init(spp_tokenizer *t, const char *s, size_t n, const char *delim);
+
+/*
+ * Fetch next token, empty fields between delimiters are skipped
+ * @param	t	tokenizer state
+ * @param	tok	token view
+ * @return	1 if a token was returned and 0 at end of input
+ */
+extern int spp_tok_next(spp_tokenizer *t, spp_tok *tok);
+
+/*
+ * Copy token to NUL terminated buffer
+ * @param	tok	token view
+ * @param	buf	destination
+ * @param	size	destination size
+ * @return	token length, a value >= size means buf was truncated
+ */
+extern size_t spp_tok_copy(const spp_tok *tok, char *buf, size_t size);
+
+/*
+ * Compare token with NUL terminated string
+ * @return	1 if equal and 0 otherwise
+ */
+extern int spp_tok_eq(const spp_tok *tok, const char *s);
+
+/*
+ * Index all fields of src in one pass
+ * @param	idx	index to fill, release with spp_tok_index_free()
+ * @param	src	source string, must stay valid while the index is used
+ * @param	delim	delimiter bytes
+ * @return	number of fields or -1 on failure
+ */
+extern int spp_tok_index_build(spp_tok_index *idx, const char *src, const char *delim);
+
+/*
+ * Random access to an indexed field
+ * @param	idx	index
+ * @param	i	field number starting from 0
+ * @param	tok	token view
+ * @return	0 on success and -1 if out of range
+ */
+extern int spp_tok_field(const spp_tok_index *idx, int i, spp_tok *tok);
+
+extern void spp_tok_index_free(spp_tok_index *idx);
+
+/*
+ * Start a foreach()/foreachby() loop over the NUL terminated s, the
+ * delimiter set is built once for the whole loop
+ * @param	t	loop state
+ * @param	delim	delimiter bytes
+ * @return	t
+ */
+extern spp_tokenizer *spp_tok_words(spp_tokenizer *t, const char *s, const char *delim);
+
+/*
+ * Copy next token of a foreach()/foreachby() loop into word
+ * @param	t	loop state from spp_tok_words()
+ * @param	word	destination, truncated to size - 1
+ * @param	size	destination size
+ * @return	position right after the token or NULL if no token left
+ */
+extern const char *spp_tok_word(spp_tokenizer *t, char *word, size_t size);
+
+#endif /* __TOKENIZE_H__ */
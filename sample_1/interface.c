@@ -14,6 +14,10 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <macidx.h>
+#include <ifstats.h>
+#include <ifctl.h>
+#include <nlbatch.h>
 
 
 #define INT_STR 32
@@ -22,14 +26,19 @@
 #define MANAGE_DID  "ra1"
 #define MANAGE_APCLI "apcli0"
 
-static void help(void);
+static int help(int argc, char **argv);
 static char *help_str[] = {
 "Example:\n"
 "\t[CMD] interface off\n"
+"\t[CMD] interface on ra0\n"
+"\t[CMD] interface addr br0 192.168.1.1 255.255.255.0\n"
+"\t[CMD] interface mtu br0 1400\n"
+"\t[CMD] interface set br0 up mtu=1500 addr=192.168.1.1/24 ra0 down route=10.0.0.0/8@192.168.1.254\n"
+"Interface defaults to " MANAGE_INT "\n"
 "Command:\n"
 };
 
-typedef void (*FUNC)(void);
+typedef int (*FUNC)(int, char **);
 
 typedef struct {
     char if_name[INT_STR];
@@ -45,16 +54,17 @@ int GetNetInfo(ETH_INT *eth_int)
     struct ifreq req; 
     struct sockaddr_in* host = NULL; 
  
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0); 
-    if (-1 == sockfd ) { 
-        return SPP_FAIL; 
-    } 
+    // shared with ifctl, not closed here
+    int sockfd = spp_if_sock();
+    if (sockfd < 0) {
+        return SPP_FAIL;
+    }
  
     bzero(&req, sizeof(struct ifreq)); 
     strcpy(req.ifr_name, eth_int->if_name); 
     if (ioctl(sockfd, SIOCGIFADDR, &req) >= 0) { 
         host = (struct sockaddr_in*)&req.ifr_addr; 
-        sprintf(eth_int->ip_addr, "%s", inet_ntoa(host->sin_addr));
+        inet_ntop(AF_INET, &host->sin_addr, eth_int->ip_addr, sizeof(eth_int->ip_addr));
     } 
     else { 
         ret = SPP_FAIL; 
@@ -64,7 +74,7 @@ int GetNetInfo(ETH_INT *eth_int)
     strcpy(req.ifr_name, eth_int->if_name); 
     if (ioctl(sockfd, SIOCGIFNETMASK, &req) >= 0 ) { 
         host = (struct sockaddr_in*)&req.ifr_addr;
-        sprintf(eth_int->mask, "%s", inet_ntoa(host->sin_addr)); 
+        inet_ntop(AF_INET, &host->sin_addr, eth_int->mask, sizeof(eth_int->mask));
     } 
     else { 
         ret = SPP_FAIL; 
@@ -73,33 +83,54 @@ int GetNetInfo(ETH_INT *eth_int)
     bzero(&req, sizeof(struct ifreq)); 
     strcpy(req.ifr_name, eth_int->if_name); 
     if (ioctl(sockfd, SIOCGIFHWADDR, &req) >= 0 ) { 
-        sprintf(eth_int->mac, "%02x:%02x:%02x:%02x:%02x:%02x", 
-            (unsigned char)req.ifr_hwaddr.sa_data[0], 
-            (unsigned char)req.ifr_hwaddr.sa_data[1], 
-            (unsigned char)req.ifr_hwaddr.sa_data[2], 
-            (unsigned char)req.ifr_hwaddr.sa_data[3], 
-            (unsigned char)req.ifr_hwaddr.sa_data[4], 
-            (unsigned char)req.ifr_hwaddr.sa_data[5] 
-        ); 
+        spp_mac_format(spp_mac_from_bytes((unsigned char *)req.ifr_hwaddr.sa_data), eth_int->mac, 0);
     } 
     else { 
         ret = SPP_FAIL; 
     } 
  
-    if (sockfd != -1 ) { 
-        close(sockfd); 
-        sockfd = -1; 
-    } 
-
     return ret; 
 } 
 
-char *interface_status(void)
+/*
+ * Counters and rates of every interface, -1 only if the sink fails. The
+ * rate keys are left out until there is a previous sample to rate against,
+ * a one-shot run never has one.
+ */
+static ssize_t interface_traffic(spp_sink *s)
+{
+    spp_ifstat st[IFSTATS_MAX];
+    spp_ifstat *t = NULL;
+    int i = 0, n = 0;
+
+    // no netlink: the traffic keys are left out
+    if ((n = spp_ifstats_sample(st, IFSTATS_MAX)) < 0) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        t = &st[i];
+        if (spp_sink_printf(s, "spp_%s_rx_bytes=%llu\nspp_%s_rx_packets=%llu\nspp_%s_rx_errors=%llu\n"
+                    "spp_%s_tx_bytes=%llu\nspp_%s_tx_packets=%llu\nspp_%s_tx_errors=%llu\n",
+                    t->name, (unsigned long long)t->rx_bytes, t->name, (unsigned long long)t->rx_packets,
+                    t->name, (unsigned long long)t->rx_errors, t->name, (unsigned long long)t->tx_bytes,
+                    t->name, (unsigned long long)t->tx_packets, t->name, (unsigned long long)t->tx_errors) < 0) {
+            return -1;
+        }
+        if (t->rated && spp_sink_printf(s, "spp_%s_rx_bps=%llu\nspp_%s_tx_bps=%llu\nspp_%s_rx_pps=%llu\nspp_%s_tx_pps=%llu\n",
+                    t->name, (unsigned long long)t->rx_bps, t->name, (unsigned long long)t->tx_bps,
+                    t->name, (unsigned long long)t->rx_pps, t->name, (unsigned long long)t->tx_pps) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Reentrant, every call has its own ETH_INT and sink */
+ssize_t interface_status(spp_sink *s)
 {
 
     ETH_INT eth_int;
-    static char status_buf[STATUS_BUF];
-    int len = 0;
+    size_t len = s->len;
     int i = 0;
 
     char *int_query_tbl[] = {
@@ -110,48 +141,210 @@ char *interface_status(void)
         NULL
     };
 
-    bzero(&status_buf, sizeof(status_buf));
-
     for (i = 0; int_query_tbl[i] != NULL; i++) {
         bzero(&eth_int, sizeof(ETH_INT));
         strcpy(eth_int.if_name, int_query_tbl[i]);
         GetNetInfo(&eth_int);
 
-        len += sprintf(status_buf+len, "spp_%s_ip=%s\n", eth_int.if_name, eth_int.ip_addr);
-        len += sprintf(status_buf+len, "spp_%s_mask=%s\n", eth_int.if_name, eth_int.mask);
-        len += sprintf(status_buf+len, "spp_%s_mac=%s\n", eth_int.if_name, eth_int.mac);
+        if (spp_sink_printf(s, "spp_%s_ip=%s\n", eth_int.if_name, eth_int.ip_addr) < 0 ||
+                spp_sink_printf(s, "spp_%s_mask=%s\n", eth_int.if_name, eth_int.mask) < 0 ||
+                spp_sink_printf(s, "spp_%s_mac=%s\n", eth_int.if_name, eth_int.mac) < 0) {
+            return -1;
+        }
     }
 
-    return status_buf;
+    if (interface_traffic(s) < 0) {
+        return -1;
+    }
+
+    return s->len - len;
+}
+
+
+
+/* Report a -errno from ifctl, SPP_OK when there is none */
+static int if_result(const char *op, const char *ifname, int ret)
+{
+    if (ret < 0) {
+        SPP_PRINT("spp_if_error=%s %s: %s (errno=%d)\n", op, ifname, strerror(-ret), -ret);
+        return SPP_FAIL;
+    }
+    return SPP_OK;
 }
 
+static const char *if_name(int argc, char **argv)
+{
+    return argc > 3 ? argv[3] : MANAGE_INT;
+}
 
+static int set_off(int argc, char **argv)
+{
+    if (if_result("off", if_name(argc, argv), spp_if_set_up(if_name(argc, argv), 0)) != SPP_OK) {
+        return SPP_FAIL;
+    }
+    SPP_PRINT("Set Interface %s OFF\n", if_name(argc, argv));
+    return SPP_OK;
+}
 
-static void set_off(void)
+static int set_on(int argc, char **argv)
 {
-    SPP_PRINT("Set Interface OFF\n");
+    if (if_result("on", if_name(argc, argv), spp_if_set_up(if_name(argc, argv), 1)) != SPP_OK) {
+        return SPP_FAIL;
+    }
+    SPP_PRINT("Set Interface %s ON\n", if_name(argc, argv));
+    return SPP_OK;
 }
 
-static void set_on(void)
+/* addr <ifname> <ip> [mask] */
+static int set_addr(int argc, char **argv)
 {
-    SPP_PRINT("Set Interface ON\n");
+    if (argc < 5) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+    return if_result("addr", argv[3], spp_if_set_addr(argv[3], argv[4], argc > 5 ? argv[5] : NULL));
+}
+
+/* mtu <ifname> <mtu> */
+static int set_mtu(int argc, char **argv)
+{
+    if (argc < 5) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+    return if_result("mtu", argv[3], spp_if_set_mtu(argv[3], atoi(argv[4])));
+}
+
+/*
+ * "a.b.c.d/len" into addr and prefix, addr points into arg
+ * @return	0 on success, -EINVAL if len is not a number from 0 to 32
+ */
+static int if_prefix(char *arg, char **addr, int *prefix)
+{
+    char *slash = strchr(arg, '/'), *end = NULL;
+    long len = 32;
+
+    *addr = arg;
+    if (slash) {
+        // "a.b.c.d/" or "/x" must not become a /0
+        if (slash[1] < '0' || slash[1] > '9') {
+            return -EINVAL;
+        }
+        errno = 0;
+        len = strtol(slash + 1, &end, 10);
+        if (errno || *end != '\0' || len < 0 || len > 32) {
+            return -EINVAL;
+        }
+        *slash = '\0';
+    }
+    *prefix = len;
+    return 0;
+}
+
+/* Queue one item of "set", ifname is the interface it applies to */
+static int if_set_item(spp_nl_batch *b, const char *ifname, char *item)
+{
+    char *val = strchr(item, '='), *addr = NULL, *gw = NULL;
+    int prefix = 0;
+
+    if (!strcmp(item, "up") || !strcmp(item, "down")) {
+        return spp_nl_link(b, ifname, item[0] == 'u', 0);
+    }
+    if (val == NULL) {
+        return -EINVAL;
+    }
+    *val++ = '\0';
+    if (!strcmp(item, "mtu")) {
+        return spp_nl_link(b, ifname, -1, atoi(val));
+    }
+    if (!strcmp(item, "addr") || !strcmp(item, "deladdr")) {
+        if (if_prefix(val, &addr, &prefix) < 0) {
+            return -EINVAL;
+        }
+        return spp_nl_addr(b, ifname, addr, prefix, item[0] == 'd');
+    }
+    if (!strcmp(item, "route")) {
+        if ((gw = strchr(val, '@')) != NULL) {
+            *gw++ = '\0';
+        }
+        if (if_prefix(val, &addr, &prefix) < 0) {
+            return -EINVAL;
+        }
+        return spp_nl_route(b, addr, prefix, gw, ifname);
+    }
+    return -EINVAL;
+}
+
+/*
+ * set <ifname> <item>... [<ifname> <item>...]
+ * Items are up, down, mtu=N, addr=A/P, deladdr=A/P and route=D/P[@GW]; a
+ * word without '=' other than up/down names the next interface. All of it
+ * goes to the kernel in one netlink batch.
+ */
+static int set_batch(int argc, char **argv)
+{
+    spp_nl_batch *b = NULL;
+    const char *ifname = NULL, *label = NULL;
+    char item[64];
+    int i = 0, ret = 0, failed = 0;
+
+    if (argc < 5) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+    if ((b = spp_nl_batch_new()) == NULL) {
+        return SPP_FAIL;
+    }
+
+    for (i = 3; i < argc; i++) {
+        if (strchr(argv[i], '=') == NULL && strcmp(argv[i], "up") && strcmp(argv[i], "down")) {
+            ifname = argv[i];
+            continue;
+        }
+        strncpy(item, argv[i], sizeof(item) - 1);
+        item[sizeof(item) - 1] = '\0';
+        if (ifname == NULL || (ret = if_set_item(b, ifname, item)) < 0) {
+            // nothing is sent when the command line is wrong
+            if_result(argv[i], ifname ? ifname : "-", ifname ? ret : -EINVAL);
+            spp_nl_batch_free(b);
+            return SPP_FAIL;
+        }
+    }
+
+    if ((failed = spp_nl_batch_commit(b)) < 0) {
+        if_result("set", argv[3], failed);
+        spp_nl_batch_free(b);
+        return SPP_FAIL;
+    }
+    for (i = 0; i < spp_nl_batch_count(b); i++) {
+        if ((ret = spp_nl_batch_result(b, i, &label)) < 0) {
+            SPP_PRINT("spp_if_op=%s: %s (errno=%d)\n", label, strerror(-ret), -ret);
+        } else {
+            SPP_PRINT("spp_if_op=%s: ok\n", label);
+        }
+    }
+    spp_nl_batch_free(b);
+    return failed ? SPP_FAIL : SPP_OK;
 }
 
 static void *cmd[CMD_NUM][CMD_LEN] = {
     {"help", "Show this help page", &help},
     {"off", "Turn off interface", &set_off},
     {"on", "Turn on interface", &set_on},
+    {"addr", "Set IPv4 address and netmask", &set_addr},
+    {"mtu", "Set MTU", &set_mtu},
+    {"set", "Apply several changes in one netlink batch", &set_batch},
     {NULL, NULL, NULL}
 };
 
-static void help(void)
+static int help(int argc, char **argv)
 {
     int i = 0;
     SPP_PRINT("%s", help_str[0]);
     for (i = 0; cmd[i][0]; i++) {
         SPP_PRINT("%s,      \t%s\n", (char *)cmd[i][0], (char *)cmd[i][1]);
     }
-
+    return SPP_OK;
 }
 
 int interface(int argc, char **argv)
@@ -159,20 +352,20 @@ int interface(int argc, char **argv)
     int cmdVector = 0;
 
     if (argc < 3) {
-        help();
+        help(argc, argv);
         return SPP_FAIL;
     }
 
     cmdVector = sppcmd_check(cmd, argv[2]);
     if (cmdVector == SPP_FAIL) {
-        help();
+        help(argc, argv);
         return SPP_FAIL;
     }
 
     if (cmd[cmdVector][0] != NULL) {
-        ((FUNC)cmd[cmdVector][2])();
+        return ((FUNC)cmd[cmdVector][2])(argc, argv);
     } else {
-        help();
+        help(argc, argv);
         return SPP_FAIL;
     }
     return SPP_OK;
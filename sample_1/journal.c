@@ -0,0 +1,583 @@
+/*
+ * journal.c
+ *
+ * The file is a header the size of one record followed by JOURNAL_RECORDS
+ * slots. Slot numbers come from __atomic_fetch_add() on the header tail in
+ * the shared mapping; a writer fills its slot and stores the checksum
+ * last. The tail may run past the end: whoever gets a slot out of range
+ * rotates, under flock() on JOURNAL_PATH.lock, unless the file was rotated
+ * by someone else already, and maps the new file. Inside a process the
+ * mapping is replaced under a write lock, appends hold it for reading.
+ *
+ */
+
+#define _GNU_SOURCE     /* strptime */
+#include <config.h>
+#include <sppCtrl.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <daemon.h>
+#include <journal.h>
+#include <timestamp.h>
+
+#define JOURNAL_MAGIC       0x4a707053  /* "SppJ" */
+#define JOURNAL_VERSION     1
+#define JOURNAL_OLD         JOURNAL_PATH ".1"
+#define JOURNAL_TMP         JOURNAL_PATH ".tmp"
+#define JOURNAL_LOCK        JOURNAL_PATH ".lock"
+#define JOURNAL_TRIES       4           /* rotations raced per append */
+#define JOURNAL_SIZE(cap)   (((size_t)(cap) + 1) * sizeof(spp_jrec))
+
+typedef union {
+    struct {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t rec_size;
+        uint32_t capacity;
+        uint64_t tail;      /* next slot, atomic, may run past capacity */
+        int64_t created_ns;
+    };
+    spp_jrec pad;
+} JOURNAL_HDR;
+
+typedef struct {
+    char *map;
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+} JOURNAL_MAP;
+
+static JOURNAL_MAP jr = { NULL };
+static pthread_rwlock_t jr_lock = PTHREAD_RWLOCK_INITIALIZER;
+static __thread pid_t jr_pid = 0;
+static __thread uid_t jr_uid = 0;
+static __thread int jr_flags = 0;
+
+static uint32_t crc_tbl[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+extern void *cmd_tables[CMD_NUM][CMD_LEN];
+
+static int help(int, char **);
+static char *help_str[] = {
+"Example:\n"
+"\t[CMD] journal show since=-1h cmd=interface\n"
+"\t[CMD] journal show since=2026-10-19T08:00:00 until=2026-10-19T09:00:00 last=20\n"
+"Command:\n"
+};
+
+typedef int (*FUNC)(int, char **);
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int i = 0, k = 0;
+
+    for (i = 0; i < 256; i++) {
+        for (c = i, k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_tbl[i] = c;
+    }
+}
+
+/* CRC-32 of r with its crc field taken as 0 */
+static uint32_t jr_crc(const spp_jrec *r)
+{
+    const unsigned char *p = (const unsigned char *)r + sizeof(r->crc);
+    size_t len = sizeof(spp_jrec) - sizeof(r->crc);
+    uint32_t c = 0xffffffff;
+    int i = 0;
+
+    pthread_once(&crc_once, crc_init);
+    for (i = 0; i < (int)sizeof(r->crc); i++) {
+        c = crc_tbl[c & 0xff] ^ (c >> 8);
+    }
+    while (len--) {
+        c = crc_tbl[(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+static int64_t real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Serializes creation and rotation between processes, -1 on failure */
+static int jr_flock(void)
+{
+    int fd = open(JOURNAL_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd >= 0 && flock(fd, LOCK_EX) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void jr_funlock(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/* An empty journal at JOURNAL_PATH, published by rename, flock held */
+static int jr_create(void)
+{
+    JOURNAL_HDR h;
+    int fd = -1, ret = -1;
+
+    if ((fd = open(JOURNAL_TMP, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    h.magic = JOURNAL_MAGIC;
+    h.version = JOURNAL_VERSION;
+    h.rec_size = sizeof(spp_jrec);
+    h.capacity = JOURNAL_RECORDS;
+    h.created_ns = real_ns();
+    // the slots stay a hole until written, zero is "never written"
+    if (ftruncate(fd, JOURNAL_SIZE(JOURNAL_RECORDS)) == 0
+            && pwrite(fd, &h, sizeof(h), 0) == sizeof(h)
+            && rename(JOURNAL_TMP, JOURNAL_PATH) == 0) {
+        ret = 0;
+    }
+    close(fd);
+    if (ret < 0) {
+        unlink(JOURNAL_TMP);
+    }
+    return ret;
+}
+
+/* The header makes sense for a file of size bytes */
+static int jr_valid(const JOURNAL_HDR *h, size_t size)
+{
+    return size >= sizeof(JOURNAL_HDR) && h->magic == JOURNAL_MAGIC && h->version == JOURNAL_VERSION
+        && h->rec_size == sizeof(spp_jrec) && h->capacity && JOURNAL_SIZE(h->capacity) <= size;
+}
+
+/*
+ * A crash can lose the header page while record pages made it to disk:
+ * move the tail past the slots already written
+ */
+static void jr_recover(JOURNAL_HDR *h)
+{
+    spp_jrec *slot = (spp_jrec *)(h + 1);
+    uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE), i = tail;
+
+    while (i < h->capacity && __atomic_load_n(&slot[i].magic, __ATOMIC_RELAXED)) {
+        i++;
+    }
+    if (i != tail) {
+        __atomic_compare_exchange_n(&h->tail, &tail, i, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+/* Map JOURNAL_PATH, creating it if needed; jr_lock held for writing */
+static int jr_map(void)
+{
+    struct stat st;
+    char *map = NULL;
+    int fd = -1, lfd = -1;
+
+    if ((fd = open(JOURNAL_PATH, O_RDWR | O_CLOEXEC)) < 0 && errno == ENOENT) {
+        if ((lfd = jr_flock()) < 0) {
+            return -1;
+        }
+        if ((fd = open(JOURNAL_PATH, O_RDWR | O_CLOEXEC)) < 0 && errno == ENOENT && jr_create() == 0) {
+            fd = open(JOURNAL_PATH, O_RDWR | O_CLOEXEC);
+        }
+        jr_funlock(lfd);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0
+            || (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    if (!jr_valid((JOURNAL_HDR *)map, st.st_size)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    jr.map = map;
+    jr.size = st.st_size;
+    jr.dev = st.st_dev;
+    jr.ino = st.st_ino;
+    jr_recover((JOURNAL_HDR *)map);
+    return 0;
+}
+
+static void jr_unmap(void)
+{
+    if (jr.map) {
+        munmap(jr.map, jr.size);
+        jr.map = NULL;
+    }
+}
+
+/*
+ * The mapped file is full: rotate it unless another thread or process
+ * did, then map the current file; jr_lock held for writing
+ */
+static int jr_rotate(void)
+{
+    JOURNAL_HDR *h = (JOURNAL_HDR *)jr.map;
+    struct stat st;
+    int lfd = -1;
+
+    if (__atomic_load_n(&h->tail, __ATOMIC_ACQUIRE) < h->capacity) {
+        return 0;
+    }
+    if ((lfd = jr_flock()) < 0) {
+        return -1;
+    }
+    if (stat(JOURNAL_PATH, &st) == 0 && st.st_dev == jr.dev && st.st_ino == jr.ino) {
+        // the one sync per file: the old generation is complete on disk
+        msync(jr.map, jr.size, MS_SYNC);
+        if (rename(JOURNAL_PATH, JOURNAL_OLD) < 0 || jr_create() < 0) {
+            jr_funlock(lfd);
+            return -1;
+        }
+    }
+    jr_funlock(lfd);
+    jr_unmap();
+    return jr_map();
+}
+
+void spp_journal_caller(pid_t pid, uid_t uid, int flags)
+{
+    jr_pid = pid;
+    jr_uid = uid;
+    jr_flags = flags;
+}
+
+/* argv[2..] space separated into r->args */
+static void jr_args(spp_jrec *r, int argc, char **argv)
+{
+    size_t len = 0, n = 0, room = 0;
+    int i = 0;
+
+    for (i = 2; i < argc; i++) {
+        room = sizeof(r->args) - 1 - len;
+        if (len > 0) {
+            if (room == 0) {
+                r->flags |= JOURNAL_F_TRUNC;
+                break;
+            }
+            r->args[len++] = ' ';
+            room--;
+        }
+        if ((n = strlen(argv[i])) > room) {
+            r->flags |= JOURNAL_F_TRUNC;
+            n = room;
+        }
+        memcpy(r->args + len, argv[i], n);
+        len += n;
+        if (r->flags & JOURNAL_F_TRUNC) {
+            break;
+        }
+    }
+    r->args[len] = '\0';
+}
+
+int spp_journal_log(int argc, char **argv, uint64_t start_ns, int ret)
+{
+    JOURNAL_HDR *h = NULL;
+    spp_jrec rec, *slot = NULL;
+    uint64_t now = spp_mono_ns(), seq = 0;
+    int feature = 0, tries = 0;
+
+    // every command is audited, status update writes as well
+    if (argc < 2 || (feature = sppcmd_check(cmd_tables, argv[1])) == SPP_FAIL) {
+        return 0;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = JOURNAL_MAGIC;
+    rec.time_ns = real_ns() - (int64_t)(now - start_ns);
+    rec.dur_us = (now - start_ns) / 1000;
+    rec.ret = ret;
+    rec.pid = jr_pid == 0 ? getpid() : jr_pid < 0 ? -1 : jr_pid;
+    rec.uid = jr_pid == 0 ? getuid() : jr_pid < 0 || jr_uid == (uid_t)-1 ? JOURNAL_UID_UNKNOWN : jr_uid;
+    rec.flags = (spp_daemon_self() ? JOURNAL_F_DAEMON : 0) | (jr_flags & JOURNAL_F_RING);
+    rec.argc = argc;
+    strncpy(rec.cmd, cmd_tables[feature][0], sizeof(rec.cmd) - 1);
+    jr_args(&rec, argc, argv);
+
+    for (tries = 0; tries < JOURNAL_TRIES; tries++) {
+        pthread_rwlock_rdlock(&jr_lock);
+        if ((h = (JOURNAL_HDR *)jr.map) != NULL
+                && (seq = __atomic_fetch_add(&h->tail, 1, __ATOMIC_ACQ_REL)) < h->capacity) {
+            slot = (spp_jrec *)(h + 1) + seq;
+            rec.seq = seq;
+            rec.crc = jr_crc(&rec);
+            // body first, a reader takes the record once the crc matches
+            memcpy((char *)slot + sizeof(rec.crc), (char *)&rec + sizeof(rec.crc), sizeof(rec) - sizeof(rec.crc));
+            __atomic_store_n(&slot->crc, rec.crc, __ATOMIC_RELEASE);
+            pthread_rwlock_unlock(&jr_lock);
+            return 0;
+        }
+        pthread_rwlock_unlock(&jr_lock);
+
+        pthread_rwlock_wrlock(&jr_lock);
+        if (jr.map == NULL ? jr_map() : jr_rotate()) {
+            pthread_rwlock_unlock(&jr_lock);
+            DBGMSG("journal %s: %s\n", JOURNAL_PATH, strerror(errno));
+            return -1;
+        }
+        pthread_rwlock_unlock(&jr_lock);
+    }
+    return -1;
+}
+
+/*
+ * Journal file for reading
+ * @param	size	mapping size
+ * @return	header or NULL if there is no valid file at path
+ */
+static JOURNAL_HDR *jr_open_ro(const char *path, size_t *size)
+{
+    struct stat st;
+    char *map = NULL;
+    int fd = -1;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(JOURNAL_HDR)
+            || (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    if (!jr_valid((JOURNAL_HDR *)map, st.st_size)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return (JOURNAL_HDR *)map;
+}
+
+/* 1 if the slot holds a complete record, copied to out */
+static int jr_read(const spp_jrec *slot, spp_jrec *out)
+{
+    uint32_t crc = __atomic_load_n(&slot->crc, __ATOMIC_ACQUIRE);
+
+    memcpy(out, slot, sizeof(spp_jrec));
+    return out->magic == JOURNAL_MAGIC && crc == jr_crc(out);
+}
+
+/*
+ * "-90s", "-15m", "-2h", "-1d" back from now, seconds since the epoch or
+ * local "YYYY-MM-DD[Thh:mm[:ss]]"
+ */
+static int parse_time(const char *s, int64_t *ns)
+{
+    struct tm tm;
+    char *end = NULL;
+    long long v = 0;
+    const char *fmts[] = {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M:%S", "%Y-%m-%d"};
+    int i = 0;
+
+    if (s[0] == '-') {
+        v = strtoll(s + 1, &end, 10);
+        switch (end == s + 1 ? 0 : *end ? *end : 's') {
+            case 's': break;
+            case 'm': v *= 60; break;
+            case 'h': v *= 3600; break;
+            case 'd': v *= 86400; break;
+            default: return -1;
+        }
+        *ns = real_ns() - v * 1000000000LL;
+        return 0;
+    }
+    v = strtoll(s, &end, 10);
+    if (end != s && *end == '\0') {
+        *ns = v * 1000000000LL;
+        return 0;
+    }
+    for (i = 0; i < (int)(sizeof(fmts) / sizeof(fmts[0])); i++) {
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_isdst = -1;
+        if ((end = strptime(s, fmts[i], &tm)) != NULL && *end == '\0') {
+            *ns = (int64_t)mktime(&tm) * 1000000000LL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    int64_t since;
+    int64_t until;
+    const char *cmd;
+    long last;
+    long skip;          /* matches to pass over for last */
+    long matched;
+} JOURNAL_FILTER;
+
+static int jr_match(JOURNAL_FILTER *f, const spp_jrec *r)
+{
+    return r->time_ns >= f->since && r->time_ns < f->until && (f->cmd == NULL || !strcmp(f->cmd, r->cmd));
+}
+
+static void jr_print(const spp_jrec *r)
+{
+    struct tm tm;
+    time_t sec = r->time_ns / 1000000000LL;
+    char ts[SPP_ISO8601_LEN];
+
+    localtime_r(&sec, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+    SPP_PRINT("%s.%03d pid=%d uid=%ld ret=%d dur_us=%u%s%s %s%s%s%s\n", ts, (int)(r->time_ns / 1000000 % 1000),
+            r->pid, r->uid == JOURNAL_UID_UNKNOWN ? -1L : (long)r->uid, r->ret, r->dur_us,
+            r->flags & JOURNAL_F_DAEMON ? " daemon" : "", r->flags & JOURNAL_F_RING ? " ring" : "",
+            r->cmd, r->args[0] ? " " : "", r->args, r->flags & JOURNAL_F_TRUNC ? "..." : "");
+}
+
+/*
+ * Walk the valid records of path in slot order, print the ones to show
+ * @return	number of records that matched
+ */
+static long jr_scan(const char *path, JOURNAL_FILTER *f, int print)
+{
+    JOURNAL_HDR *h = NULL;
+    spp_jrec *slot = NULL, r;
+    size_t size = 0;
+    uint32_t i = 0;
+    long n = 0;
+
+    if ((h = jr_open_ro(path, &size)) == NULL) {
+        return 0;
+    }
+    slot = (spp_jrec *)(h + 1);
+    // all slots: the tail may have been lost in a crash
+    for (i = 0; i < h->capacity; i++) {
+        if (!jr_read(&slot[i], &r) || !jr_match(f, &r)) {
+            continue;
+        }
+        n++;
+        if (print && f->matched++ >= f->skip) {
+            jr_print(&r);
+        }
+    }
+    munmap(h, size);
+    return n;
+}
+
+/* show [since=T] [until=T] [cmd=<feature>] [last=N], oldest first */
+static int show(int argc, char **argv)
+{
+    JOURNAL_FILTER f = { 0, INT64_MAX, NULL, 0, 0, 0 };
+    long total = 0;
+    int i = 0;
+
+    for (i = 3; i < argc; i++) {
+        if (!strncmp(argv[i], "since=", 6) && parse_time(argv[i] + 6, &f.since) == 0) {
+            continue;
+        }
+        if (!strncmp(argv[i], "until=", 6) && parse_time(argv[i] + 6, &f.until) == 0) {
+            continue;
+        }
+        if (!strncmp(argv[i], "cmd=", 4) && argv[i][4]) {
+            f.cmd = argv[i] + 4;
+            continue;
+        }
+        if (!strncmp(argv[i], "last=", 5) && (f.last = atol(argv[i] + 5)) > 0) {
+            continue;
+        }
+        SPP_PRINT("journal: bad filter '%s'\n", argv[i]);
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+
+    if (f.last) {
+        total = jr_scan(JOURNAL_OLD, &f, 0) + jr_scan(JOURNAL_PATH, &f, 0);
+        f.skip = total > f.last ? total - f.last : 0;
+    }
+    jr_scan(JOURNAL_OLD, &f, 1);
+    jr_scan(JOURNAL_PATH, &f, 1);
+    return SPP_OK;
+}
+
+/* Slots used, valid and torn records of both files */
+static int stats(int argc, char **argv)
+{
+    const char *paths[] = {JOURNAL_PATH, JOURNAL_OLD};
+    JOURNAL_HDR *h = NULL;
+    spp_jrec *slot = NULL, r;
+    size_t size = 0;
+    uint64_t tail = 0;
+    uint32_t i = 0;
+    long valid = 0, torn = 0;
+    int p = 0;
+
+    for (p = 0; p < 2; p++) {
+        if ((h = jr_open_ro(paths[p], &size)) == NULL) {
+            SPP_PRINT("spp_journal%s=none\n", p ? "_old" : "");
+            continue;
+        }
+        slot = (spp_jrec *)(h + 1);
+        tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+        for (i = 0, valid = 0, torn = 0; i < h->capacity; i++) {
+            if (jr_read(&slot[i], &r)) {
+                valid++;
+            } else if (r.magic || r.crc) {
+                torn++;
+            }
+        }
+        SPP_PRINT("spp_journal%s=%s\n", p ? "_old" : "", paths[p]);
+        SPP_PRINT("spp_journal%s_capacity=%u\n", p ? "_old" : "", h->capacity);
+        SPP_PRINT("spp_journal%s_tail=%llu\n", p ? "_old" : "", (unsigned long long)tail);
+        SPP_PRINT("spp_journal%s_records=%ld\n", p ? "_old" : "", valid);
+        SPP_PRINT("spp_journal%s_torn=%ld\n", p ? "_old" : "", torn);
+        munmap(h, size);
+    }
+    return SPP_OK;
+}
+
+static void *cmd[CMD_NUM][CMD_LEN] = {
+    {"help", "Show this help page", &help},
+    {"show", "Print records, filters since=T until=T cmd=F last=N", &show},
+    {"stats", "Show journal files and record counts", &stats},
+    {NULL, NULL, NULL}
+};
+
+static int help(int argc, char **argv)
+{
+    int i = 0;
+    SPP_PRINT("%s", help_str[0]);
+    for (i = 0; cmd[i][0]; i++) {
+        SPP_PRINT("%s,       \t%s\n", (char *)cmd[i][0], (char *)cmd[i][1]);
+    }
+    SPP_PRINT("T is -<N>[smhd] back from now, seconds since the epoch or YYYY-MM-DD[Thh:mm[:ss]]\n");
+    return SPP_OK;
+}
+
+int journal(int argc, char **argv)
+{
+    int cmdVector = 0;
+
+    if (argc < 3) {
+        return show(argc, argv);
+    }
+
+    cmdVector = sppcmd_check(cmd, argv[2]);
+    if (cmdVector == SPP_FAIL) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+    return ((FUNC)cmd[cmdVector][2])(argc, argv);
+}
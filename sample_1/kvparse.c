@@ -0,0 +1,230 @@
+/*
+ * kvparse.c
+ *
+ * Newlines and separators are located a whole block at a time with
+ * SSE2/AVX2 compares, lines are then cut from the resulting bitmasks.
+ * Targets without SIMD fall back to memchr().
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <kvparse.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KV_BLOCK    32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KV_BLOCK    16
+#endif
+
+#define KV_LIST_STEP    64
+#define KV_BLANK(c)     ((c) == ' ' || (c) == '\t')
+
+typedef int (*KV_CB)(void *, const spp_tok *, const spp_tok *);
+
+typedef struct {
+    const char *const *keys;
+    size_t klen[64];
+    spp_tok *vals;
+    int nkeys;
+    int found;
+} KV_LOOKUP;
+
+/* Cut one line [ls, le), sp is the first separator or NULL */
+static int kv_line(const char *ls, const char *le, const char *sp, char sep,
+        KV_CB cb, void *arg)
+{
+    spp_tok key, val;
+
+    if (le > ls && le[-1] == '\r') {
+        le--;
+    }
+    if (sep != KV_SEP_EQ) {
+        while (ls < le && KV_BLANK(*ls)) {
+            ls++;
+        }
+    }
+    if (ls >= le || *ls == '#') {
+        return 0;
+    }
+    if (sep == KV_SEP_BLANK) {
+        for (sp = ls; sp < le && !KV_BLANK(*sp); sp++)
+            ;
+    }
+
+    if (sp == NULL || sp >= le) {
+        key.ptr = ls;
+        key.len = le - ls;
+        val.ptr = le;
+        val.len = 0;
+        return cb(arg, &key, &val);
+    }
+
+    key.ptr = ls;
+    key.len = sp - ls;
+    val.ptr = sp + 1;
+    val.len = le - val.ptr;
+    if (sep != KV_SEP_EQ) {
+        while (key.len && KV_BLANK(key.ptr[key.len - 1])) {
+            key.len--;
+        }
+        while (val.len && KV_BLANK(*val.ptr)) {
+            val.ptr++;
+            val.len--;
+        }
+        while (val.len && KV_BLANK(val.ptr[val.len - 1])) {
+            val.len--;
+        }
+    }
+    return cb(arg, &key, &val);
+}
+
+static void kv_scan(const char *buf, size_t len, char sep, KV_CB cb, void *arg)
+{
+    const char *p = buf, *end = buf + len;
+    const char *ls = buf, *sp = NULL, *nl, *le;
+
+#ifdef KV_BLOCK
+#if KV_BLOCK == 32
+    const __m256i vnl = _mm256_set1_epi8('\n');
+    const __m256i vsep = _mm256_set1_epi8(sep);
+#else
+    const __m128i vnl = _mm_set1_epi8('\n');
+    const __m128i vsep = _mm_set1_epi8(sep);
+#endif
+    unsigned int m;
+
+    for (; end - p >= KV_BLOCK; p += KV_BLOCK) {
+#if KV_BLOCK == 32
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vnl));
+        if (sep != KV_SEP_BLANK) {
+            m |= (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vsep));
+        }
+#else
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vnl));
+        if (sep != KV_SEP_BLANK) {
+            m |= (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vsep));
+        }
+#endif
+        while (m) {
+            const char *q = p + __builtin_ctz(m);
+
+            m &= m - 1;
+            if (*q == '\n') {
+                if (kv_line(ls, q, sp, sep, cb, arg)) {
+                    return;
+                }
+                ls = q + 1;
+                sp = NULL;
+            } else if (sp == NULL) {
+                sp = q;
+            }
+        }
+    }
+#endif
+
+    /* Tail of the block loop, or the whole input without SIMD */
+    while (ls < end) {
+        nl = memchr(p, '\n', end - p);
+        le = nl ? nl : end;
+        if (sp == NULL && sep != KV_SEP_BLANK) {
+            sp = memchr(p, sep, le - p);
+        }
+        if (kv_line(ls, le, sp, sep, cb, arg) || nl == NULL) {
+            return;
+        }
+        ls = p = nl + 1;
+        sp = NULL;
+    }
+}
+
+static int kv_append(void *arg, const spp_tok *key, const spp_tok *val)
+{
+    spp_kvlist *l = arg;
+
+    if (l->count == l->size) {
+        spp_kv *kv = realloc(l->kv, (l->size + KV_LIST_STEP) * sizeof(spp_kv));
+        if (kv == NULL) {
+            l->count = -1;
+            return 1;
+        }
+        l->kv = kv;
+        l->size += KV_LIST_STEP;
+    }
+    l->kv[l->count].key = *key;
+    l->kv[l->count].val = *val;
+    l->count++;
+    return 0;
+}
+
+int spp_kv_parse(spp_kvlist *l, const char *buf, size_t len, char sep)
+{
+    memset(l, 0, sizeof(spp_kvlist));
+    kv_scan(buf, len, sep, kv_append, l);
+    if (l->count < 0) {
+        spp_kv_free(l);
+        return -1;
+    }
+    return l->count;
+}
+
+void spp_kv_free(spp_kvlist *l)
+{
+    free(l->kv);
+    l->kv = NULL;
+    l->count = l->size = 0;
+}
+
+const spp_tok *spp_kv_get(const spp_kvlist *l, const char *key)
+{
+    int i;
+
+    for (i = 0; i < l->count; i++) {
+        if (spp_tok_eq(&l->kv[i].key, key)) {
+            return &l->kv[i].val;
+        }
+    }
+    return NULL;
+}
+
+static int kv_match(void *arg, const spp_tok *key, const spp_tok *val)
+{
+    KV_LOOKUP *lk = arg;
+    int i;
+
+    for (i = 0; i < lk->nkeys; i++) {
+        if (lk->vals[i].ptr == NULL && lk->klen[i] == key->len &&
+                !memcmp(lk->keys[i], key->ptr, key->len)) {
+            lk->vals[i] = *val;
+            lk->found++;
+            break;
+        }
+    }
+    return lk->found == lk->nkeys;
+}
+
+int spp_kv_lookup(const char *buf, size_t len, char sep,
+        const char *const keys[], spp_tok vals[], int nkeys)
+{
+    KV_LOOKUP lk;
+    int i;
+
+    if (nkeys <= 0 || nkeys > (int)(sizeof(lk.klen) / sizeof(lk.klen[0]))) {
+        return -1;
+    }
+    lk.keys = keys;
+    lk.vals = vals;
+    lk.nkeys = nkeys;
+    lk.found = 0;
+    for (i = 0; i < nkeys; i++) {
+        lk.klen[i] = strlen(keys[i]);
+        vals[i].ptr = NULL;
+        vals[i].len = 0;
+    }
+    kv_scan(buf, len, sep, kv_match, &lk);
+    return lk.found;
+}
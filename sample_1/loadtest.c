@@ -0,0 +1,301 @@
+/*
+ * loadtest.c
+ *
+ * sppLoad: concurrent clients running a weighted command mix through the
+ * sppCtrl binary, the way cron jobs, the web UI and hotplug scripts do.
+ * One-shot mode runs "sppCtrl <cmd>" and contends on the PID file lock,
+ * daemon mode runs "sppCtrl -r <cmd>". Every request is a process, its
+ * latency is spawn to reap.
+ *
+ * Lock waits come from the clients themselves: spp_unlock() appends the
+ * time spent in spp_lock() to the file named by SPP_LOCK_STATS_ENV.
+ *
+ * Build with "make x86 loadtest", run e.g.
+ *	./sppLoad -c 8 -n 200
+ *	./sppLoad -d -c 32 -n 2000 -m "status update:4,sample on:1"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <config.h>
+#include <timestamp.h>
+
+#define LOAD_MIX_MAX    16      /* commands in a mix */
+#define LOAD_ARGS_MAX   16      /* words in one command */
+#define LOAD_CLIENTS    8
+#define LOAD_REQUESTS   200
+#define LOAD_BINARY     "./sppCtrl"
+#define LOAD_MIX        "status update:4,interface on:1,interface off:1,sample on:2"
+
+extern char **environ;
+
+typedef struct {
+    char *name;             /* as given in the mix */
+    char *argv[LOAD_ARGS_MAX + 3];  /* binary [-r] words NULL */
+    int weight;
+} LOAD_CMD;
+
+typedef struct {
+    int cmd;
+    int status;             /* wait status */
+    uint64_t ns;
+} LOAD_REQ;
+
+static LOAD_CMD mix[LOAD_MIX_MAX];
+static int mix_count = 0;
+static int mix_weight = 0;
+static LOAD_REQ *reqs = NULL;
+static int req_total = LOAD_REQUESTS;
+static int req_next = 0;
+static posix_spawn_file_actions_t quiet;
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-c clients] [-n requests] [-d] [-b sppCtrl] [-m mix]\n"
+            "\t-c\tconcurrent clients, default %d\n"
+            "\t-n\trequests in total, default %d\n"
+            "\t-d\tdaemon mode, \"sppCtrl -r <cmd>\", the daemon must be running\n"
+            "\t-b\tbinary to run, default %s\n"
+            "\t-m\t\"<cmd>:<weight>,...\", default \"%s\"\n"
+            "Without br0 the interface commands fail in daemon mode, that is expected on a PC\n",
+            prog, LOAD_CLIENTS, LOAD_REQUESTS, LOAD_BINARY, LOAD_MIX);
+}
+
+/* "status update:4,sample on:1" into mix[], words stay in the string */
+static int mix_parse(char *spec, const char *binary, int remote)
+{
+    char *item = NULL, *save = NULL, *word = NULL, *wsave = NULL, *colon = NULL;
+    LOAD_CMD *c = NULL;
+    int n = 0;
+
+    for (item = strtok_r(spec, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (mix_count == LOAD_MIX_MAX) {
+            return -1;
+        }
+        c = &mix[mix_count];
+        c->weight = 1;
+        if ((colon = strrchr(item, ':')) != NULL) {
+            *colon = '\0';
+            c->weight = atoi(colon + 1);
+        }
+        c->name = strdup(item);
+        n = 0;
+        c->argv[n++] = (char *)binary;
+        if (remote) {
+            c->argv[n++] = "-r";
+        }
+        for (word = strtok_r(item, " ", &wsave); word && n < LOAD_ARGS_MAX + 2; word = strtok_r(NULL, " ", &wsave)) {
+            c->argv[n++] = word;
+        }
+        c->argv[n] = NULL;
+        if (c->name == NULL || c->weight <= 0 || n == 1 + remote) {
+            return -1;
+        }
+        mix_weight += c->weight;
+        mix_count++;
+    }
+    return mix_count ? 0 : -1;
+}
+
+/* Run argv to completion, output to /dev/null unless loud */
+static int spawn_wait(char **argv, int loud, int *status)
+{
+    pid_t pid;
+    int ret = 0;
+
+    if ((ret = posix_spawn(&pid, argv[0], loud ? NULL : &quiet, NULL, argv, environ)) != 0) {
+        errno = ret;
+        return -1;
+    }
+    while (waitpid(pid, status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *client(void *arg)
+{
+    unsigned int seed = (unsigned int)(long)arg * 2654435761u;
+    LOAD_REQ *r = NULL;
+    uint64_t start;
+    int i = 0, pick = 0, c = 0;
+
+    while ((i = __atomic_fetch_add(&req_next, 1, __ATOMIC_RELAXED)) < req_total) {
+        r = &reqs[i];
+        pick = rand_r(&seed) % mix_weight;
+        for (c = 0; pick >= mix[c].weight; c++) {
+            pick -= mix[c].weight;
+        }
+        r->cmd = c;
+        start = spp_mono_ns();
+        if (spawn_wait(mix[c].argv, 0, &r->status) < 0) {
+            r->status = -1;
+        }
+        r->ns = spp_mono_ns() - start;
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Sorted v: value at fraction p */
+static double pct_ms(uint64_t *v, int n, double p)
+{
+    return n ? v[(int)((n - 1) * p)] / 1e6 : 0;
+}
+
+static void report_latency(const char *name, uint64_t *v, int n, int failed)
+{
+    qsort(v, n, sizeof(uint64_t), cmp_u64);
+    printf("%-24s %6d  p50 %8.2f  p99 %8.2f  p999 %8.2f  max %8.2f ms", name, n,
+            pct_ms(v, n, 0.5), pct_ms(v, n, 0.99), pct_ms(v, n, 0.999), pct_ms(v, n, 1));
+    printf(failed < 0 ? "\n" : "  failed %d\n", failed);
+}
+
+/* SIGKILL or not SPP_OK; one-shot sppCtrl exits SPP_OK whatever the handler returned */
+static int req_failed(LOAD_REQ *r)
+{
+    return r->status == -1 || !WIFEXITED(r->status) || (signed char)WEXITSTATUS(r->status) != SPP_OK;
+}
+
+/* Lines of "<wait ns> <kills>" the clients appended */
+static void report_lock(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    unsigned long long ns = 0;
+    uint64_t *v = NULL, sum = 0;
+    int kills = 0, total = 0, n = 0;
+
+    if (fp == NULL || (v = calloc(req_total + 1, sizeof(uint64_t))) == NULL) {
+        if (fp) {
+            fclose(fp);
+        }
+        return;
+    }
+    while (n <= req_total && fscanf(fp, "%llu %d", &ns, &kills) == 2) {
+        v[n++] = ns;
+        sum += ns;
+        total += kills;
+    }
+    fclose(fp);
+    if (n == 0) {
+        printf("spp_lock wait            none recorded\n");
+    } else {
+        report_latency("spp_lock wait", v, n, -1);
+        printf("spp_lock wait total      %.3f s, %.2f ms per request\n", sum / 1e9, sum / 1e6 / n);
+    }
+    printf("spp_lock kills           %d\n", total);
+    free(v);
+}
+
+int main(int argc, char **argv)
+{
+    char spec[1024] = LOAD_MIX, lockfile[] = "/tmp/sppLoad.XXXXXX";
+    const char *binary = LOAD_BINARY;
+    pthread_t *tids = NULL;
+    uint64_t *v = NULL, start, elapsed;
+    int clients = LOAD_CLIENTS, remote = 0, opt = 0, fd = -1;
+    int i = 0, c = 0, n = 0, killed = 0, failed = 0, status = 0;
+    char *stats[] = {NULL, "daemon", "stats", NULL};
+
+    while ((opt = getopt(argc, argv, "c:n:db:m:h")) != -1) {
+        switch (opt) {
+            case 'c': clients = atoi(optarg); break;
+            case 'n': req_total = atoi(optarg); break;
+            case 'd': remote = 1; break;
+            case 'b': binary = optarg; break;
+            case 'm': snprintf(spec, sizeof(spec), "%s", optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (clients <= 0 || req_total <= 0 || mix_parse(spec, binary, remote) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (access(binary, X_OK) < 0) {
+        printf("%s: %s, build it with 'make x86'\n", binary, strerror(errno));
+        return 1;
+    }
+    stats[0] = (char *)binary;
+
+    posix_spawn_file_actions_init(&quiet);
+    posix_spawn_file_actions_addopen(&quiet, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&quiet, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    if ((fd = mkstemp(lockfile)) < 0) {
+        printf("%s: %s\n", lockfile, strerror(errno));
+        return 1;
+    }
+    close(fd);
+    setenv(SPP_LOCK_STATS_ENV, lockfile, 1);
+
+    reqs = calloc(req_total, sizeof(LOAD_REQ));
+    v = calloc(req_total, sizeof(uint64_t));
+    tids = calloc(clients, sizeof(pthread_t));
+    if (reqs == NULL || v == NULL || tids == NULL) {
+        unlink(lockfile);
+        return 1;
+    }
+
+    start = spp_mono_ns();
+    for (i = 0; i < clients; i++) {
+        if (pthread_create(&tids[i], NULL, client, (void *)(long)(i + 1)) != 0) {
+            clients = i;
+            break;
+        }
+    }
+    for (i = 0; i < clients; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    elapsed = spp_mono_ns() - start;
+
+    for (i = 0; i < req_total; i++) {
+        status = reqs[i].status;
+        killed += status != -1 && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+        failed += req_failed(&reqs[i]);
+    }
+
+    printf("mode %s, %d clients, %d requests in %.3f s, %.1f req/s\n", remote ? "daemon" : "one-shot",
+            clients, req_total, elapsed / 1e9, req_total / (elapsed / 1e9));
+    for (i = 0; i < req_total; i++) {
+        v[i] = reqs[i].ns;
+    }
+    report_latency("all", v, req_total, failed);
+    for (c = 0; c < mix_count; c++) {
+        for (i = 0, n = 0, failed = 0; i < req_total; i++) {
+            if (reqs[i].cmd == c) {
+                v[n++] = reqs[i].ns;
+                failed += req_failed(&reqs[i]);
+            }
+        }
+        report_latency(mix[c].name, v, n, failed);
+    }
+    printf("SIGKILLed clients        %d\n", killed);
+    report_lock(lockfile);
+    unlink(lockfile);
+
+    if (remote) {
+        // queueing happens in the daemon, not on the lock
+        fflush(stdout);
+        unsetenv(SPP_LOCK_STATS_ENV);
+        spawn_wait(stats, 1, &status);
+    }
+    free(reqs);
+    free(v);
+    free(tids);
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * macidx.c
+ *
+ * Linear probing with backward shift deletion, so there are no tombstones
+ * and lookups stay short after stations come and go.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <tokenize.h>
+#include <macidx.h>
+
+#define MACIDX_MIN_CAP  64
+#define MACIDX_HASH_MUL 0x9E3779B97F4A7C15ULL
+
+/* hex digit value + 1, 0 for anything else */
+static const unsigned char hex_tbl[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+int spp_mac_parse(const char *s, spp_mac *mac)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    spp_mac m = 0;
+    char sep = s[2];
+    int i;
+
+    if (sep != ':' && sep != '-') {
+        return -1;
+    }
+    for (i = 0; i < 6; i++, p += 3) {
+        unsigned char hi = hex_tbl[p[0]], lo = hex_tbl[p[1]];
+
+        if (!hi || !lo || (i < 5 && p[2] != sep)) {
+            return -1;
+        }
+        m = (m << 8) | ((hi - 1) << 4) | (lo - 1);
+    }
+    *mac = m;
+    return 0;
+}
+
+char *spp_mac_format(spp_mac mac, char *a, int upper)
+{
+    const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *c = a;
+    int shift;
+
+    for (shift = 40; shift >= 0; shift -= 8) {
+        unsigned int b = (mac >> shift) & 0xff;
+
+        *c++ = hex[b >> 4];
+        *c++ = hex[b & 0xf];
+        *c++ = ':';
+    }
+    c[-1] = '\0';
+    return a;
+}
+
+spp_mac spp_mac_from_bytes(const unsigned char *e)
+{
+    return ((spp_mac)e[0] << 40) | ((spp_mac)e[1] << 32) | ((spp_mac)e[2] << 24) |
+        ((spp_mac)e[3] << 16) | ((spp_mac)e[4] << 8) | e[5];
+}
+
+void spp_mac_to_bytes(spp_mac mac, unsigned char *e)
+{
+    int i;
+
+    for (i = 5; i >= 0; i--, mac >>= 8) {
+        e[i] = mac & 0xff;
+    }
+}
+
+static size_t macidx_home(const spp_macidx *idx, uint64_t key)
+{
+    return (size_t)(((key & 0xffffffffffffULL) * MACIDX_HASH_MUL) >> 32) & (idx->cap - 1);
+}
+
+static int macidx_resize(spp_macidx *idx, size_t cap)
+{
+    spp_macent *old = idx->ent;
+    size_t old_cap = idx->cap, i;
+
+    idx->ent = calloc(cap, sizeof(spp_macent));
+    if (idx->ent == NULL) {
+        idx->ent = old;
+        return -1;
+    }
+    idx->cap = cap;
+    for (i = 0; i < old_cap; i++) {
+        if (old[i].key) {
+            size_t j = macidx_home(idx, old[i].key);
+
+            while (idx->ent[j].key) {
+                j = (j + 1) & (cap - 1);
+            }
+            idx->ent[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+int spp_macidx_init(spp_macidx *idx, size_t hint)
+{
+    size_t cap = MACIDX_MIN_CAP;
+
+    /* keep the load factor under 3/4 */
+    while (cap * 3 / 4 < hint) {
+        cap <<= 1;
+    }
+    memset(idx, 0, sizeof(spp_macidx));
+    return macidx_resize(idx, cap);
+}
+
+void spp_macidx_free(spp_macidx *idx)
+{
+    free(idx->ent);
+    memset(idx, 0, sizeof(spp_macidx));
+}
+
+static spp_macent *macidx_find(const spp_macidx *idx, spp_mac mac)
+{
+    uint64_t key = mac | SPP_MACIDX_USED;
+    size_t i;
+
+    if (idx->cap == 0) {
+        return NULL;
+    }
+    for (i = macidx_home(idx, key); idx->ent[i].key; i = (i + 1) & (idx->cap - 1)) {
+        if (idx->ent[i].key == key) {
+            return &idx->ent[i];
+        }
+    }
+    return NULL;
+}
+
+int spp_macidx_put(spp_macidx *idx, spp_mac mac, uint64_t val)
+{
+    uint64_t key = (mac & 0xffffffffffffULL) | SPP_MACIDX_USED;
+    size_t i;
+
+    if ((idx->count + 1) * 4 > idx->cap * 3 &&
+            macidx_resize(idx, idx->cap ? idx->cap << 1 : MACIDX_MIN_CAP) < 0) {
+        return -1;
+    }
+    for (i = macidx_home(idx, key); idx->ent[i].key; i = (i + 1) & (idx->cap - 1)) {
+        if (idx->ent[i].key == key) {
+            idx->ent[i].val = val;
+            return 0;
+        }
+    }
+    idx->ent[i].key = key;
+    idx->ent[i].val = val;
+    idx->count++;
+    return 1;
+}
+
+int spp_macidx_get(const spp_macidx *idx, spp_mac mac, uint64_t *val)
+{
+    spp_macent *e = macidx_find(idx, mac & 0xffffffffffffULL);
+
+    if (e == NULL) {
+        return 0;
+    }
+    if (val) {
+        *val = e->val;
+    }
+    return 1;
+}
+
+int spp_macidx_del(spp_macidx *idx, spp_mac mac)
+{
+    spp_macent *e = macidx_find(idx, mac & 0xffffffffffffULL);
+    size_t mask = idx->cap - 1, i, j, k;
+
+    if (e == NULL) {
+        return 0;
+    }
+    /* shift back every following entry that may not stay behind the hole */
+    i = j = e - idx->ent;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!idx->ent[j].key) {
+            break;
+        }
+        k = macidx_home(idx, idx->ent[j].key);
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        idx->ent[i] = idx->ent[j];
+        i = j;
+    }
+    idx->ent[i].key = 0;
+    idx->ent[i].val = 0;
+    idx->count--;
+    return 1;
+}
+
+/* Split buf into lines and hand the fields of each line to cb */
+static int macidx_load(spp_macidx *idx, const char *buf, size_t len,
+        int (*cb)(spp_macidx *, spp_tok *, int, const void *), const void *arg)
+{
+    const char *p = buf, *end = buf + len, *nl;
+    spp_tokenizer t;
+    spp_tok f[6];
+    int n, ret, loaded = 0;
+
+    for (; p < end; p = nl + 1) {
+        nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            nl = end;
+        }
+        spp_tok_init(&t, p, nl - p, " \t\r");
+        for (n = 0; n < 6 && spp_tok_next(&t, &f[n]); n++)
+            ;
+        ret = cb(idx, f, n, arg);
+        if (ret < 0) {
+            return -1;
+        }
+        loaded += ret;
+    }
+    return loaded;
+}
+
+/* IP address  HW type  Flags  HW address  Mask  Device */
+static int arp_line(spp_macidx *idx, spp_tok *f, int n, const void *dev)
+{
+    struct in_addr ip;
+    char ipstr[INET_ADDRSTRLEN];
+    spp_mac mac;
+
+    if (n < 6 || f[3].len != SPP_MAC_STRLEN || spp_mac_parse(f[3].ptr, &mac) < 0) {
+        return 0;
+    }
+    /* ATF_COM not set: incomplete entry */
+    if (spp_tok_eq(&f[2], "0x0") || (dev && !spp_tok_eq(&f[5], dev))) {
+        return 0;
+    }
+    spp_tok_copy(&f[0], ipstr, sizeof(ipstr));
+    if (inet_pton(AF_INET, ipstr, &ip) != 1) {
+        return 0;
+    }
+    return spp_macidx_put(idx, mac, ip.s_addr) < 0 ? -1 : 1;
+}
+
+/* port no  mac addr  is local?  ageing timer */
+static int fdb_line(spp_macidx *idx, spp_tok *f, int n, const void *arg)
+{
+    spp_mac mac;
+    uint64_t val;
+
+    if (n < 3 || f[1].len != SPP_MAC_STRLEN || spp_mac_parse(f[1].ptr, &mac) < 0) {
+        return 0;
+    }
+    val = strtoul(f[0].ptr, NULL, 10) & 0xffff;
+    if (spp_tok_eq(&f[2], "yes")) {
+        val |= 1 << 16;
+    }
+    return spp_macidx_put(idx, mac, val) < 0 ? -1 : 1;
+}
+
+int spp_macidx_load_arp(spp_macidx *idx, const char *buf, size_t len, const char *dev)
+{
+    return macidx_load(idx, buf, len, arp_line, dev);
+}
+
+int spp_macidx_load_fdb(spp_macidx *idx, const char *buf, size_t len)
+{
+    return macidx_load(idx, buf, len, fdb_line, NULL);
+}
@@ -0,0 +1,287 @@
+/*
+ * memstat.c
+ *
+ * Every block gets a 16 byte header with the scope it was allocated in and
+ * the bytes it was counted at, so a block freed by another thread or after
+ * the request is still taken off the right feature. A request's own peak
+ * is kept per thread: a daemon worker runs one request at a time.
+ *
+ * A block libc allocated has no header, the 16 bytes read before it are
+ * glibc's chunk header of that block (prev_size, size) on a 64 bit target.
+ * The magic is mixed with the header address so that what the previous
+ * chunk left in prev_size does not pass for one by chance.
+ *
+ */
+
+#define _GNU_SOURCE     /* vasprintf */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <memstat.h>
+
+#define MEM_NAME_LEN    16
+#define MEM_MAGIC       0x5370704d  /* "SppM" */
+
+typedef struct {
+    char name[MEM_NAME_LEN];
+    uint64_t requests;
+    uint64_t allocs;
+    uint64_t bytes;         /* allocated in total */
+    int64_t live;
+    int64_t peak;
+    int64_t req_peak;       /* highest peak of a single request */
+} MEM_SCOPE;
+
+static MEM_SCOPE scopes[SPP_MEM_SCOPES] = { { "core" } };
+static MEM_SCOPE total;
+static uint64_t foreign_frees = 0;
+
+static __thread int mem_scope = 0;
+static __thread int64_t mem_req_live = 0;
+static __thread int64_t mem_req_peak = 0;
+
+static void mem_max(int64_t *peak, int64_t v)
+{
+    int64_t cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (v > cur && !__atomic_compare_exchange_n(peak, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+#ifdef SPP_MEM_STATS
+
+typedef struct {
+    uint32_t scope;
+    uint32_t magic;
+    uint64_t size;
+} MEM_HDR;  /* 16 bytes, the block keeps malloc()'s alignment */
+
+#define MEM_MAGIC_OF(h) (MEM_MAGIC ^ (uint32_t)(uintptr_t)(h))
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+extern void __real_free(void *ptr);
+
+/* n bytes more (or less) in scope, and in the request of this thread */
+static void mem_account(int scope, int64_t n)
+{
+    MEM_SCOPE *m = &scopes[scope];
+
+    mem_max(&m->peak, __atomic_add_fetch(&m->live, n, __ATOMIC_RELAXED));
+    mem_max(&total.peak, __atomic_add_fetch(&total.live, n, __ATOMIC_RELAXED));
+    if (n > 0) {
+        __atomic_add_fetch(&m->bytes, n, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&total.bytes, n, __ATOMIC_RELAXED);
+    }
+    mem_req_live += n;
+    if (mem_req_live > mem_req_peak) {
+        mem_req_peak = mem_req_live;
+    }
+}
+
+/* Header filled in, user pointer returned */
+static void *mem_track(MEM_HDR *h)
+{
+    if (h == NULL) {
+        return NULL;
+    }
+    h->scope = mem_scope;
+    h->magic = MEM_MAGIC_OF(h);
+    h->size = malloc_usable_size(h) - sizeof(MEM_HDR);
+    __atomic_add_fetch(&scopes[h->scope].allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total.allocs, 1, __ATOMIC_RELAXED);
+    mem_account(h->scope, h->size);
+    return h + 1;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    if (size > SIZE_MAX - sizeof(MEM_HDR)) {
+        return NULL;
+    }
+    return mem_track(__real_malloc(size + sizeof(MEM_HDR)));
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (SIZE_MAX - sizeof(MEM_HDR)) / size) {
+        return NULL;
+    }
+    return mem_track(__real_calloc(1, nmemb * size + sizeof(MEM_HDR)));
+}
+
+void __wrap_free(void *ptr)
+{
+    MEM_HDR *h = ptr ? (MEM_HDR *)ptr - 1 : NULL;
+
+    if (h == NULL) {
+        return;
+    }
+    if (h->magic != MEM_MAGIC_OF(h)) {
+        // allocated inside libc, not by us
+        __atomic_add_fetch(&foreign_frees, 1, __ATOMIC_RELAXED);
+        __real_free(ptr);
+        return;
+    }
+    h->magic = 0;
+    mem_account(h->scope, -(int64_t)h->size);
+    __real_free(h);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    MEM_HDR *h = ptr ? (MEM_HDR *)ptr - 1 : NULL;
+    uint64_t old = 0;
+
+    if (h == NULL) {
+        return __wrap_malloc(size);
+    }
+    if (size == 0) {
+        __wrap_free(ptr);
+        return NULL;
+    }
+    if (h->magic != MEM_MAGIC_OF(h) || size > SIZE_MAX - sizeof(MEM_HDR)) {
+        return h->magic != MEM_MAGIC_OF(h) ? __real_realloc(ptr, size) : NULL;
+    }
+    old = h->size;
+    if ((h = __real_realloc(h, size + sizeof(MEM_HDR))) == NULL) {
+        return NULL;
+    }
+    // the block may have moved
+    h->magic = MEM_MAGIC_OF(h);
+    // the block stays with the feature that allocated it
+    h->size = malloc_usable_size(h) - sizeof(MEM_HDR);
+    mem_account(h->scope, (int64_t)h->size - (int64_t)old);
+    return h + 1;
+}
+
+char *__wrap_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = __wrap_malloc(len);
+
+    return p ? memcpy(p, s, len) : NULL;
+}
+
+char *__wrap_strndup(const char *s, size_t n)
+{
+    size_t len = strnlen(s, n);
+    char *p = __wrap_malloc(len + 1);
+
+    if (p) {
+        memcpy(p, s, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+int __wrap_vasprintf(char **strp, const char *fmt, va_list args)
+{
+    va_list copy;
+    int len = 0;
+
+    va_copy(copy, args);
+    len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if (len < 0 || (*strp = __wrap_malloc(len + 1)) == NULL) {
+        return -1;
+    }
+    return vsnprintf(*strp, len + 1, fmt, args);
+}
+
+#endif /* SPP_MEM_STATS */
+
+static int mem_scope_of(int feature)
+{
+    return feature >= 0 && feature + 1 < SPP_MEM_SCOPES ? feature + 1 : 0;
+}
+
+int spp_mem_resume(int feature, const char *name)
+{
+    int prev = mem_scope;
+    int scope = mem_scope_of(feature);
+
+    // every caller writes the same name, the race is harmless
+    if (scope && scopes[scope].name[0] == '\0' && name) {
+        strncpy(scopes[scope].name, name, MEM_NAME_LEN - 1);
+    }
+    mem_scope = scope;
+    mem_req_live = 0;
+    mem_req_peak = 0;
+    return prev;
+}
+
+void spp_mem_request(int feature)
+{
+    __atomic_add_fetch(&scopes[mem_scope_of(feature)].requests, 1, __ATOMIC_RELAXED);
+}
+
+int spp_mem_enter(int feature, const char *name)
+{
+    spp_mem_request(feature);
+    return spp_mem_resume(feature, name);
+}
+
+void spp_mem_leave(int prev)
+{
+    mem_max(&scopes[mem_scope].req_peak, mem_req_peak);
+    mem_scope = prev;
+}
+
+static ssize_t mem_status(spp_sink *s)
+{
+    struct rusage ru;
+    MEM_SCOPE *m = NULL;
+    size_t len = s->len;
+    int i = 0, on = 0;
+
+#ifdef SPP_MEM_STATS
+    on = 1;
+#endif
+    getrusage(RUSAGE_SELF, &ru);
+    if (spp_sink_printf(s, "spp_mem_accounting=%s\nspp_mem_rss_peak_kb=%ld\n", on ? "on" : "off", ru.ru_maxrss) < 0) {
+        return -1;
+    }
+    if (!on) {
+        return s->len - len;
+    }
+
+    if (spp_sink_printf(s, "spp_mem_total_allocs=%llu\nspp_mem_total_bytes=%llu\nspp_mem_total_live=%lld\n"
+                "spp_mem_total_peak=%lld\nspp_mem_foreign_frees=%llu\n",
+                (unsigned long long)total.allocs, (unsigned long long)total.bytes, (long long)total.live,
+                (long long)total.peak, (unsigned long long)foreign_frees) < 0) {
+        return -1;
+    }
+    for (i = 0; i < SPP_MEM_SCOPES; i++) {
+        m = &scopes[i];
+        if (m->name[0] == '\0' || (m->allocs == 0 && m->requests == 0)) {
+            continue;
+        }
+        if (spp_sink_printf(s, "spp_mem_%s_requests=%llu\nspp_mem_%s_allocs=%llu\nspp_mem_%s_bytes=%llu\n"
+                    "spp_mem_%s_live=%lld\nspp_mem_%s_peak=%lld\nspp_mem_%s_req_peak=%lld\n",
+                    m->name, (unsigned long long)m->requests, m->name, (unsigned long long)m->allocs,
+                    m->name, (unsigned long long)m->bytes, m->name, (long long)m->live,
+                    m->name, (long long)m->peak, m->name, (long long)m->req_peak) < 0) {
+            return -1;
+        }
+    }
+    return s->len - len;
+}
+
+void spp_mem_report(spp_out *o)
+{
+    spp_out tmp = {0};
+    spp_sink s;
+
+    spp_sink_init(&s, o ? o : &tmp, NULL, 0);
+    mem_status(&s);
+    if (o == NULL) {
+        fwrite(tmp.buf ? tmp.buf : "", 1, tmp.len, stdout);
+        spp_out_free(&tmp);
+    }
+}
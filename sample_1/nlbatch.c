@@ -0,0 +1,360 @@
+/*
+ * nlbatch.c
+ *
+ * Every request carries NLM_F_ACK and sequence number base + index, so each
+ * NLMSG_ERROR that comes back (error 0 is the ACK) lands on its operation
+ * whatever the order. NETLINK_CAP_ACK keeps the kernel from echoing the
+ * request in an error, a batch of failures still fits one recv().
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <nlbatch.h>
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
+#define NLB_RECV_BUF    (32 * 1024)
+#define NLB_TIMEOUT_MS  2000        /* for the whole batch to be answered */
+
+typedef struct {
+    int result;
+    int acked;
+    char label[SPP_NL_LABEL];
+} NLB_OP;
+
+struct spp_nl_batch {
+    char buf[SPP_NL_BUF] __attribute__((aligned(NLMSG_ALIGNTO)));
+    size_t len;
+    int count;
+    uint32_t seq;           /* sequence number of operation 0 */
+    NLB_OP op[SPP_NL_OPS];
+};
+
+static int nlb_fd = -1;
+static uint32_t nlb_seq = 0;
+static pthread_mutex_t nlb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with nlb_lock held */
+static int nlb_open(void)
+{
+    struct sockaddr_nl addr;
+    int one = 1;
+
+    if (nlb_fd >= 0) {
+        return 0;
+    }
+    if ((nlb_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+        return -errno;
+    }
+    // not supported before 4.3, the errors are then just bigger
+    setsockopt(nlb_fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(nlb_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        one = -errno;
+        close(nlb_fd);
+        nlb_fd = -1;
+        return one;
+    }
+    return 0;
+}
+
+spp_nl_batch *spp_nl_batch_new(void)
+{
+    return calloc(1, sizeof(spp_nl_batch));
+}
+
+void spp_nl_batch_free(spp_nl_batch *b)
+{
+    free(b);
+}
+
+void spp_nl_batch_reset(spp_nl_batch *b)
+{
+    b->len = 0;
+    b->count = 0;
+}
+
+int spp_nl_batch_count(spp_nl_batch *b)
+{
+    return b->count;
+}
+
+int spp_nl_batch_result(spp_nl_batch *b, int op, const char **label)
+{
+    if (op < 0 || op >= b->count) {
+        return -EINVAL;
+    }
+    if (label) {
+        *label = b->op[op].label;
+    }
+    return b->op[op].result;
+}
+
+/* Start a message of type with a header of hdrlen, NULL when full */
+static struct nlmsghdr *nlb_msg(spp_nl_batch *b, int type, int flags, size_t hdrlen)
+{
+    struct nlmsghdr *nh = (struct nlmsghdr *)(b->buf + b->len);
+
+    if (b->count == SPP_NL_OPS || b->len + NLMSG_SPACE(hdrlen) > SPP_NL_BUF) {
+        return NULL;
+    }
+    memset(nh, 0, NLMSG_SPACE(hdrlen));
+    nh->nlmsg_len = NLMSG_LENGTH(hdrlen);
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    // the real sequence numbers are set at commit time
+    nh->nlmsg_seq = b->count;
+    return nh;
+}
+
+static int nlb_attr(spp_nl_batch *b, struct nlmsghdr *nh, int type, const void *data, size_t len)
+{
+    struct rtattr *rta = (struct rtattr *)((char *)nh + NLMSG_ALIGN(nh->nlmsg_len));
+
+    if (b->len + NLMSG_ALIGN(nh->nlmsg_len) + RTA_SPACE(len) > SPP_NL_BUF) {
+        return -ENOBUFS;
+    }
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+    return 0;
+}
+
+/* The message is complete: keep it and name the operation */
+static int nlb_queue(spp_nl_batch *b, struct nlmsghdr *nh, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static int nlb_queue(spp_nl_batch *b, struct nlmsghdr *nh, const char *fmt, ...)
+{
+    NLB_OP *op = &b->op[b->count];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(op->label, sizeof(op->label), fmt, args);
+    va_end(args);
+    op->result = 0;
+    op->acked = 0;
+    b->len += NLMSG_ALIGN(nh->nlmsg_len);
+    return b->count++;
+}
+
+static int nlb_index(const char *ifname)
+{
+    int index = 0;
+
+    if (ifname == NULL || strlen(ifname) >= IFNAMSIZ) {
+        return -EINVAL;
+    }
+    return (index = if_nametoindex(ifname)) > 0 ? index : -ENODEV;
+}
+
+int spp_nl_link(spp_nl_batch *b, const char *ifname, int up, int mtu)
+{
+    struct nlmsghdr *nh = NULL;
+    struct ifinfomsg *ifi = NULL;
+    uint32_t m = mtu;
+    char what[16] = "";
+    int index = 0;
+
+    if (up < 0 && mtu <= 0) {
+        return -EINVAL;
+    }
+    if ((index = nlb_index(ifname)) < 0) {
+        return index;
+    }
+    if ((nh = nlb_msg(b, RTM_NEWLINK, 0, sizeof(struct ifinfomsg))) == NULL) {
+        return -ENOBUFS;
+    }
+    ifi = NLMSG_DATA(nh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = index;
+    if (up >= 0) {
+        ifi->ifi_change = IFF_UP;
+        ifi->ifi_flags = up ? IFF_UP : 0;
+    }
+    if (mtu > 0) {
+        if (nlb_attr(b, nh, IFLA_MTU, &m, sizeof(m)) < 0) {
+            return -ENOBUFS;
+        }
+        snprintf(what, sizeof(what), " mtu %d", mtu);
+    }
+    return nlb_queue(b, nh, "link %s%s%s", ifname, up < 0 ? "" : (up ? " up" : " down"), what);
+}
+
+int spp_nl_addr(spp_nl_batch *b, const char *ifname, const char *addr, int prefix, int del)
+{
+    struct nlmsghdr *nh = NULL;
+    struct ifaddrmsg *ifa = NULL;
+    struct in_addr in;
+    int index = 0;
+
+    if ((index = nlb_index(ifname)) < 0) {
+        return index;
+    }
+    if (addr == NULL || inet_pton(AF_INET, addr, &in) != 1 || prefix < 0 || prefix > 32) {
+        return -EINVAL;
+    }
+    nh = nlb_msg(b, del ? RTM_DELADDR : RTM_NEWADDR, del ? 0 : NLM_F_CREATE | NLM_F_REPLACE, sizeof(struct ifaddrmsg));
+    if (nh == NULL) {
+        return -ENOBUFS;
+    }
+    ifa = NLMSG_DATA(nh);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_prefixlen = prefix;
+    ifa->ifa_index = index;
+    if (nlb_attr(b, nh, IFA_LOCAL, &in, sizeof(in)) < 0 || nlb_attr(b, nh, IFA_ADDRESS, &in, sizeof(in)) < 0) {
+        return -ENOBUFS;
+    }
+    return nlb_queue(b, nh, "%s %s %s/%d", del ? "deladdr" : "addr", ifname, addr, prefix);
+}
+
+int spp_nl_route(spp_nl_batch *b, const char *dst, int prefix, const char *gw, const char *ifname)
+{
+    struct nlmsghdr *nh = NULL;
+    struct rtmsg *rtm = NULL;
+    struct in_addr in, via;
+    int index = 0;
+
+    if (dst == NULL || inet_pton(AF_INET, dst, &in) != 1 || prefix < 0 || prefix > 32 ||
+            (gw && inet_pton(AF_INET, gw, &via) != 1) || (gw == NULL && ifname == NULL)) {
+        return -EINVAL;
+    }
+    if (ifname && (index = nlb_index(ifname)) < 0) {
+        return index;
+    }
+    if ((nh = nlb_msg(b, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, sizeof(struct rtmsg))) == NULL) {
+        return -ENOBUFS;
+    }
+    rtm = NLMSG_DATA(nh);
+    rtm->rtm_family = AF_INET;
+    rtm->rtm_dst_len = prefix;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = RTPROT_STATIC;
+    rtm->rtm_scope = gw ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+    rtm->rtm_type = RTN_UNICAST;
+    if (nlb_attr(b, nh, RTA_DST, &in, sizeof(in)) < 0 ||
+            (gw && nlb_attr(b, nh, RTA_GATEWAY, &via, sizeof(via)) < 0) ||
+            (index && nlb_attr(b, nh, RTA_OIF, &index, sizeof(index)) < 0)) {
+        return -ENOBUFS;
+    }
+    return nlb_queue(b, nh, "route %s/%d%s%s%s%s", dst, prefix, gw ? " via " : "", gw ? gw : "",
+            ifname ? " dev " : "", ifname ? ifname : "");
+}
+
+/* Mark every operation not answered yet with err */
+static void nlb_fail(spp_nl_batch *b, int err)
+{
+    int i = 0;
+
+    for (i = 0; i < b->count; i++) {
+        if (!b->op[i].acked) {
+            b->op[i].result = err;
+        }
+    }
+}
+
+/* Read ACKs until all count operations are answered, called with nlb_lock held */
+static int nlb_collect(spp_nl_batch *b)
+{
+    static char buf[NLB_RECV_BUF] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct pollfd pfd = { nlb_fd, POLLIN, 0 };
+    struct nlmsghdr *nh = NULL;
+    struct nlmsgerr *err = NULL;
+    int pending = b->count;
+    uint32_t i;
+    ssize_t n;
+
+    while (pending) {
+        if ((n = poll(&pfd, 1, NLB_TIMEOUT_MS)) == 0) {
+            return -ETIMEDOUT;
+        }
+        n = n < 0 ? -1 : recv(nlb_fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? -errno : -EPIPE;
+        }
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+            i = nh->nlmsg_seq - b->seq;
+            // a late answer to an earlier batch that timed out
+            if (nh->nlmsg_type != NLMSG_ERROR || i >= (uint32_t)b->count || b->op[i].acked) {
+                continue;
+            }
+            err = NLMSG_DATA(nh);
+            b->op[i].result = err->error;
+            b->op[i].acked = 1;
+            pending--;
+        }
+    }
+    return 0;
+}
+
+int spp_nl_batch_commit(spp_nl_batch *b)
+{
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct iovec iov = { b->buf, b->len };
+    struct msghdr msg = { .msg_name = &kernel, .msg_namelen = sizeof(kernel), .msg_iov = &iov, .msg_iovlen = 1 };
+    struct nlmsghdr *nh = NULL;
+    size_t off = 0;
+    ssize_t n;
+    int i = 0, ret = 0, failed = 0;
+
+    if (b->count == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&nlb_lock);
+    if ((ret = nlb_open()) < 0) {
+        pthread_mutex_unlock(&nlb_lock);
+        nlb_fail(b, ret);
+        return ret;
+    }
+    b->seq = nlb_seq;
+    nlb_seq += b->count;
+    for (off = 0, i = 0; off < b->len; off += NLMSG_ALIGN(nh->nlmsg_len), i++) {
+        nh = (struct nlmsghdr *)(b->buf + off);
+        nh->nlmsg_seq = b->seq + i;
+        b->op[i].acked = 0;
+    }
+
+    while ((n = sendmsg(nlb_fd, &msg, 0)) < 0 && errno == EINTR)
+        ;
+    if (n < 0) {
+        ret = -errno;
+    } else {
+        ret = nlb_collect(b);
+    }
+    if (ret < 0 && ret != -ETIMEDOUT) {
+        // the socket may be out of step, start over next time
+        close(nlb_fd);
+        nlb_fd = -1;
+    }
+    pthread_mutex_unlock(&nlb_lock);
+    if (ret < 0) {
+        nlb_fail(b, ret);
+        if (n < 0) {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < b->count; i++) {
+        failed += b->op[i].result < 0;
+    }
+    return failed;
+}
@@ -0,0 +1,403 @@
+/*
+ * nvcache.c
+ *
+ * Hash table of name -> value. With the vendor backend a missing name is
+ * fetched with nvram_get() on first use, the file backend loads the whole
+ * file once. Dirty entries are written back by spp_nvram_commit(); once the
+ * snapshot is marked stale the clean ones are dropped on the next get.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <nvcache.h>
+#include <timestamp.h>
+
+#ifdef NVRAM_FILE
+#include <sys/file.h>
+#include <shutils.h> /* fd2str */
+#include <kvparse.h>
+#else
+#include <nvram.h> /* nvram usr/nvram/include/ */
+#endif
+
+#define NV_BUCKETS  256
+
+typedef struct NV_ENT {
+    struct NV_ENT *next;
+    char *value;        /* NULL: unset */
+    int dirty;
+    char name[];
+} NV_ENT;
+
+static NV_ENT *nv_tbl[NV_BUCKETS];
+static pthread_mutex_t nv_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nv_dirty = 0;
+static uint64_t nv_first_set = 0, nv_last_set = 0;
+static int nv_later = 0;
+static int nv_stale = 0;
+
+#ifdef NVRAM_FILE
+static const char *nv_path = NVRAM_FILE_PATH;
+static int nv_loaded = 0;
+#endif
+
+static unsigned int nv_hash(const char *s, size_t len)
+{
+    unsigned int h = 5381;
+
+    while (len--) {
+        h = h * 33 + (unsigned char)*s++;
+    }
+    return h & (NV_BUCKETS - 1);
+}
+
+static NV_ENT *nv_find(const char *name, size_t len)
+{
+    NV_ENT *e;
+
+    for (e = nv_tbl[nv_hash(name, len)]; e; e = e->next) {
+        if (!strncmp(e->name, name, len) && e->name[len] == '\0') {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static NV_ENT *nv_add(const char *name, size_t len, const char *value, size_t vlen)
+{
+    unsigned int h = nv_hash(name, len);
+    NV_ENT *e = malloc(sizeof(NV_ENT) + len + 1);
+
+    if (e == NULL) {
+        return NULL;
+    }
+    memcpy(e->name, name, len);
+    e->name[len] = '\0';
+    e->value = value ? strndup(value, vlen) : NULL;
+    e->dirty = 0;
+    if (value && e->value == NULL) {
+        free(e);
+        return NULL;
+    }
+    e->next = nv_tbl[h];
+    nv_tbl[h] = e;
+    return e;
+}
+
+#ifdef NVRAM_FILE
+static void nv_load(void)
+{
+    spp_kvlist kv;
+    char *buf = NULL;
+    int fd, i = 0;
+
+    nv_loaded = 1;
+    if ((fd = open(nv_path, O_RDONLY)) < 0 || (buf = fd2str(fd)) == NULL) {
+        return;
+    }
+    if (spp_kv_parse(&kv, buf, strlen(buf), KV_SEP_EQ) > 0) {
+        for (i = 0; i < kv.count; i++) {
+            if (!nv_find(kv.kv[i].key.ptr, kv.kv[i].key.len)) {
+                nv_add(kv.kv[i].key.ptr, kv.kv[i].key.len, kv.kv[i].val.ptr, kv.kv[i].val.len);
+            }
+        }
+    }
+    spp_kv_free(&kv);
+    free(buf);
+}
+
+/* The file as it is now with the dirty entries applied, NULL is empty */
+static void nv_merge(FILE *fp, const char *buf)
+{
+    spp_kvlist kv;
+    spp_tok *k = NULL;
+    NV_ENT *e;
+    int i = 0;
+
+    if (buf && spp_kv_parse(&kv, buf, strlen(buf), KV_SEP_EQ) > 0) {
+        for (i = 0; i < kv.count; i++) {
+            k = &kv.kv[i].key;
+            if ((e = nv_find(k->ptr, k->len)) == NULL || !e->dirty) {
+                fprintf(fp, "%.*s=%.*s\n", (int)k->len, k->ptr, (int)kv.kv[i].val.len, kv.kv[i].val.ptr);
+            }
+        }
+        spp_kv_free(&kv);
+    }
+    for (i = 0; i < NV_BUCKETS; i++) {
+        for (e = nv_tbl[i]; e; e = e->next) {
+            if (e->dirty && e->value) {
+                fprintf(fp, "%s=%s\n", e->name, e->value);
+            }
+        }
+    }
+}
+
+/*
+ * Read the file again, apply the sets and rename() the result into place,
+ * under flock() on <file>.lock against other sppCtrl processes
+ */
+static int nv_backend_commit(void)
+{
+    char tmp[256], lock[256];
+    char *buf = NULL;
+    FILE *fp;
+    int fd = -1, lfd = -1, ret = -1;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", nv_path);
+    snprintf(lock, sizeof(lock), "%s.lock", nv_path);
+    if ((lfd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0 || flock(lfd, LOCK_EX) < 0) {
+        if (lfd >= 0) {
+            close(lfd);
+        }
+        return -1;
+    }
+    if ((fd = open(nv_path, O_RDONLY | O_CLOEXEC)) >= 0) {
+        buf = fd2str(fd);
+    }
+    if ((fp = fopen(tmp, "w")) != NULL) {
+        nv_merge(fp, buf);
+        if (fflush(fp) == 0 && fsync(fileno(fp)) == 0) {
+            ret = 0;
+        }
+        fclose(fp);
+        if (ret == 0 && rename(tmp, nv_path) < 0) {
+            ret = -1;
+        }
+        if (ret < 0) {
+            unlink(tmp);
+        }
+    }
+    free(buf);
+    flock(lfd, LOCK_UN);
+    close(lfd);
+    // what others wrote came along, read it on the next get
+    nv_stale = 1;
+    return ret;
+}
+
+void spp_nvram_file(const char *path)
+{
+    pthread_mutex_lock(&nv_lock);
+    nv_path = path;
+    pthread_mutex_unlock(&nv_lock);
+    spp_nvram_drop();
+}
+#else
+static int nv_backend_commit(void)
+{
+    NV_ENT *e;
+    int i = 0;
+
+    for (i = 0; i < NV_BUCKETS; i++) {
+        for (e = nv_tbl[i]; e; e = e->next) {
+            if (!e->dirty) {
+                continue;
+            }
+            if (e->value) {
+                nvram_set(e->name, e->value);
+            } else {
+                nvram_unset(e->name);
+            }
+        }
+    }
+    return nvram_commit();
+}
+#endif
+
+/* Drop the entries without a pending set, called with nv_lock held */
+static void nv_drop_clean(void)
+{
+    NV_ENT **pe, *e;
+    int i = 0;
+
+    for (i = 0; i < NV_BUCKETS; i++) {
+        for (pe = &nv_tbl[i]; (e = *pe) != NULL; ) {
+            if (e->dirty) {
+                pe = &e->next;
+                continue;
+            }
+            *pe = e->next;
+            free(e->value);
+            free(e);
+        }
+    }
+#ifdef NVRAM_FILE
+    nv_loaded = 0;
+#endif
+    nv_stale = 0;
+}
+
+/* Snapshot entry for name, called with nv_lock held */
+static NV_ENT *nv_get(const char *name)
+{
+    size_t len = strlen(name);
+    NV_ENT *e;
+#ifndef NVRAM_FILE
+    char *value;
+#endif
+
+    if (nv_stale) {
+        nv_drop_clean();
+    }
+#ifdef NVRAM_FILE
+    if (!nv_loaded) {
+        nv_load();
+    }
+#endif
+    if ((e = nv_find(name, len)) != NULL) {
+        return e;
+    }
+#ifdef NVRAM_FILE
+    return nv_add(name, len, NULL, 0);
+#else
+    // unset names are cached as well
+    value = nvram_get(name);
+    return nv_add(name, len, value, value ? strlen(value) : 0);
+#endif
+}
+
+ssize_t spp_nvram_get(const char *name, char *buf, size_t size)
+{
+    NV_ENT *e;
+    ssize_t len = -1;
+
+    pthread_mutex_lock(&nv_lock);
+    if ((e = nv_get(name)) != NULL && e->value) {
+        len = snprintf(buf, size, "%s", e->value);
+    }
+    pthread_mutex_unlock(&nv_lock);
+    return len;
+}
+
+int spp_nvram_set(const char *name, const char *value)
+{
+    NV_ENT *e;
+    char *copy = NULL;
+    int ret = -1;
+
+    if (value && (copy = strdup(value)) == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&nv_lock);
+    if ((e = nv_get(name)) != NULL) {
+        // setting the same value again costs nothing
+        if ((e->value == NULL && copy == NULL) || (e->value && copy && !strcmp(e->value, copy))) {
+            free(copy);
+        } else {
+            free(e->value);
+            e->value = copy;
+            if (!e->dirty) {
+                e->dirty = 1;
+                if (nv_dirty++ == 0) {
+                    nv_first_set = spp_mono_ns();
+                }
+            }
+            nv_last_set = spp_mono_ns();
+        }
+        ret = 0;
+    } else {
+        free(copy);
+    }
+    pthread_mutex_unlock(&nv_lock);
+    return ret;
+}
+
+int spp_nvram_unset(const char *name)
+{
+    return spp_nvram_set(name, NULL);
+}
+
+int spp_nvram_commit(void)
+{
+    NV_ENT *e;
+    int i = 0, ret = 0;
+
+    pthread_mutex_lock(&nv_lock);
+    nv_later = 0;
+    if (nv_dirty == 0) {
+        pthread_mutex_unlock(&nv_lock);
+        return 0;
+    }
+    if (nv_backend_commit() < 0) {
+        pthread_mutex_unlock(&nv_lock);
+        return -1;
+    }
+    for (i = 0; i < NV_BUCKETS; i++) {
+        for (e = nv_tbl[i]; e; e = e->next) {
+            e->dirty = 0;
+        }
+    }
+    ret = nv_dirty;
+    nv_dirty = 0;
+    pthread_mutex_unlock(&nv_lock);
+    return ret;
+}
+
+void spp_nvram_commit_later(void)
+{
+    pthread_mutex_lock(&nv_lock);
+    nv_later = nv_dirty > 0;
+    pthread_mutex_unlock(&nv_lock);
+}
+
+int spp_nvram_timeout(void)
+{
+    uint64_t due, now;
+
+    pthread_mutex_lock(&nv_lock);
+    if (!nv_later || nv_dirty == 0) {
+        pthread_mutex_unlock(&nv_lock);
+        return -1;
+    }
+    due = nv_last_set + NVRAM_COMMIT_DELAY_MS * 1000000ULL;
+    if (due > nv_first_set + NVRAM_COMMIT_MAX_MS * 1000000ULL) {
+        due = nv_first_set + NVRAM_COMMIT_MAX_MS * 1000000ULL;
+    }
+    pthread_mutex_unlock(&nv_lock);
+
+    now = spp_mono_ns();
+    return now >= due ? 0 : (int)((due - now) / 1000000ULL) + 1;
+}
+
+void spp_nvram_tick(void)
+{
+    if (spp_nvram_timeout() == 0) {
+        spp_nvram_commit();
+    }
+}
+
+void spp_nvram_refresh(void)
+{
+    pthread_mutex_lock(&nv_lock);
+    nv_stale = 1;
+    pthread_mutex_unlock(&nv_lock);
+}
+
+void spp_nvram_drop(void)
+{
+    NV_ENT *e, *next;
+    int i = 0;
+
+    pthread_mutex_lock(&nv_lock);
+    for (i = 0; i < NV_BUCKETS; i++) {
+        for (e = nv_tbl[i]; e; e = next) {
+            next = e->next;
+            free(e->value);
+            free(e);
+        }
+        nv_tbl[i] = NULL;
+    }
+    nv_dirty = 0;
+    nv_later = 0;
+#ifdef NVRAM_FILE
+    nv_loaded = 0;
+#endif
+    pthread_mutex_unlock(&nv_lock);
+}
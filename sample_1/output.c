@@ -0,0 +1,395 @@
+/*
+ * output.c
+ *
+ * Growable output buffers and the SPP_PRINT() backend.
+ *
+ */
+
+#define _GNU_SOURCE     /* splice */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <output.h>
+#include <timestamp.h>
+
+#define OUT_MIN_SIZE    512
+#define OUT_PIPE_CHUNK  (64 * 1024)     /* DAEMON_MAX_FRAME, one OUT frame */
+
+__thread spp_out *spp_out_cur = NULL;
+
+static int out_reserve(spp_out *o, size_t len)
+{
+    size_t size = o->size ? o->size : OUT_MIN_SIZE;
+    char *buf;
+
+    if (o->len + len + 1 <= o->size) {
+        return 0;
+    }
+    while (size < o->len + len + 1) {
+        size <<= 1;
+    }
+    if ((buf = realloc(o->buf, size)) == NULL) {
+        return -1;
+    }
+    o->buf = buf;
+    o->size = size;
+    return 0;
+}
+
+/* Bytes a streaming buffer holds, queued references included */
+static size_t chan_pending(spp_out *o)
+{
+    return o->chan->pending + o->len - o->chan->sealed;
+}
+
+/* Turn the text written since the last segment into a segment */
+static void chan_seal(spp_out *o)
+{
+    spp_chan *ch = o->chan;
+
+    if (o->len > ch->sealed) {
+        ch->seg[ch->nseg].ptr = NULL;
+        ch->seg[ch->nseg].off = ch->sealed;
+        ch->seg[ch->nseg].len = o->len - ch->sealed;
+        ch->pending += o->len - ch->sealed;
+        ch->nseg++;
+        ch->sealed = o->len;
+    }
+}
+
+int spp_out_flush(spp_out *o)
+{
+    struct iovec iov[SPP_CHAN_SEGS];
+    spp_chan *ch = o->chan;
+    int i = 0, ret = 0;
+
+    if (ch == NULL) {
+        return 0;
+    }
+    chan_seal(o);
+    if (ch->nseg == 0) {
+        return 0;
+    }
+    // resolve buffer offsets now, buf may have moved since
+    for (i = 0; i < ch->nseg; i++) {
+        iov[i].iov_base = (void *)(ch->seg[i].ptr ? ch->seg[i].ptr : o->buf + ch->seg[i].off);
+        iov[i].iov_len = ch->seg[i].len;
+    }
+    ret = ch->writev(ch, iov, ch->nseg, ch->pending);
+    ch->sent += ch->pending;
+    ch->nseg = 0;
+    ch->pending = 0;
+    ch->sealed = 0;
+    spp_out_reset(o);
+    return ret < 0 ? -1 : 0;
+}
+
+int spp_out_append(spp_out *o, const void *data, size_t len)
+{
+    if (out_reserve(o, len) < 0) {
+        return -1;
+    }
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+    o->buf[o->len] = '\0';
+    if (o->chan && chan_pending(o) >= SPP_CHAN_FLUSH) {
+        spp_out_flush(o);
+    }
+    return 0;
+}
+
+int spp_out_ref(spp_out *o, const void *data, size_t len)
+{
+    spp_chan *ch = o->chan;
+
+    if (ch == NULL) {
+        return spp_out_append(o, data, len);
+    }
+    // room for this reference and the text that may follow it
+    if (ch->nseg >= SPP_CHAN_SEGS - 2) {
+        spp_out_flush(o);
+    }
+    chan_seal(o);
+    ch->seg[ch->nseg].ptr = data;
+    ch->seg[ch->nseg].len = len;
+    ch->pending += len;
+    ch->nseg++;
+    if (chan_pending(o) >= SPP_CHAN_FLUSH) {
+        return spp_out_flush(o);
+    }
+    return 0;
+}
+
+int spp_out_puts(spp_out *o, const char *s)
+{
+    return s ? spp_out_append(o, s, strlen(s)) : 0;
+}
+
+void spp_out_reset(spp_out *o)
+{
+    o->len = 0;
+    if (o->buf) {
+        o->buf[0] = '\0';
+    }
+}
+
+void spp_out_free(spp_out *o)
+{
+    free(o->buf);
+    memset(o, 0, sizeof(spp_out));
+}
+
+spp_out *spp_out_select(spp_out *o)
+{
+    spp_out *prev = spp_out_cur;
+
+    spp_out_cur = o;
+    return prev;
+}
+
+/* vprintf() into o without flushing */
+static int out_vprintf(spp_out *o, const char *fmt, va_list args)
+{
+    va_list copy;
+    int n;
+
+    va_copy(copy, args);
+    n = vsnprintf(o->buf ? o->buf + o->len : NULL, o->buf ? o->size - o->len : 0, fmt, copy);
+    va_end(copy);
+    if (n < 0) {
+        return -1;
+    }
+    if (o->buf == NULL || o->len + n >= o->size) {
+        if (out_reserve(o, n) < 0) {
+            return -1;
+        }
+        vsnprintf(o->buf + o->len, o->size - o->len, fmt, args);
+    }
+    o->len += n;
+    return n;
+}
+
+int spp_vprintf(const char *fmt, va_list args)
+{
+    spp_out *o = spp_out_cur;
+    int n;
+
+    if (o == NULL) {
+        return vprintf(fmt, args);
+    }
+    if ((n = out_vprintf(o, fmt, args)) < 0) {
+        return -1;
+    }
+    if (o->chan && chan_pending(o) >= SPP_CHAN_FLUSH) {
+        spp_out_flush(o);
+    }
+    return n;
+}
+
+int spp_printf(const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = spp_vprintf(fmt, args);
+    va_end(args);
+    return n;
+}
+
+int spp_putref(const void *data, size_t len)
+{
+    if (spp_out_cur == NULL) {
+        return fwrite(data, 1, len, stdout) == len ? 0 : -1;
+    }
+    return spp_out_ref(spp_out_cur, data, len);
+}
+
+int spp_flush(void)
+{
+    if (spp_out_cur == NULL) {
+        return fflush(stdout) == 0 ? 0 : -1;
+    }
+    return spp_out_flush(spp_out_cur);
+}
+
+/* Wait for fd to become readable before deadline, 0 at the deadline */
+static int pipe_wait(int fd, uint64_t deadline)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint64_t now;
+    int n;
+
+    do {
+        if (deadline == 0) {
+            n = poll(&pfd, 1, -1);
+        } else if ((now = spp_mono_ns()) >= deadline) {
+            return 0;
+        } else {
+            n = poll(&pfd, 1, (deadline - now + 999999) / 1000000);
+        }
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/* Copy one chunk from fd into o or stdout, used when splice can not */
+static ssize_t pipe_copy(int fd, spp_out *o, size_t max)
+{
+    char buf[4096];
+    ssize_t n;
+
+    n = read(fd, buf, max < sizeof(buf) ? max : sizeof(buf));
+    if (n > 0) {
+        if (o) {
+            spp_out_append(o, buf, n);
+        } else if (fwrite(buf, 1, n, stdout) != (size_t)n) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+ssize_t spp_putpipe(int fd, int timeout_ms)
+{
+    spp_out *o = spp_out_cur;
+    uint64_t deadline = timeout_ms > 0 ? spp_mono_ns() + timeout_ms * 1000000ULL : 0;
+    ssize_t n, total = 0;
+    int avail = 0, can_splice = 1;
+
+    // queued output goes first
+    if (o) {
+        spp_out_flush(o);
+    } else {
+        fflush(stdout);
+    }
+
+    for (;;) {
+        if ((n = pipe_wait(fd, deadline)) <= 0) {
+            if (n == 0) {
+                errno = ETIMEDOUT;
+            }
+            return -1;
+        }
+        if (o && o->chan) {
+            // one chunk of exactly what the pipe holds, 0 is end of file
+            if (ioctl(fd, FIONREAD, &avail) < 0 || avail == 0) {
+                n = pipe_copy(fd, o, OUT_PIPE_CHUNK);
+            } else {
+                n = o->chan->splice(o->chan, fd, avail < OUT_PIPE_CHUNK ? avail : OUT_PIPE_CHUNK);
+            }
+        } else if (o == NULL && can_splice) {
+            n = splice(fd, NULL, STDOUT_FILENO, NULL, OUT_PIPE_CHUNK, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                // stdout does not take splice
+                can_splice = 0;
+                continue;
+            }
+        } else {
+            n = pipe_copy(fd, o, OUT_PIPE_CHUNK);
+        }
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return n < 0 ? -1 : total;
+}
+
+void spp_sink_init(spp_sink *s, spp_out *o, spp_seg *seg, int max)
+{
+    s->out = o;
+    s->seg = seg;
+    s->nseg = 0;
+    s->max = seg ? max : 0;
+    s->sealed = o->len;
+    s->len = 0;
+}
+
+/* Text since the last segment becomes a segment */
+static void sink_seal(spp_sink *s)
+{
+    if (s->seg && s->out->len > s->sealed) {
+        s->seg[s->nseg].ptr = NULL;
+        s->seg[s->nseg].off = s->sealed;
+        s->seg[s->nseg].len = s->out->len - s->sealed;
+        s->nseg++;
+        s->sealed = s->out->len;
+    }
+}
+
+ssize_t spp_sink_printf(spp_sink *s, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = out_vprintf(s->out, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return -1;
+    }
+    s->len += n;
+    return n;
+}
+
+ssize_t spp_sink_write(spp_sink *s, const void *data, size_t len)
+{
+    if (spp_out_append(s->out, data, len) < 0) {
+        return -1;
+    }
+    s->len += len;
+    return len;
+}
+
+ssize_t spp_sink_ref(spp_sink *s, const void *data, size_t len)
+{
+    // room for the text before it and this reference
+    if (s->nseg + 2 > s->max) {
+        return spp_sink_write(s, data, len);
+    }
+    sink_seal(s);
+    s->seg[s->nseg].ptr = data;
+    s->seg[s->nseg].off = 0;
+    s->seg[s->nseg].len = len;
+    s->nseg++;
+    s->len += len;
+    return len;
+}
+
+int spp_sink_iov(spp_sink *s, struct iovec *iov, int max)
+{
+    int i = 0, n = 0;
+
+    if (s->seg == NULL) {
+        if (max < 1) {
+            return -1;
+        }
+        iov[0].iov_base = s->out->buf + s->out->len - s->len;
+        iov[0].iov_len = s->len;
+        return 1;
+    }
+    // spp_sink_ref() always leaves a segment for the trailing text
+    sink_seal(s);
+    if (s->nseg > max) {
+        return -1;
+    }
+    for (i = 0; i < s->nseg; i++) {
+        if (s->seg[i].len == 0) {
+            continue;
+        }
+        // offsets are resolved only now, buf may have moved since
+        iov[n].iov_base = (void *)(s->seg[i].ptr ? s->seg[i].ptr : s->out->buf + s->seg[i].off);
+        iov[n].iov_len = s->seg[i].len;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,585 @@
+/*
+ * pool.c
+ *
+ * Worker threads for the daemon. A feature with queued requests is put on
+ * the deque of one worker; the worker runs one request and puts the feature
+ * back at the tail of its own deque, so busy features take turns. Idle
+ * workers steal features from the tail of the other deques.
+ *
+ * Every worker has one deque per priority class (cmd_tables column 3).
+ * The class with the best rank runs first, a class gains one rank for every
+ * POOL_AGING_MS its oldest feature waited, and each class has a limit on the
+ * workers it may occupy.
+ *
+ */
+
+#include <config.h>
+#include <sppCtrl.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <journal.h>
+#include <pool.h>
+#include <timestamp.h>
+
+extern void *cmd_tables[CMD_NUM][CMD_LEN];
+
+#define POOL_ACTORS (CMD_NUM + 1)   /* last one takes unknown commands */
+#define POOL_AGING_MS   250         /* a class waiting this long moves up one rank */
+
+/* scheduling rank of each class, lower runs first */
+static const int class_rank[CMD_CLASSES] = {
+    [CMD_CLASS_INTERACTIVE] = 0,
+    [CMD_CLASS_CONTROL] = 1,
+    [CMD_CLASS_BULK] = 2,
+};
+static const char *class_name[CMD_CLASSES] = {
+    [CMD_CLASS_INTERACTIVE] = "interactive",
+    [CMD_CLASS_CONTROL] = "control",
+    [CMD_CLASS_BULK] = "bulk",
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    spp_req *head, *tail;
+    int cls;                /* CMD_CLASS_* of the feature */
+    int depth;              /* queued, not yet running */
+    int max_depth;
+    int scheduled;          /* on a deque or running */
+    unsigned long done;
+    unsigned long joined;   /* requests served by an identical one */
+    uint64_t wait_ns;       /* total time spent queued */
+} POOL_ACTOR;
+
+typedef struct {
+    int actor;
+    uint64_t since;         /* when it was put on the deque */
+} POOL_SLOT;
+
+typedef struct {
+    POOL_SLOT ring[POOL_ACTORS];    /* each actor is on at most one deque */
+    int head, count;
+} POOL_DEQUE;
+
+typedef struct {
+    pthread_t tid;
+    POOL_DEQUE dq[CMD_CLASSES];
+    unsigned long runs, steals;
+} POOL_WORKER;
+
+typedef struct {
+    int ready;              /* actors on deques */
+    int running;
+    int limit;
+    unsigned long done, aged;
+    uint64_t wait_ns;       /* deque wait of the actors taken */
+} POOL_CLASS;
+
+static POOL_ACTOR actors[POOL_ACTORS];
+static POOL_WORKER workers[POOL_MAX_WORKERS];
+static POOL_CLASS classes[CMD_CLASSES];
+static int worker_count = 0;
+static int next_worker = 0;
+
+/* deques, classes and pool_quit */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static int pool_quit = 0;
+
+/* idempotent requests queued or running, only the daemon loop uses it */
+static spp_req *flight = NULL;
+/* streamed and the join lists, workers read them when output streams */
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static spp_req *done_head = NULL, *done_tail = NULL;
+static int done_fd = -1;
+
+static int feature_class(int feature)
+{
+    int cls = CMD_CLASS_CONTROL;
+
+    if (feature < CMD_NUM) {
+        cls = CMD_CLASS((long)cmd_tables[feature][3]);
+    }
+    return cls < CMD_CLASSES ? cls : CMD_CLASS_CONTROL;
+}
+
+static int feature_idempotent(int feature)
+{
+    return feature < CMD_NUM && ((long)cmd_tables[feature][3] & CMD_IDEMPOTENT);
+}
+
+/*
+ * Attach req to an identical request that has not completed yet, it gets
+ * the same output and return value
+ * @return	1 if joined
+ */
+static int flight_join(spp_req *req)
+{
+    spp_req *r = NULL, *last = NULL;
+
+    for (r = flight; r; r = r->flight_next) {
+        if (r->feature == req->feature && r->len == req->len && !memcmp(r->data, req->data, req->len)) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&flight_lock);
+    if (r->streamed) {
+        // the first chunks are gone, a late joiner would miss them
+        pthread_mutex_unlock(&flight_lock);
+        return 0;
+    }
+    for (last = r; last->join; last = last->join)
+        ;
+    last->join = req;
+    pthread_mutex_unlock(&flight_lock);
+    pthread_mutex_lock(&actors[req->feature].lock);
+    actors[req->feature].joined++;
+    pthread_mutex_unlock(&actors[req->feature].lock);
+    return 1;
+}
+
+static void flight_remove(spp_req *req)
+{
+    spp_req **pp = NULL;
+
+    for (pp = &flight; *pp; pp = &(*pp)->flight_next) {
+        if (*pp == req) {
+            *pp = req->flight_next;
+            break;
+        }
+    }
+}
+
+static void deque_push(POOL_WORKER *w, int actor)
+{
+    int cls = actors[actor].cls;
+    POOL_DEQUE *dq = &w->dq[cls];
+    POOL_SLOT *slot = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    slot = &dq->ring[(dq->head + dq->count++) % POOL_ACTORS];
+    slot->actor = actor;
+    slot->since = spp_mono_ns();
+    classes[cls].ready++;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Own deque from the head, other deques from the tail */
+static POOL_SLOT *deque_pop(POOL_DEQUE *dq, int steal)
+{
+    POOL_SLOT *slot = NULL;
+
+    if (dq->count == 0) {
+        return NULL;
+    }
+    if (steal) {
+        slot = &dq->ring[(dq->head + dq->count - 1) % POOL_ACTORS];
+    } else {
+        slot = &dq->ring[dq->head];
+        dq->head = (dq->head + 1) % POOL_ACTORS;
+    }
+    dq->count--;
+    return slot;
+}
+
+/*
+ * Interactive requests may use every worker, the other classes always
+ * leave one worker free for them
+ */
+static int class_allowed(int cls)
+{
+    int busy = 0, i = 0;
+
+    if (classes[cls].running >= classes[cls].limit) {
+        return 0;
+    }
+    if (cls == CMD_CLASS_INTERACTIVE) {
+        return 1;
+    }
+    for (i = 0; i < CMD_CLASSES; i++) {
+        busy += i == CMD_CLASS_INTERACTIVE ? 0 : classes[i].running;
+    }
+    return busy < (worker_count > 1 ? worker_count - 1 : 1);
+}
+
+/*
+ * Choose a class by rank, aged by the wait of its oldest actor, and take
+ * an actor of it. Called with pool_lock held.
+ * @return	actor or -1 if nothing may run now
+ */
+static int pool_pick(POOL_WORKER *self, int *cls)
+{
+    POOL_DEQUE *dq = NULL;
+    POOL_SLOT *slot = NULL;
+    uint64_t now = spp_mono_ns(), oldest;
+    long score, best_score = 0;
+    int best = -1, top = -1, c = 0, i = 0;
+
+    for (c = 0; c < CMD_CLASSES; c++) {
+        if (classes[c].ready == 0 || !class_allowed(c)) {
+            continue;
+        }
+        oldest = now;
+        for (i = 0; i < worker_count; i++) {
+            dq = &workers[i].dq[c];
+            if (dq->count && dq->ring[dq->head].since < oldest) {
+                oldest = dq->ring[dq->head].since;
+            }
+        }
+        score = class_rank[c] * POOL_AGING_MS - (long)((now - oldest) / 1000000ULL);
+        if (best < 0 || score < best_score) {
+            best = c;
+            best_score = score;
+        }
+        if (top < 0 || class_rank[c] < class_rank[top]) {
+            top = c;
+        }
+    }
+    if (best < 0) {
+        return -1;
+    }
+
+    if ((slot = deque_pop(&self->dq[best], 0)) == NULL) {
+        for (i = 1; i < worker_count && slot == NULL; i++) {
+            slot = deque_pop(&workers[(self - workers + i) % worker_count].dq[best], 1);
+        }
+        self->steals++;
+    }
+    classes[best].ready--;
+    classes[best].running++;
+    classes[best].wait_ns += now - slot->since;
+    if (best != top) {
+        classes[best].aged++;
+    }
+    *cls = best;
+    return slot->actor;
+}
+
+void spp_pool_streaming(spp_req *req)
+{
+    pthread_mutex_lock(&flight_lock);
+    req->streamed = 1;
+    pthread_mutex_unlock(&flight_lock);
+}
+
+void spp_pool_wake(void)
+{
+    char c = 0;
+
+    while (write(done_fd, &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+static void pool_complete(spp_req *req)
+{
+
+    pthread_mutex_lock(&done_lock);
+    req->next = NULL;
+    if (done_tail) {
+        done_tail->next = req;
+    } else {
+        done_head = req;
+    }
+    done_tail = req;
+    pthread_mutex_unlock(&done_lock);
+
+    spp_pool_wake();
+}
+
+static void pool_run(POOL_WORKER *self, int i)
+{
+    POOL_ACTOR *a = &actors[i];
+    spp_out *prev = NULL;
+    spp_req *req = NULL;
+    int again = 0;
+
+    pthread_mutex_lock(&a->lock);
+    if ((req = a->head) != NULL) {
+        a->head = req->next;
+        if (a->head == NULL) {
+            a->tail = NULL;
+        }
+        a->depth--;
+        a->wait_ns += spp_mono_ns() - req->queued_ns;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (req) {
+        prev = spp_out_select(&req->out);
+        spp_journal_caller(req->pid, req->uid, req->conn ? 0 : JOURNAL_F_RING);
+        if (req->argc > 1) {
+            spp_dispatch(req->argc, req->argv, &req->ret);
+        } else {
+            spp_usage(req->argc, req->argv);
+        }
+        spp_journal_caller(0, 0, 0);
+        // once streaming, the rest goes the same way to keep the order
+        if (req->out.chan && (req->out.chan->sent || req->out.chan->nseg)) {
+            spp_out_flush(&req->out);
+        }
+        spp_out_select(prev);
+        self->runs++;
+        pool_complete(req);
+    }
+
+    // one request per turn, the feature goes behind the others
+    pthread_mutex_lock(&a->lock);
+    if (req) {
+        a->done++;
+    }
+    a->scheduled = again = a->head != NULL;
+    pthread_mutex_unlock(&a->lock);
+    if (again) {
+        deque_push(self, i);
+    }
+}
+
+static void *pool_worker(void *arg)
+{
+    POOL_WORKER *self = arg;
+    int actor = -1, cls = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    while (!pool_quit) {
+        if ((actor = pool_pick(self, &cls)) < 0) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        pool_run(self, actor);
+
+        pthread_mutex_lock(&pool_lock);
+        classes[cls].running--;
+        classes[cls].done++;
+        // a class held back by its limit may run now
+        pthread_cond_broadcast(&pool_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+int spp_pool_start(int count, int wakefd)
+{
+    sigset_t all, old;
+    int i = 0;
+
+    if (count <= 0) {
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    count = count < 2 ? 2 : (count > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : count);
+
+    for (i = 0; i < POOL_ACTORS; i++) {
+        memset(&actors[i], 0, sizeof(POOL_ACTOR));
+        pthread_mutex_init(&actors[i].lock, NULL);
+        actors[i].cls = feature_class(i);
+    }
+    memset(classes, 0, sizeof(classes));
+    classes[CMD_CLASS_INTERACTIVE].limit = count;
+    classes[CMD_CLASS_CONTROL].limit = count - 1;
+    classes[CMD_CLASS_BULK].limit = count / 2;
+    done_fd = wakefd;
+    pool_quit = 0;
+
+    // signals stay with the daemon loop
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (worker_count = 0; worker_count < count; worker_count++) {
+        memset(&workers[worker_count], 0, sizeof(POOL_WORKER));
+        if (pthread_create(&workers[worker_count].tid, NULL, pool_worker, &workers[worker_count]) != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (worker_count == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void spp_pool_stop(void)
+{
+    spp_req *req = NULL;
+    int i = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_quit = 1;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    worker_count = 0;
+    flight = NULL;
+
+    for (i = 0; i < POOL_ACTORS; i++) {
+        while ((req = actors[i].head) != NULL) {
+            actors[i].head = req->next;
+            spp_req_free(req);
+        }
+        actors[i].tail = NULL;
+    }
+    while ((req = spp_pool_done()) != NULL) {
+        spp_req_free(req);
+    }
+}
+
+int spp_pool_submit(spp_req *req)
+{
+    POOL_ACTOR *a = NULL;
+    int wake = 0;
+
+    if (worker_count == 0) {
+        return -1;
+    }
+    if (req->feature < 0 || req->feature >= POOL_ACTORS) {
+        req->feature = CMD_NUM;
+    }
+    a = &actors[req->feature];
+    req->next = NULL;
+    req->join = NULL;
+    req->queued_ns = spp_mono_ns();
+
+    if (feature_idempotent(req->feature)) {
+        if (flight_join(req)) {
+            return 0;
+        }
+        req->flight_next = flight;
+        flight = req;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    if (a->tail) {
+        a->tail->next = req;
+    } else {
+        a->head = req;
+    }
+    a->tail = req;
+    if (++a->depth > a->max_depth) {
+        a->max_depth = a->depth;
+    }
+    if (!a->scheduled) {
+        a->scheduled = 1;
+        wake = 1;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (wake) {
+        deque_push(&workers[next_worker++ % worker_count], req->feature);
+    }
+    return 0;
+}
+
+spp_req *spp_pool_done(void)
+{
+    spp_req *req = NULL;
+
+    pthread_mutex_lock(&done_lock);
+    if ((req = done_head) != NULL) {
+        done_head = req->next;
+        if (done_head == NULL) {
+            done_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&done_lock);
+
+    // output is final, later duplicates run again
+    if (req && feature_idempotent(req->feature)) {
+        flight_remove(req);
+    }
+    return req;
+}
+
+spp_req *spp_req_new(const char *data, size_t len)
+{
+    spp_req *req = calloc(1, sizeof(spp_req));
+    char *p = NULL, *end = NULL;
+
+    if (req == NULL || (req->data = malloc(len + 1)) == NULL) {
+        free(req);
+        return NULL;
+    }
+    memcpy(req->data, data, len);
+    req->data[len] = '\0';
+    req->len = len;
+    req->ret = SPP_FAIL;
+    req->pid = -1;
+    req->uid = (uid_t)-1;
+
+    for (p = req->data, end = req->data + len; p < end && req->argc < POOL_MAX_ARGS - 1; ) {
+        req->argv[req->argc++] = p;
+        p += strlen(p) + 1;
+    }
+    req->argv[req->argc] = NULL;
+    req->feature = req->argc > 1 ? sppcmd_check(cmd_tables, req->argv[1]) : SPP_FAIL;
+    return req;
+}
+
+void spp_req_free(spp_req *req)
+{
+    spp_req *join = NULL;
+
+    for (; req; req = join) {
+        join = req->join;
+        spp_out_free(&req->out);
+        free(req->data);
+        free(req);
+    }
+}
+
+void spp_pool_stats(spp_out *o)
+{
+    spp_out *prev = spp_out_select(o);
+    POOL_ACTOR *a = NULL;
+    POOL_CLASS cls[CMD_CLASSES];
+    const char *name = NULL;
+    int i = 0, c = 0, count = 0;
+
+    SPP_PRINT("spp_pool_workers=%d\n", worker_count);
+    pthread_mutex_lock(&pool_lock);
+    memcpy(cls, classes, sizeof(cls));
+    for (i = 0; i < worker_count; i++) {
+        for (c = 0, count = 0; c < CMD_CLASSES; c++) {
+            count += workers[i].dq[c].count;
+        }
+        SPP_PRINT("spp_pool_worker%d_deque=%d\n", i, count);
+        SPP_PRINT("spp_pool_worker%d_runs=%lu\n", i, workers[i].runs);
+        SPP_PRINT("spp_pool_worker%d_steals=%lu\n", i, workers[i].steals);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    for (c = 0; c < CMD_CLASSES; c++) {
+        SPP_PRINT("spp_pool_class_%s_ready=%d\n", class_name[c], cls[c].ready);
+        SPP_PRINT("spp_pool_class_%s_running=%d\n", class_name[c], cls[c].running);
+        SPP_PRINT("spp_pool_class_%s_limit=%d\n", class_name[c], cls[c].limit);
+        SPP_PRINT("spp_pool_class_%s_done=%lu\n", class_name[c], cls[c].done);
+        SPP_PRINT("spp_pool_class_%s_aged=%lu\n", class_name[c], cls[c].aged);
+        SPP_PRINT("spp_pool_class_%s_wait_us=%llu\n", class_name[c],
+                (unsigned long long)(cls[c].done ? cls[c].wait_ns / cls[c].done / 1000 : 0));
+    }
+    for (i = 0; i < POOL_ACTORS; i++) {
+        a = &actors[i];
+        name = i < CMD_NUM ? cmd_tables[i][0] : "unknown";
+        if (name == NULL) {
+            i = CMD_NUM - 1;
+            continue;
+        }
+        pthread_mutex_lock(&a->lock);
+        SPP_PRINT("spp_pool_%s_depth=%d\n", name, a->depth);
+        SPP_PRINT("spp_pool_%s_max_depth=%d\n", name, a->max_depth);
+        SPP_PRINT("spp_pool_%s_done=%lu\n", name, a->done);
+        SPP_PRINT("spp_pool_%s_joined=%lu\n", name, a->joined);
+        SPP_PRINT("spp_pool_%s_wait_us=%llu\n", name,
+                (unsigned long long)(a->done ? a->wait_ns / a->done / 1000 : 0));
+        pthread_mutex_unlock(&a->lock);
+    }
+    spp_out_select(prev);
+}
@@ -0,0 +1,312 @@
+/*
+ * ring.c
+ *
+ * Bounded MPSC queue in a memfd, see ring.h. Every slot carries a sequence
+ * number: a producer claims position p with a CAS on head when its slot
+ * reads p, fills it and publishes p + 1; the daemon takes the slot when it
+ * reads tail + 1 and hands it back as tail + SPP_RING_SLOTS.
+ *
+ * The daemon sets sleeping before it blocks on the eventfd and producers
+ * only write the eventfd when they see it set, so a busy daemon drains
+ * whole batches without a single syscall on either side.
+ *
+ */
+
+#define _GNU_SOURCE     /* memfd_create */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <config.h>
+#include <ring.h>
+#include <timestamp.h>
+
+#define RING_MAGIC      0x53505052  /* "SPPR" */
+#define RING_MASK       (SPP_RING_SLOTS - 1)
+#define RING_SPIN       200         /* spp_ring_wait() polls before it sleeps */
+#define RING_NAP_NS     50000
+
+#define LINE __attribute__((aligned(64)))
+
+typedef struct {
+    uint32_t seq;           /* ticket + 1 once code is valid */
+    int32_t code;
+} RING_DONE;
+
+/* The memfd, the same layout on both ends */
+typedef struct {
+    uint32_t magic;
+    uint32_t slots;
+    char names[SPP_RING_FEATURES][SPP_RING_NAME_LEN];
+    uint32_t head LINE;     /* next position to claim, producers */
+    uint32_t full;          /* pushes refused */
+    uint32_t tail LINE;     /* next position to drain, daemon */
+    uint32_t sleeping;      /* daemon blocks on the eventfd */
+    uint32_t drained;
+    uint32_t wakeups;
+    RING_DONE done[SPP_RING_SLOTS] LINE;
+    spp_ring_rec rec[SPP_RING_SLOTS] LINE;
+} RING_SHM;
+
+struct spp_ring {
+    RING_SHM *shm;
+    int memfd;
+    int evfd;
+};
+
+static spp_ring *ring_open(int memfd, int evfd)
+{
+    spp_ring *r = calloc(1, sizeof(spp_ring));
+    void *p = NULL;
+
+    if (r == NULL) {
+        return NULL;
+    }
+    p = mmap(NULL, sizeof(RING_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED) {
+        free(r);
+        return NULL;
+    }
+    r->shm = p;
+    r->memfd = memfd;
+    r->evfd = evfd;
+    return r;
+}
+
+spp_ring *spp_ring_create(const char **names, int count)
+{
+    spp_ring *r = NULL;
+    int memfd = -1, evfd = -1, i = 0;
+
+    memfd = memfd_create("spp_ring", MFD_CLOEXEC);
+    evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (memfd < 0 || evfd < 0 || ftruncate(memfd, sizeof(RING_SHM)) < 0 ||
+            (r = ring_open(memfd, evfd)) == NULL) {
+        if (memfd >= 0) {
+            close(memfd);
+        }
+        if (evfd >= 0) {
+            close(evfd);
+        }
+        return NULL;
+    }
+
+    r->shm->slots = SPP_RING_SLOTS;
+    for (i = 0; i < SPP_RING_SLOTS; i++) {
+        r->shm->rec[i].seq = i;
+    }
+    for (i = 0; i < count && i < SPP_RING_FEATURES; i++) {
+        if (names[i]) {
+            strncpy(r->shm->names[i], names[i], SPP_RING_NAME_LEN - 1);
+        }
+    }
+    // clients check the magic last
+    __atomic_store_n(&r->shm->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return r;
+}
+
+spp_ring *spp_ring_map(int memfd, int evfd)
+{
+    spp_ring *r = ring_open(memfd, evfd);
+
+    if (r == NULL) {
+        close(memfd);
+        close(evfd);
+        return NULL;
+    }
+    if (__atomic_load_n(&r->shm->magic, __ATOMIC_ACQUIRE) != RING_MAGIC || r->shm->slots != SPP_RING_SLOTS) {
+        spp_ring_close(r);
+        errno = EPROTO;
+        return NULL;
+    }
+    return r;
+}
+
+void spp_ring_close(spp_ring *r)
+{
+    if (r == NULL) {
+        return;
+    }
+    munmap(r->shm, sizeof(RING_SHM));
+    close(r->memfd);
+    close(r->evfd);
+    free(r);
+}
+
+int spp_ring_memfd(spp_ring *r)
+{
+    return r->memfd;
+}
+
+int spp_ring_evfd(spp_ring *r)
+{
+    return r->evfd;
+}
+
+int spp_ring_feature(spp_ring *r, const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < SPP_RING_FEATURES; i++) {
+        if (!strncmp(r->shm->names[i], name, SPP_RING_NAME_LEN)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int spp_ring_push(spp_ring *r, int feature, int argc, char **argv, int flags, uint32_t *ticket)
+{
+    RING_SHM *s = r->shm;
+    spp_ring_rec *rec = NULL;
+    char args[SPP_RING_ARGS];
+    uint32_t pos, seq;
+    size_t len = 0, n = 0;
+    int i = 0;
+
+    for (i = 0; i < argc; i++) {
+        n = strlen(argv[i]) + 1;
+        if (len + n > SPP_RING_ARGS) {
+            return -E2BIG;
+        }
+        memcpy(args + len, argv[i], n);
+        len += n;
+    }
+
+    pos = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    for (;;) {
+        rec = &s->rec[pos & RING_MASK];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&s->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // pos was reloaded by the failed CAS
+        } else if ((int32_t)(seq - pos) < 0) {
+            // the daemon has not drained this slot yet
+            __atomic_add_fetch(&s->full, 1, __ATOMIC_RELAXED);
+            return -EAGAIN;
+        } else {
+            pos = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->feature = feature;
+    rec->flags = flags;
+    rec->len = len;
+    memcpy(rec->args, args, len);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    if (ticket) {
+        *ticket = pos;
+    }
+
+    // pairs with the fence in spp_ring_idle(), one of the two sees the other
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->sleeping, __ATOMIC_RELAXED)) {
+        eventfd_write(r->evfd, 1);
+    }
+    return 0;
+}
+
+int spp_ring_wait(spp_ring *r, uint32_t ticket, int timeout_ms, int *code)
+{
+    RING_DONE *d = &r->shm->done[ticket & RING_MASK];
+    struct timespec nap = { 0, RING_NAP_NS };
+    uint64_t due = timeout_ms < 0 ? 0 : spp_mono_ns() + timeout_ms * 1000000ULL;
+    int spin = 0;
+
+    while (__atomic_load_n(&d->seq, __ATOMIC_ACQUIRE) != ticket + 1) {
+        if (due && spp_mono_ns() >= due) {
+            return -1;
+        }
+        // a toggle takes microseconds, do not sleep a whole tick for it
+        if (spin++ < RING_SPIN) {
+            sched_yield();
+        } else {
+            nanosleep(&nap, NULL);
+        }
+    }
+    *code = d->code;
+    return 0;
+}
+
+static int ring_ready(RING_SHM *s)
+{
+    uint32_t tail = s->tail;
+
+    return __atomic_load_n(&s->rec[tail & RING_MASK].seq, __ATOMIC_ACQUIRE) == tail + 1;
+}
+
+int spp_ring_pop(spp_ring *r, spp_ring_rec *rec, uint32_t *ticket)
+{
+    RING_SHM *s = r->shm;
+    uint32_t tail = s->tail;
+    spp_ring_rec *slot = &s->rec[tail & RING_MASK];
+
+    if (!ring_ready(s)) {
+        return 0;
+    }
+    memcpy(rec, slot, sizeof(spp_ring_rec));
+    __atomic_store_n(&slot->seq, tail + SPP_RING_SLOTS, __ATOMIC_RELEASE);
+    s->tail = tail + 1;
+    s->drained++;
+    *ticket = tail;
+
+    // the producer is not trusted to fill the record sanely
+    if (rec->len > SPP_RING_ARGS) {
+        rec->len = SPP_RING_ARGS;
+    }
+    if (rec->len && rec->args[rec->len - 1] != '\0') {
+        rec->args[rec->len - 1] = '\0';
+    }
+    return 1;
+}
+
+void spp_ring_complete(spp_ring *r, uint32_t ticket, int code)
+{
+    RING_DONE *d = &r->shm->done[ticket & RING_MASK];
+
+    d->code = code;
+    __atomic_store_n(&d->seq, ticket + 1, __ATOMIC_RELEASE);
+}
+
+int spp_ring_idle(spp_ring *r)
+{
+    RING_SHM *s = r->shm;
+
+    __atomic_store_n(&s->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ring_ready(s)) {
+        __atomic_store_n(&s->sleeping, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void spp_ring_woken(spp_ring *r, int signalled)
+{
+    eventfd_t n;
+
+    __atomic_store_n(&r->shm->sleeping, 0, __ATOMIC_RELAXED);
+    if (signalled && eventfd_read(r->evfd, &n) == 0) {
+        r->shm->wakeups++;
+    }
+}
+
+void spp_ring_stats(spp_ring *r, spp_out *o)
+{
+    spp_out *prev = spp_out_select(o);
+    RING_SHM *s = r->shm;
+
+    SPP_PRINT("spp_ring_slots=%u\n", s->slots);
+    SPP_PRINT("spp_ring_queued=%u\n", __atomic_load_n(&s->head, __ATOMIC_RELAXED) - s->tail);
+    SPP_PRINT("spp_ring_drained=%u\n", s->drained);
+    SPP_PRINT("spp_ring_wakeups=%u\n", s->wakeups);
+    SPP_PRINT("spp_ring_full=%u\n", __atomic_load_n(&s->full, __ATOMIC_RELAXED));
+    spp_out_select(prev);
+}
@@ -9,78 +9,162 @@
 
 #include <config.h>
 #include <sppCtrl.h>
+#include <pthread.h>
+#include <coproc.h>
+#include <async.h>
 
-static void help(void);
+static int help(int argc, char **argv);
 static char *help_str[] = {
 "Example:\n"
 "\t[CMD] sample off\n"
+"\t[CMD] sample sh 'cd /tmp; pwd'\n"
+"\t[CMD] sample sleep 500\n"
 "Command:\n"
 };
 
-typedef void (*FUNC)(void);
+typedef int (*FUNC)(int, char **);
 
-char *sample_status(void)
+#define SAMPLE_DUMP_TIMEOUT_MS  3000
+#define SAMPLE_SH_TIMEOUT_MS    5000
+#define SAMPLE_SLEEP_MAX_MS     60000
+
+/* Kept for the life of the process, the daemon reuses it across requests */
+static spp_sh *sample_sh = NULL;
+static pthread_mutex_t sample_sh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+ssize_t sample_status(spp_sink *s)
 {
-    static char tmp[] = "spp_sample=on\n";
+    static const char tmp[] = "spp_sample=on\n";
 
 //    DBGMSG("\nbacktick sample = \n%s\n", backticksh("ifconfig %s", "eth2"));
 
-    return tmp;
+    return spp_sink_ref(s, tmp, sizeof(tmp) - 1);
 }
 
 
-static void set_off(void)
+static int set_off(int argc, char **argv)
 {
 #ifdef X86_TEST
 #endif
     SPP_PRINT("Set sample OFF\n");
+    return SPP_OK;
 }
 
-static void set_on(void)
+static int set_on(int argc, char **argv)
 {
 #ifdef X86_TEST
 #endif
     SPP_PRINT("Set sample ON\n");
+    return SPP_OK;
+}
+
+/* In the daemon ifconfig runs while the loop serves other requests */
+static int dump(spp_task *t, int argc, char **argv)
+{
+    SPP_ASYNC_BEGIN(t);
+    SPP_AWAIT_SH(t, SAMPLE_DUMP_TIMEOUT_MS, SPP_TASK_PRINT, "ifconfig -a");
+    if (t->result == EVAL_TIMEDOUT) {
+        SPP_PRINT("ifconfig timed out\n");
+        SPP_ASYNC_RETURN(t, SPP_FAIL);
+    }
+    SPP_ASYNC_END(t, SPP_OK);
+}
+
+/* Holds no worker and no thread while it waits */
+static int nap(spp_task *t, int argc, char **argv)
+{
+    int ms = argc > 3 ? atoi(argv[3]) : 0;
+
+    SPP_ASYNC_BEGIN(t);
+    if (ms <= 0 || ms > SAMPLE_SLEEP_MAX_MS) {
+        help(argc, argv);
+        SPP_ASYNC_RETURN(t, SPP_FAIL);
+    }
+    SPP_AWAIT_SLEEP(t, ms);
+    SPP_PRINT("slept %d ms\n", ms);
+    SPP_ASYNC_END(t, SPP_OK);
+}
+
+/* Run the arguments as one command line in the persistent shell */
+static int sh(int argc, char **argv)
+{
+    spp_out line = {0};
+    int i = 0, ret = 0;
+
+    if (argc < 4) {
+        help(argc, argv);
+        return SPP_FAIL;
+    }
+    pthread_mutex_lock(&sample_sh_lock);
+    if (sample_sh == NULL) {
+        sample_sh = spp_sh_new();
+    }
+    pthread_mutex_unlock(&sample_sh_lock);
+    if (sample_sh == NULL) {
+        return SPP_FAIL;
+    }
+
+    for (i = 3; i < argc; i++) {
+        spp_out_puts(&line, argv[i]);
+        spp_out_puts(&line, i + 1 < argc ? " " : "");
+    }
+    ret = spp_sh_evalsh(sample_sh, SAMPLE_SH_TIMEOUT_MS, "%s", line.buf);
+    spp_out_free(&line);
+    if (ret == EVAL_TIMEDOUT) {
+        SPP_PRINT("command timed out\n");
+        return SPP_FAIL;
+    }
+    SPP_PRINT("exit=%d\n", ret);
+    return ret == 0 ? SPP_OK : SPP_FAIL;
 }
 
 static void *cmd[CMD_NUM][CMD_LEN] = {
     {"help", "Show this help page", &help},
     {"off", "Turn off sample", &set_off},
     {"on", "Turn on sample", &set_on},
+    {"dump", "Show ifconfig output", &dump, CMD_ATTR(CMD_ASYNC)},
+    {"sh", "Run a command line in the sample shell", &sh},
+    {"sleep", "Wait <ms> milliseconds", &nap, CMD_ATTR(CMD_ASYNC)},
     {NULL, NULL, NULL}
 };
 
-static void help(void)
+static int help(int argc, char **argv)
 {
     int i = 0;
     SPP_PRINT("%s", help_str[0]);
     for (i = 0; cmd[i][0]; i++) {
         SPP_PRINT("%s,       \t%s\n", (char *)cmd[i][0], (char *)cmd[i][1]);
     }
-
+    return SPP_OK;
 }
 
-int sample(int argc, char **argv)
+/*
+ * Async subcommands are CMD_ASYNC in column 3 and resumed through here,
+ * the others block and run on a worker in the daemon
+ */
+int sample(spp_task *t, int argc, char **argv)
 {
     int cmdVector = 0;
 
     if (argc < 3) {
-        help();
+        help(argc, argv);
         return SPP_FAIL;
     }
 
     cmdVector = sppcmd_check(cmd, argv[2]);
     if (cmdVector == SPP_FAIL) {
-        help();
+        help(argc, argv);
         return SPP_FAIL;
     }
 
-    if (cmd[cmdVector][0] != NULL) {
-        ((FUNC)cmd[cmdVector][2])();    
-    } else {
-        help();
+    if (cmd[cmdVector][0] == NULL) {
+        help(argc, argv);
         return SPP_FAIL;
     }
-    return SPP_OK;
+    if ((long)cmd[cmdVector][3] & CMD_ASYNC) {
+        return ((spp_async_fn)cmd[cmdVector][2])(t, argc, argv);
+    }
+    SPP_ASYNC_BLOCKING(t);
+    return ((FUNC)cmd[cmdVector][2])(argc, argv);
 }
 
@@ -26,7 +26,12 @@
 #include <sys/wait.h>
 #include <sys/ioctl.h>
 #include <sys/sysinfo.h>
+#include <sys/syscall.h>
+#include <poll.h>
 #include <shutils.h>
+#include <timestamp.h>
+#include <output.h>
+#include <macidx.h>
 
 /* Linux specific headers */
 #ifdef linux
@@ -100,6 +105,114 @@ waitfor(int fd, int timeout)
 	return select(fd + 1, &rfds, NULL, NULL, (timeout > 0) ? &tv : NULL);
 }
 
+/*
+ * pidfd of a child, polls readable once it exited
+ * @return	descriptor or -1 if the kernel has no pidfd_open
+ */
+static int
+child_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Reap child before deadline
+ * @return	1 if reaped, 0 at the deadline or -1 on error
+ */
+static int
+child_wait(pid_t pid, int pidfd, uint64_t deadline, int *status)
+{
+	struct pollfd pfd = { pidfd, POLLIN, 0 };
+	struct timespec ts;
+	uint64_t now;
+	int backoff = 1, left;
+	pid_t ret;
+
+	for (;;) {
+		if ((ret = waitpid(pid, status, WNOHANG)) == pid)
+			return 1;
+		if (ret < 0 && errno != EINTR)
+			return -1;
+		if ((now = spp_mono_ns()) >= deadline)
+			return 0;
+		left = (deadline - now + 999999) / 1000000;
+		if (pidfd >= 0) {
+			poll(&pfd, 1, left);
+		} else {
+			/* no pidfd, poll waitpid with a growing interval */
+			left = left < backoff ? left : backoff;
+			ts.tv_sec = left / 1000;
+			ts.tv_nsec = (left % 1000) * 1000000L;
+			nanosleep(&ts, NULL);
+			backoff = backoff < 32 ? backoff * 2 : 32;
+		}
+	}
+}
+
+/*
+ * Signal the process group of child, or child itself while it has not
+ * called setsid() yet: the group does not exist before that and a parent
+ * can not create a session for it
+ */
+static void
+child_signal(pid_t pid, int sig)
+{
+	if (kill(-pid, sig) < 0 && errno == ESRCH)
+		kill(pid, sig);
+}
+
+/*
+ * Kill the process group of child, SIGTERM first and SIGKILL after
+ * EVAL_KILL_GRACE_MS, and reap child
+ */
+static void
+child_kill(pid_t pid, int pidfd, int *status)
+{
+	child_signal(pid, SIGTERM);
+	if (child_wait(pid, pidfd, spp_mono_ns() + EVAL_KILL_GRACE_MS * 1000000ULL, status) != 1) {
+		child_signal(pid, SIGKILL);
+		while (waitpid(pid, status, 0) < 0 && errno == EINTR)
+			;
+	}
+	/* grandchildren may ignore SIGTERM, pid is reaped and may be reused */
+	kill(-pid, SIGKILL);
+}
+
+/*
+ * Waits for child termination, the child must lead its own process group
+ * @param	pid	child pid
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @param	status	wait status
+ * @return	0 on success, EVAL_TIMEDOUT if the process group was killed or errno
+ */
+int
+waitpid_ms(pid_t pid, int timeout_ms, int *status)
+{
+	int pidfd, ret;
+
+	if (timeout_ms <= 0) {
+		while (waitpid(pid, status, 0) == -1) {
+			if (errno != EINTR)
+				return errno;
+		}
+		return 0;
+	}
+
+	pidfd = child_pidfd(pid);
+	ret = child_wait(pid, pidfd, spp_mono_ns() + timeout_ms * 1000000ULL, status);
+	if (ret == 0)
+		child_kill(pid, pidfd, status);
+	if (pidfd >= 0)
+		close(pidfd);
+	if (ret < 0)
+		return errno;
+	return ret == 0 ? EVAL_TIMEDOUT : 0;
+}
+
 /* 
  * Concatenates NULL-terminated list of arguments into a single
  * commmand and executes it
@@ -107,16 +220,33 @@ waitfor(int fd, int timeout)
  * @param	path	NULL, ">output", or ">>output"
  * @param	timeout	seconds to wait before timing out or 0 for no timeout
  * @param	ppid	NULL to wait for child termination or pointer to pid
- * @return	return value of executed command or errno
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
  */
 int
 _eval(char *const argv[], char *path, int timeout, int *ppid)
+{
+	return _eval_ms(argv, path, timeout * 1000, ppid);
+}
+
+/* 
+ * Concatenates NULL-terminated list of arguments into a single
+ * commmand and executes it. The child leads a new process group; on
+ * timeout the whole group gets SIGTERM and then SIGKILL.
+ * @param	argv	argument list
+ * @param	path	NULL, ">output", or ">>output"
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @param	ppid	NULL to wait for child termination or pointer to pid
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
+ */
+int
+_eval_ms(char *const argv[], char *path, int timeout_ms, int *ppid)
 {
 	pid_t pid;
 	int status;
 	int fd;
 	int flags;
 	int sig;
+	int ret;
 
 	switch (pid = fork()) {
 	case -1:	/* error */
@@ -156,7 +286,9 @@ _eval(char *const argv[], char *path, int timeout, int *ppid)
 		/* execute command */
 		dprintf("%s\n", argv[0]);
 		setenv("PATH", "/sbin:/bin:/usr/sbin:/usr/bin", 1);
-		alarm(timeout);
+		/* the parent can not enforce the timeout of a child it does not wait for */
+		if (ppid)
+			alarm((timeout_ms + 999) / 1000);
 		execvp(argv[0], argv);
 		perror(argv[0]);
 		exit(errno);
@@ -165,10 +297,8 @@ _eval(char *const argv[], char *path, int timeout, int *ppid)
 			*ppid = pid;
 			return 0;
 		} else {
-			if (waitpid(pid, &status, 0) == -1) {
-				/*perror("waitpid");*/
-				return errno;
-			}
+			if ((ret = waitpid_ms(pid, timeout_ms, &status)) != 0)
+				return ret;
 			if (WIFEXITED(status))
 				return WEXITSTATUS(status);
 			else
@@ -283,7 +413,7 @@ int _eval_nowait(char *const argv[], char *path, int timeout, int *ppid)
  * @param	path	NULL, ">output", or ">>output"
  * @param	timeout	seconds to wait before timing out or 0 for no timeout
  * @param	ppid	NULL to wait for child termination or pointer to pid
- * @return	return value of executed command or errno
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
  */
 int
 _eval2(char *const argv[], char *path, int timeout, int *ppid)
@@ -293,6 +423,7 @@ _eval2(char *const argv[], char *path, int timeout, int *ppid)
 	int fd;
 	int flags;
 	int sig;
+	int ret;
 
 	switch (pid = fork()) {
 	case -1:	/* error */
@@ -332,7 +463,8 @@ _eval2(char *const argv[], char *path, int timeout, int *ppid)
 		/* execute command */
 		dprintf("%s\n", argv[0]);
 		setenv("PATH", "/sbin:/bin:/usr/sbin:/usr/bin", 1);
-		alarm(timeout);
+		if (ppid)
+			alarm(timeout);
 		execvp(argv[0], argv);
 		perror(argv[0]);
 		exit(errno);
@@ -341,10 +473,8 @@ _eval2(char *const argv[], char *path, int timeout, int *ppid)
 			*ppid = pid;
 			return 0;
 		} else {
-			if (waitpid(pid, &status, 0) == -1) {
-				/*perror("waitpid");*/
-				return errno;
-			}
+			if ((ret = waitpid_ms(pid, timeout * 1000, &status)) != 0)
+				return ret;
 			if (WIFEXITED(status))
 				return WEXITSTATUS(status);
 			else
@@ -460,11 +590,30 @@ int _eval_nowait2(char *const argv[], char *path, int timeout, int *ppid)
  */
 char *
 _backtick(char *const argv[])
+{
+	return _backtick_ms(argv, 0);
+}
+
+/* 
+ * Concatenates NULL-terminated list of arguments into a single
+ * commmand and executes it in a new process group
+ * @param	argv	argument list
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @return	stdout of executed command or NULL if an error occurred,
+ *		errno is ETIMEDOUT if the process group was killed
+ */
+char *
+_backtick_ms(char *const argv[], int timeout_ms)
 {
 	int filedes[2];
 	pid_t pid;
 	int status;
-	char *buf = NULL;
+	char *buf = NULL, *p;
+	size_t count = 0, size = 0;
+	uint64_t deadline = 0, now;
+	struct pollfd pfd;
+	ssize_t n = -1;
+	int ret;
 
 	/* create pipe */
 	if (pipe(filedes) == -1) {
@@ -474,8 +623,11 @@ _backtick(char *const argv[])
 
 	switch (pid = fork()) {
 	case -1:	/* error */
+		close(filedes[0]);
+		close(filedes[1]);
 		return NULL;
 	case 0:		/* child */
+		setpgid(0, 0);		/* killed as a group on timeout */
 		close(filedes[0]);	/* close read end of pipe */
 		dup2(filedes[1], 1);	/* redirect stdout to write end of pipe */
 		close(filedes[1]);	/* close write end of pipe */
@@ -484,12 +636,113 @@ _backtick(char *const argv[])
 		break;
 	default:	/* parent */
 		close(filedes[1]);	/* close write end of pipe */
-		buf = fd2str(filedes[0]);
-		waitpid(pid, &status, 0);
 		break;
 	}
-	
-	return buf;
+
+	/* also in the parent, the child may not have run yet */
+	setpgid(pid, pid);
+	if (timeout_ms > 0)
+		deadline = spp_mono_ns() + timeout_ms * 1000000ULL;
+	pfd.fd = filedes[0];
+	pfd.events = POLLIN;
+
+	for (;;) {
+		if (size - count < 512) {
+			if ((p = realloc(buf, size ? size * 2 : 1024)) == NULL)
+				break;
+			buf = p;
+			size = size ? size * 2 : 1024;
+		}
+		if (deadline) {
+			if ((now = spp_mono_ns()) >= deadline)
+				break;
+			if (poll(&pfd, 1, (deadline - now + 999999) / 1000000) <= 0)
+				continue;
+		}
+		n = read(filedes[0], buf + count, size - count - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		count += n;
+	}
+	close(filedes[0]);
+
+	if (n == 0) {
+		now = spp_mono_ns();
+		ret = waitpid_ms(pid, !deadline ? 0 : (now < deadline ? (deadline - now + 999999) / 1000000 : 1), &status);
+		if (ret == 0) {
+			buf[count] = '\0';
+			return buf;
+		}
+		errno = ret == EVAL_TIMEDOUT ? ETIMEDOUT : ret;
+	} else {
+		/* timed out, read error or out of memory */
+		child_kill(pid, -1, &status);
+		errno = deadline && spp_mono_ns() >= deadline ? ETIMEDOUT : EIO;
+	}
+	free(buf);
+	return NULL;
+}
+
+/* 
+ * Concatenates NULL-terminated list of arguments into a single
+ * commmand and executes it in a new process group, its stdout goes
+ * straight to the current SPP_PRINT() output
+ * @param	argv	argument list
+ * @param	timeout_ms	milliseconds to wait before timing out or 0 for no timeout
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
+ */
+int
+_backtick_out(char *const argv[], int timeout_ms)
+{
+	int filedes[2];
+	pid_t pid;
+	int status;
+	uint64_t deadline = 0, now;
+	int ret;
+
+	if (pipe(filedes) == -1) {
+		perror(argv[0]);
+		return errno;
+	}
+
+	switch (pid = fork()) {
+	case -1:	/* error */
+		ret = errno;
+		close(filedes[0]);
+		close(filedes[1]);
+		return ret;
+	case 0:		/* child */
+		setpgid(0, 0);		/* killed as a group on timeout */
+		close(filedes[0]);	/* close read end of pipe */
+		dup2(filedes[1], 1);	/* redirect stdout to write end of pipe */
+		close(filedes[1]);	/* close write end of pipe */
+		execvp(argv[0], argv);
+		exit(errno);
+		break;
+	default:	/* parent */
+		close(filedes[1]);	/* close write end of pipe */
+		break;
+	}
+
+	setpgid(pid, pid);
+	if (timeout_ms > 0)
+		deadline = spp_mono_ns() + timeout_ms * 1000000ULL;
+	if (spp_putpipe(filedes[0], timeout_ms) < 0) {
+		close(filedes[0]);
+		child_kill(pid, -1, &status);
+		return errno == ETIMEDOUT ? EVAL_TIMEDOUT : errno;
+	}
+	close(filedes[0]);
+
+	now = spp_mono_ns();
+	ret = waitpid_ms(pid, !deadline ? 0 : (now < deadline ? (deadline - now + 999999) / 1000000 : 1), &status);
+	if (ret != 0)
+		return ret;
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	return status;
 }
 
 /* 
@@ -579,6 +832,13 @@ ether_atoe(const char *a, unsigned char *e)
 {
 	char *c = (char *) a;
 	int i = 0;
+	spp_mac mac;
+
+	/* fixed width xx:xx:xx:xx:xx:xx, no strtoul() */
+	if (strnlen(a, SPP_MAC_STRLEN) == SPP_MAC_STRLEN && spp_mac_parse(a, &mac) == 0) {
+		spp_mac_to_bytes(mac, e);
+		return 1;
+	}
 
 	memset(e, 0, ETHER_ADDR_LEN);
 	for (;;) {
@@ -598,15 +858,7 @@ ether_atoe(const char *a, unsigned char *e)
 char *
 ether_etoa(const unsigned char *e, char *a)
 {
-	char *c = a;
-	int i;
-
-	for (i = 0; i < ETHER_ADDR_LEN; i++) {
-		if (i)
-			*c++ = ':';
-		c += sprintf(c, "%02X", e[i] & 0xff);
-	}
-	return a;
+	return spp_mac_format(spp_mac_from_bytes(e), a, 1);
 }
 
 /* 
@@ -631,6 +883,24 @@ int evalsh(const char *fmt,...)
     return ret;
 }
 
+/* 
+ * shell execution with _eval_ms
+ * @param	timeout_ms	milliseconds before the shell and its children are killed
+ * @param	fmt	argument string
+ * @return	return value of executed command, EVAL_TIMEDOUT or errno
+ */
+int evalsh_ms(int timeout_ms, const char *fmt,...)
+{
+    char buf[4096];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    return _evalsh_ms(timeout_ms, buf);
+}
+
 /* 
  * shell execution with _eval
  * @param	fmt	argument string
@@ -722,21 +992,27 @@ char *backticksh(const char *fmt,...)
 /* 
  * get content of index by delim from src string
  * @param	src	argument string
- * @return	content	content of index
+ * @return	content	content of index, truncated to size
+ * @param	size	content buffer size
  * @param	delmin	delmin token
  * @param  index get index value
  * @return	return 0 on success and -1 on failure 
  */
-int getContentOfIndexByDelim(char *src, char *content, char *delim, int index)
+int getContentOfIndexByDelim(char *src, char *content, size_t size, char *delim, int index)
 {
-	char *next;
-	int ret = -1;
+	spp_tokenizer t;
+	spp_tok tok;
+	size_t len = 0;
 	int i = 0;
 	
-	if (!delim) return -1;
+	if (!delim || size == 0) return -1;
 		
-	foreachby(content, src, delim, next) {
+	spp_tok_init(&t, src, strlen(src), delim);
+	while (spp_tok_next(&t, &tok)) {
 		if (i == index) { 
+			len = tok.len < size - 1 ? tok.len : size - 1;
+			memcpy(content, tok.ptr, len);
+			content[len] = '\0';
 			return 0;
 		}
 		i++;
@@ -744,7 +1020,7 @@ int getContentOfIndexByDelim(char *src, char *content, char *delim, int index)
 	
 	*content = 0;
 		
-	return ret;
+	return -1;
 }
 
 /*
@@ -754,51 +1030,14 @@ int getContentOfIndexByDelim(char *src, char *content, char *delim, int index)
  */
 void get_current_time(char *buf, int size)
 {
-	time_t clock;
-//	struct tm *tm;
-	char tmp[16];
-	struct tm tm_time;
-
-	time(&clock);
-	memset(tmp, 0, sizeof(tmp));
-	//tm = gmtime(&clock);
-	memcpy(&tm_time, localtime(&clock), sizeof(tm_time));
-	strftime(tmp, sizeof(tmp), "%z", &tm_time);
-	if (strcmp(&tmp[1], "0000" )== 0){ 
-		strcpy(tmp, "Z");
-	}
-	tmp[5] = tmp[4];
-	tmp[4] = tmp[3];
-	tmp[3] = ':';
-	strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm_time);
-	strcat(buf, tmp);
+	spp_time_iso8601(buf, size);
 }
 
 /*
  *  get current time string YYYY-MM-DDThh:mm:ss
- *  @return string pointer
+ *  @return string pointer, per thread and valid until the next call
  */
 char *current_time()
 {
-	time_t clock;
-//	struct tm *tm;
-	static char buf[32];
-	char tmp[16];
-	struct tm tm_time;
-
-	time(&clock);
-	memset(tmp, 0, sizeof(tmp));
-//	tm = gmtime(&clock);
-	memcpy(&tm_time, localtime(&clock), sizeof(tm_time));
-	strftime(tmp, sizeof(tmp), "%z", &tm_time);
-        if (strcmp(&tmp[1], "0000" )== 0){
-                strcpy(tmp, "Z");
-        }   
-	tmp[5] = tmp[4];
-        tmp[4] = tmp[3];
-        tmp[3] = ':';
-	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm_time);
-	strcat(buf, tmp);
-	return buf;
+	return (char *)spp_time_iso8601_cached();
 }
-
@@ -11,25 +11,40 @@
 #include <sppCtrl.h>
 
 #include <feature_set.h>
+#include <daemon.h>
+#include <sppclient.h>
+#include <fcntl.h>
+#include <timestamp.h>
+#include <memstat.h>
+#include <journal.h>
 
 int spp_usage(int, char **);
 int version(int, char **);
 typedef int (*FUNC)(int, char **);
 
+#define APPLET_PREFIX   "spp-"  /* spp-<feature> links run that feature */
+#define APPLET_MAX_ARGS 64
+
 #define PRE_STR "Version:%s\n"\
 "Usage: sppCtrl [OPTION...]\n"\
 "Examples:\n"\
-"\tsppCtrl help\t#Show help page.\n\n"\
+"\tsppCtrl help\t#Show help page.\n"\
+"\tsppCtrl -r status update\t#Run in the resident daemon.\n"\
+"\tsppCtrl --mem-stats status update\t#Heap and RSS the command cost.\n"\
+"\tsppCtrl journal show since=-1h\t#Commands run in the last hour.\n"\
+"\tspp-status update\t#Same as sppCtrl status update, via a link.\n\n"\
 "Command:\n"
 
 
 void *cmd_tables[CMD_NUM][CMD_LEN] = {
-    {"help", "To show this help", &spp_usage},
-    {"status", "update system status", &status},
-    {"interface", "interface OP", &interface},
-    {"version", "show Version", &version},
-    {"sample", "I am sample", &sample},
-    {NULL, NULL, NULL}
+    {"help", "To show this help", &spp_usage, CMD_ATTR(CMD_CLASS_INTERACTIVE | CMD_IDEMPOTENT)},
+    {"status", "update system status", &status, CMD_ATTR(CMD_CLASS_INTERACTIVE | CMD_IDEMPOTENT)},
+    {"interface", "interface OP", &interface, CMD_ATTR(CMD_CLASS_CONTROL)},
+    {"version", "show Version", &version, CMD_ATTR(CMD_CLASS_INTERACTIVE | CMD_IDEMPOTENT)},
+    {"sample", "I am sample", &sample, CMD_ATTR(CMD_CLASS_BULK | CMD_ASYNC)},
+    {"daemon", "resident sppCtrl", &daemon_ctrl, CMD_ATTR(CMD_CLASS_INTERACTIVE)},
+    {"journal", "audit journal of commands", &journal, CMD_ATTR(CMD_CLASS_INTERACTIVE | CMD_IDEMPOTENT)},
+    {NULL, NULL, NULL, NULL}
 };
 
 int version(int argc, char **argv)
@@ -50,11 +65,34 @@ int spp_usage(int argc, char **argv)
     return SPP_OK;
 }
 
+static int spp_locked = 0;
+static uint64_t spp_lock_wait = 0;     /* ns spent in spp_lock() */
+static int spp_lock_kills = 0;         /* lock holders killed for it */
+
+/* One line per request for the load test, see SPP_LOCK_STATS_ENV */
+static void spp_lock_report(void)
+{
+    const char *path = getenv(SPP_LOCK_STATS_ENV);
+    char line[64];
+    int fd = -1, n = 0;
+
+    if (path == NULL || (fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC)) < 0) {
+        return;
+    }
+    // a single O_APPEND write, lines of concurrent requests do not mix
+    n = snprintf(line, sizeof(line), "%llu %d\n", (unsigned long long)spp_lock_wait, spp_lock_kills);
+    if (write(fd, line, n) != n) {
+        DBGMSG("lock stats write fail\n");
+    }
+    close(fd);
+}
+
 void spp_lock(void)
 {
     pid_t pid;
     FILE *fp = NULL;
     int timeout = 10;
+    uint64_t start = spp_mono_ns();
 
     // Checking pid for 10s timeout
 
@@ -68,6 +106,7 @@ void spp_lock(void)
             if (timeout == 1 ) {
                 fscanf(fp, "%d", &pid);
                 kill(pid, SIGKILL);
+                spp_lock_kills++;
                 fclose(fp);
                 SPP_PRINT("\nsppCtrl is busy and timeout happend!!!\nKill and do new request\n");
                 unlink(PID_FILE);
@@ -86,38 +125,175 @@ void spp_lock(void)
 
     fprintf(fp, "%d", getpid());
     fclose(fp);
+    spp_locked = 1;
+    spp_lock_wait = spp_mono_ns() - start;
 }
 
-int main(int argc, char **argv)
+/* Release the request lock, long running commands call it early */
+void spp_unlock(void)
 {
-    int cmdVector = 0;    
+    if (spp_locked) {
+        unlink(PID_FILE);
+        spp_locked = 0;
+        spp_lock_report();
+    }
+}
 
-    if (argc <= 1) {
-        spp_usage(argc, argv);
-        return SPP_FAIL;
+/* Call the handler of cmd_tables[cmdVector], argv[1] names the feature */
+static void run_vector(int cmdVector, int argc, char **argv, int *ret)
+{
+    long attr = (long)cmd_tables[cmdVector][3];
+    uint64_t start = spp_mono_ns();
+    int scope = 0;
+
+    if (cmd_tables[cmdVector][2]) {
+        scope = spp_mem_enter(cmdVector, cmd_tables[cmdVector][0]);
+        if (attr & CMD_ASYNC) {
+            *ret = spp_task_run((spp_async_fn)cmd_tables[cmdVector][2], argc, argv);
+        } else {
+            *ret = ((FUNC)cmd_tables[cmdVector][2])(argc, argv);
+        }
+        spp_mem_leave(scope);
+        spp_journal_log(argc, argv, start, *ret);
+    } else {    
+        SPP_PRINT("\n%s: Command is not support -- %s\n", argv[0], argv[1]);
+        SPP_PRINT("\nTry '%s help' for more information.\n", argv[0]);
     }
+}
 
-    // only allow one request for SPP CTRL
-    spp_lock();
+/*
+ * Run argv[1] from cmd_tables
+ * @param	ret	return value of the handler
+ * @return	SPP_OK if the command exists and SPP_FAIL otherwise
+ */
+int spp_dispatch(int argc, char **argv, int *ret)
+{
+    int cmdVector = 0;
 
+    *ret = SPP_FAIL;
     cmdVector = sppcmd_check(cmd_tables, argv[1]);
     if (cmdVector == SPP_FAIL) {
         SPP_PRINT("%s: unrecognized option '%s'\n", argv[0], argv[1]);
         spp_usage(argc, argv);
         SPP_PRINT("\nTry '%s help' for more information.\n", argv[0]);
-        unlink(PID_FILE);
         return SPP_FAIL;
     }
-    
-    if (cmd_tables[cmdVector][2]) {
-        ((FUNC)cmd_tables[cmdVector][2])(argc, argv);
-    } else {    
-        SPP_PRINT("\n%s: Command is not support -- %s\n", argv[0], argv[1]);
-        SPP_PRINT("\nTry '%s help' for more information.\n", argv[0]);
+    run_vector(cmdVector, argc, argv, ret);
+    return SPP_OK;
+}
+
+/*
+ * Feature named by a spp-<feature> link, the name has to match exactly
+ * @return	cmd_tables index or SPP_FAIL if argv[0] is no applet name
+ */
+static int applet(const char *argv0)
+{
+    const char *name = strrchr(argv0, '/');
+    int i = 0;
+
+    name = name ? name + 1 : argv0;
+    if (strncmp(name, APPLET_PREFIX, sizeof(APPLET_PREFIX) - 1)) {
+        return SPP_FAIL;
+    }
+    name += sizeof(APPLET_PREFIX) - 1;
+    for (i = 0; cmd_tables[i][0]; i++) {
+        if (!strcmp(cmd_tables[i][0], name)) {
+            return i;
+        }
+    }
+    return SPP_FAIL;
+}
+
+/*
+ * "sppCtrl -r ...": run the command in the daemon, no PID file lock since
+ * the daemon orders requests of one feature itself
+ */
+static int remote(int argc, char **argv)
+{
+    spp_client *c = NULL;
+    spp_out out = {0};
+    int ret = SPP_FAIL;
+
+    if ((c = spp_client_open(NULL)) == NULL) {
+        SPP_PRINT("sppCtrl daemon is not running, try '%s daemon start'\n", argv[0]);
+        return SPP_FAIL;
     }
+    // argv[1] is "-r", the daemon sees the command as usual
+    argv[1] = argv[0];
+    if (spp_client_call(c, argc - 1, argv + 1, &out, &ret) < 0) {
+        SPP_PRINT("sppCtrl daemon connection lost\n");
+    }
+    fwrite(out.buf ? out.buf : "", 1, out.len, stdout);
+    spp_out_free(&out);
+    spp_client_close(c);
+    return ret;
+}
 
-    unlink(PID_FILE);
+/*
+ * "spp-interface on ...": the handlers still see "sppCtrl interface on",
+ * without the prefix scan of spp_dispatch()
+ */
+static int applet_main(int cmdVector, int argc, char **argv)
+{
+    char *args[APPLET_MAX_ARGS + 1];
+    int i = 0, ret = SPP_FAIL;
+
+    if (argc >= APPLET_MAX_ARGS) {
+        SPP_PRINT("%s: too many arguments\n", argv[0]);
+        return SPP_FAIL;
+    }
+    args[0] = argv[0];
+    args[1] = cmd_tables[cmdVector][0];
+    for (i = 1; i <= argc; i++) {
+        args[i + 1] = argv[i];
+    }
+
+    spp_lock();
+    run_vector(cmdVector, argc + 1, args, &ret);
+    spp_nvram_commit();
+    spp_unlock();
     return SPP_OK;
- 
 }
 
+int main(int argc, char **argv)
+{
+    int ret = 0, mem_stats = 0;
+
+    if ((ret = applet(argv[0])) != SPP_FAIL) {
+        return applet_main(ret, argc, argv);
+    }
+
+    if (argc <= 1) {
+        spp_usage(argc, argv);
+        return SPP_FAIL;
+    }
+
+    if (!strcmp(argv[1], "-r")) {
+        return remote(argc, argv) == SPP_FAIL ? SPP_FAIL : SPP_OK;
+    }
+
+    if (!strcmp(argv[1], "--mem-stats") && argc > 2) {
+        // the handlers see the command as usual
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+        mem_stats = 1;
+    }
+
+    // only allow one request for SPP CTRL
+    spp_lock();
+
+    if (spp_dispatch(argc, argv, &ret) == SPP_FAIL) {
+        spp_unlock();
+        return SPP_FAIL;
+    }
+
+    // all sets of this request go to flash in one commit
+    spp_nvram_commit();
+    spp_unlock();
+    if (mem_stats) {
+        spp_mem_report(spp_out_cur);
+    }
+    return SPP_OK;
+ 
+}
@@ -0,0 +1,407 @@
+/*
+ * sppclient.c
+ *
+ * libsppctrl, see sppclient.h. Frames are the daemon's: spp_msg_hdr and
+ * the NUL separated argv.
+ *
+ */
+
+#define _GNU_SOURCE     /* MSG_CMSG_CLOEXEC */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <config.h>
+#include <daemon.h>
+#include <ring.h>
+#include <sppclient.h>
+#include <timestamp.h>
+
+#define CLIENT_MAX_ARGS 32
+
+typedef struct CLIENT_REQ {
+    struct CLIENT_REQ *next;
+    uint32_t id;
+    spp_client_cb cb;
+    void *arg;
+    spp_out out;
+    int wait;               /* spp_client_call() frees it, not client_finish() */
+    int done;
+    int code;
+} CLIENT_REQ;
+
+struct spp_client {
+    int fd;
+    uint32_t next_id;
+    spp_out rbuf;
+    CLIENT_REQ *reqs;       /* in flight, oldest first */
+    int pending;
+    int fds[2];             /* SCM_RIGHTS of the last SPP_MSG_RING reply */
+    int nfds;
+};
+
+static void client_drop_fds(spp_client *c)
+{
+    while (c->nfds > 0) {
+        close(c->fds[--c->nfds]);
+    }
+}
+
+static void client_finish(spp_client *c, CLIENT_REQ *r, int code)
+{
+    CLIENT_REQ **pp = NULL;
+
+    for (pp = &c->reqs; *pp; pp = &(*pp)->next) {
+        if (*pp == r) {
+            *pp = r->next;
+            break;
+        }
+    }
+    c->pending--;
+    r->done = 1;
+    r->code = code;
+    if (r->wait) {
+        // spp_client_call() picks it up
+        return;
+    }
+    if (r->cb) {
+        r->cb(c, r->id, code, r->out.buf ? r->out.buf : "", r->out.len, r->arg);
+    }
+    spp_out_free(&r->out);
+    free(r);
+}
+
+/* The connection broke, nothing in flight will ever complete */
+static void client_fail(spp_client *c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    spp_out_reset(&c->rbuf);
+    client_drop_fds(c);
+    while (c->reqs) {
+        client_finish(c, c->reqs, SPP_FAIL);
+    }
+}
+
+static CLIENT_REQ *client_find(spp_client *c, uint32_t id)
+{
+    CLIENT_REQ *r = NULL;
+
+    for (r = c->reqs; r && r->id != id; r = r->next)
+        ;
+    return r;
+}
+
+/* Handle the complete frames in rbuf, returns requests completed */
+static int client_input(spp_client *c)
+{
+    spp_msg_hdr hdr;
+    CLIENT_REQ *r = NULL;
+    size_t off = 0;
+    int done = 0;
+
+    while (c->rbuf.len - off >= sizeof(hdr)) {
+        memcpy(&hdr, c->rbuf.buf + off, sizeof(hdr));
+        if (hdr.len > DAEMON_MAX_FRAME) {
+            client_fail(c);
+            return -1;
+        }
+        if (c->rbuf.len - off < sizeof(hdr) + hdr.len) {
+            break;
+        }
+        if ((r = client_find(c, hdr.id)) != NULL) {
+            if (hdr.type == SPP_MSG_OUT) {
+                spp_out_append(&r->out, c->rbuf.buf + off + sizeof(hdr), hdr.len);
+            } else if (hdr.type == SPP_MSG_END) {
+                client_finish(c, r, hdr.code);
+                done++;
+            }
+        }
+        off += sizeof(hdr) + hdr.len;
+    }
+    if (off) {
+        memmove(c->rbuf.buf, c->rbuf.buf + off, c->rbuf.len - off);
+        c->rbuf.len -= off;
+    }
+    return done;
+}
+
+static int client_connect(spp_client *c, const char *path)
+{
+    struct sockaddr_un addr;
+
+    if ((c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+spp_client *spp_client_open(const char *path)
+{
+    spp_client *c = calloc(1, sizeof(spp_client));
+
+    if (c == NULL) {
+        return NULL;
+    }
+    if (client_connect(c, path ? path : DAEMON_SOCK_PATH) < 0) {
+        free(c);
+        return NULL;
+    }
+    // ids only need to be unique per connection, make logs easier to tell apart
+    c->next_id = (uint32_t)getpid() << 16;
+    return c;
+}
+
+void spp_client_close(spp_client *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    client_fail(c);
+    spp_out_free(&c->rbuf);
+    free(c);
+}
+
+int spp_client_fd(spp_client *c)
+{
+    return c->fd;
+}
+
+int spp_client_pending(spp_client *c)
+{
+    return c->pending;
+}
+
+static int client_write(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t n;
+    int idx = 0;
+
+    while (idx < cnt) {
+        n = writev(fd, iov + idx, cnt - idx);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        while (idx < cnt && (size_t)n >= iov[idx].iov_len) {
+            n -= iov[idx].iov_len;
+            idx++;
+        }
+        if (idx < cnt) {
+            iov[idx].iov_base = (char *)iov[idx].iov_base + n;
+            iov[idx].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* wait: the caller collects the reply with client_wait() */
+static uint32_t client_send(spp_client *c, int type, int argc, char **argv, spp_client_cb cb, void *arg, int wait)
+{
+    struct iovec iov[CLIENT_MAX_ARGS + 1];
+    spp_msg_hdr hdr;
+    CLIENT_REQ *r = NULL, **pp = NULL;
+    int i = 0;
+
+    if (c->fd < 0 || argc > CLIENT_MAX_ARGS || (r = calloc(1, sizeof(CLIENT_REQ))) == NULL) {
+        return 0;
+    }
+    if (++c->next_id == 0) {
+        c->next_id = 1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = type;
+    hdr.id = c->next_id;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    for (i = 0; i < argc; i++) {
+        iov[i + 1].iov_base = argv[i];
+        iov[i + 1].iov_len = strlen(argv[i]) + 1;
+        hdr.len += iov[i + 1].iov_len;
+    }
+    if (hdr.len > DAEMON_MAX_FRAME || client_write(c->fd, iov, argc + 1) < 0) {
+        free(r);
+        if (hdr.len <= DAEMON_MAX_FRAME) {
+            client_fail(c);
+        }
+        return 0;
+    }
+
+    r->id = hdr.id;
+    r->cb = cb;
+    r->arg = arg;
+    r->wait = wait;
+    for (pp = &c->reqs; *pp; pp = &(*pp)->next)
+        ;
+    *pp = r;
+    c->pending++;
+    return r->id;
+}
+
+uint32_t spp_client_send(spp_client *c, int argc, char **argv, spp_client_cb cb, void *arg)
+{
+    return argc < 1 ? 0 : client_send(c, SPP_MSG_REQ, argc, argv, cb, arg, 0);
+}
+
+/* recv() that keeps the fds of a SPP_MSG_RING reply */
+static ssize_t client_recv(spp_client *c, char *buf, size_t len)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } ctl;
+    struct msghdr msg;
+    struct cmsghdr *cm = NULL;
+    struct iovec iov = { buf, len };
+    ssize_t n;
+    int i = 0, cnt = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    if ((n = recvmsg(c->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC)) <= 0) {
+        return n;
+    }
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        cnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        client_drop_fds(c);
+        for (i = 0; i < cnt; i++) {
+            if (c->nfds < 2) {
+                memcpy(&c->fds[c->nfds++], CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            } else {
+                close(*(int *)(CMSG_DATA(cm) + i * sizeof(int)));
+            }
+        }
+    }
+    return n;
+}
+
+int spp_client_process(spp_client *c, int timeout_ms)
+{
+    struct pollfd pfd;
+    char buf[4096];
+    ssize_t n;
+    int done = 0, ret = 0;
+
+    if (c->fd < 0) {
+        return -1;
+    }
+    pfd.fd = c->fd;
+    pfd.events = POLLIN;
+    while ((ret = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+        ;
+    if (ret <= 0) {
+        return ret < 0 ? -1 : 0;
+    }
+
+    // everything already there, without blocking for more
+    do {
+        n = client_recv(c, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0 || spp_out_append(&c->rbuf, buf, n) < 0) {
+            client_fail(c);
+            return -1;
+        }
+        if ((ret = client_input(c)) < 0) {
+            return -1;
+        }
+        done += ret;
+    } while (n == sizeof(buf));
+    return done;
+}
+
+/* Wait for request id sent to be waited for */
+static int client_wait(spp_client *c, uint32_t id, spp_out *out, int *code)
+{
+    CLIENT_REQ *r = client_find(c, id);
+
+    while (!r->done) {
+        if (spp_client_process(c, -1) < 0 && !r->done) {
+            break;
+        }
+    }
+    // client_fail() finishes it as well
+    *code = r->code;
+    if (out) {
+        spp_out_append(out, r->out.buf ? r->out.buf : "", r->out.len);
+    }
+    spp_out_free(&r->out);
+    free(r);
+    return *code == SPP_FAIL && c->fd < 0 ? -1 : 0;
+}
+
+int spp_client_call(spp_client *c, int argc, char **argv, spp_out *out, int *code)
+{
+    uint32_t id;
+
+    *code = SPP_FAIL;
+    if (argc < 1 || (id = client_send(c, SPP_MSG_REQ, argc, argv, NULL, NULL, 1)) == 0) {
+        return -1;
+    }
+    return client_wait(c, id, out, code);
+}
+
+int spp_client_run(spp_client *c, spp_out *out, const char *arg, ...)
+{
+    char *argv[CLIENT_MAX_ARGS + 1];
+    va_list args;
+    int argc = 0, code = SPP_FAIL;
+
+    argv[argc++] = "sppCtrl";
+    va_start(args, arg);
+    for (; arg && argc < CLIENT_MAX_ARGS; arg = va_arg(args, const char *)) {
+        argv[argc++] = (char *)arg;
+    }
+    va_end(args);
+    argv[argc] = NULL;
+
+    if (spp_client_call(c, argc, argv, out, &code) < 0) {
+        return SPP_FAIL;
+    }
+    return code;
+}
+
+spp_ring *spp_client_ring(spp_client *c)
+{
+    uint32_t id;
+    int code = SPP_FAIL;
+
+    if ((id = client_send(c, SPP_MSG_RING, 0, NULL, NULL, NULL, 1)) == 0 ||
+            client_wait(c, id, NULL, &code) < 0 || code != SPP_OK || c->nfds != 2) {
+        client_drop_fds(c);
+        return NULL;
+    }
+    // the ring owns them now, even when mapping fails
+    c->nfds = 0;
+    return spp_ring_map(c->fds[0], c->fds[1]);
+}
@@ -7,26 +7,42 @@
  * mail: bejo.mob@gmail.com
  */
 
+#define _GNU_SOURCE     /* memmem */
 #include <config.h>
 #include <sppCtrl.h>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
 #include <feature_set.h>
+#include <daemon.h>
 
 #define STATUS_FILE_PATH    "/tmp/spp_status"
 #define STATUS_FILE_PATH_PRE    "/tmp/spp_status_"
 #define STATUS_FILE_NAME_LEN    64
+#define STATUS_SEGS     32      /* referenced pieces of one status document */
+#define STATUS_SECTION  "# spp_feature="    /* starts the lines of one feature */
 
 static int help(int, char **);
 static char *help_str[] = {
 "Example:\n"
 "\t[CMD] status update\n"
+"\t[CMD] status watch interface\n"
+"\t[CMD] status show\n"
 "Command:\n"
 };
 
 typedef int (*FUNC)(int, char **);
-typedef char *(*FUNC_STATUS)(void);
+/*
+ * Append the key=value lines of a feature to the sink, reentrant: daemon
+ * workers and watch call providers concurrently
+ * @return	bytes written or -1 on failure
+ */
+typedef ssize_t (*FUNC_STATUS)(spp_sink *);
 
-static char *list_status(void);
+static ssize_t list_status(spp_sink *);
 
 static void *status_tables[][2] = {
     {"interface", &interface_status},
@@ -35,66 +51,349 @@ static void *status_tables[][2] = {
     {NULL, NULL}
 };
 
-static char *list_status(void)
+/* Not a provider, prints the feature list to the current output */
+static ssize_t list_status(spp_sink *s)
 {
     int i = 0;
     SPP_PRINT("\nUpdate feature support:\n");
     for (i = 0; status_tables[i][0]&&strcmp("help", status_tables[i][0]); i++) {
         SPP_PRINT("\t%s \n", (char *)status_tables[i][0]);
     }
+    return 0;
+}
+
+/*
+ * Feature providers for the daemon, "help" is not a feature
+ * @param	i	feature number starting from 0
+ * @return	feature name or NULL past the last one
+ */
+const char *status_feature_name(int i)
+{
+    if (i < 0 || status_tables[i][0] == NULL || !strcmp("help", status_tables[i][0])) {
+        return NULL;
+    }
+    return status_tables[i][0];
+}
+
+int status_lookup(const char *name)
+{
+    int i = 0;
+
+    for (i = 0; status_feature_name(i); i++) {
+        if (!strcmp(name, status_tables[i][0])) {
+            return i;
+        }
+    }
+    return SPP_FAIL;
+}
+
+/*
+ * Append the key=value lines of feature i to out
+ * @return	SPP_OK on success and SPP_FAIL on failure
+ */
+int status_collect(int i, spp_out *out)
+{
+    spp_sink s;
+
+    if (status_feature_name(i) == NULL) {
+        return SPP_FAIL;
+    }
+    spp_sink_init(&s, out, NULL, 0);
+    return ((FUNC_STATUS)status_tables[i][1])(&s) < 0 ? SPP_FAIL : SPP_OK;
+}
+
+/*
+ * Lines of feature name in doc, [*start, *end)
+ * @return	1 if found, 0 if not, -1 if doc has no sections at all
+ */
+static int status_section(const char *doc, size_t len, const char *name, size_t *start, size_t *end)
+{
+    char mark[STATUS_FILE_NAME_LEN];
+    const char *p = NULL, *next = NULL;
+    int n = snprintf(mark, sizeof(mark), STATUS_SECTION "%s\n", name);
+
+    if (len < sizeof(STATUS_SECTION) - 1 || memcmp(doc, STATUS_SECTION, sizeof(STATUS_SECTION) - 1)) {
+        return -1;
+    }
+    for (p = doc; p; p = next) {
+        next = memmem(p + 1, doc + len - p - 1, "\n" STATUS_SECTION, sizeof(STATUS_SECTION));
+        next = next ? next + 1 : NULL;
+        if ((size_t)(doc + len - p) >= (size_t)n && !memcmp(p, mark, n)) {
+            *start = p - doc;
+            *end = next ? (size_t)(next - doc) : len;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whole file into out, an absent file reads as empty */
+static int status_read(const char *path, spp_out *out)
+{
+    char buf[4096];
+    ssize_t n;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || spp_out_append(out, buf, n) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static int status_same(const spp_out *old, const struct iovec *iov, int cnt)
+{
+    size_t off = 0;
+    int i = 0;
+
+    for (i = 0; i < cnt; i++) {
+        if (off + iov[i].iov_len > old->len || memcmp(old->buf + off, iov[i].iov_base, iov[i].iov_len)) {
+            return 0;
+        }
+        off += iov[i].iov_len;
+    }
+    return off == old->len;
+}
+
+/* Build path.tmp and rename it over path, readers see the old or the new */
+static int status_publish(const char *path, const struct iovec *iov, int cnt, size_t len)
+{
+    char tmp[STATUS_FILE_NAME_LEN + 8];
+    ssize_t n = 0;
+    int fd = -1;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        SPP_PRINT("Status file %s open fail\n", tmp);
+        return SPP_FAIL;
+    }
+    // a regular file takes it all at once
+    n = cnt ? writev(fd, iov, cnt) : 0;
+    if (close(fd) < 0 || n != (ssize_t)len || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return SPP_FAIL;
+    }
+    return SPP_OK;
+}
+
+/*
+ * Write feature into path, all features if feature < 0. With merge only
+ * the section of feature is replaced and the rest of the document is
+ * kept. Constant provider output is referenced, not copied, and a
+ * document that did not change is not written at all.
+ * @return	SPP_OK on success and SPP_FAIL on failure
+ */
+static int status_write(const char *path, int feature, int merge)
+{
+    struct iovec iov[STATUS_SEGS + 2];
+    spp_seg seg[STATUS_SEGS];
+    spp_out out = {0}, old = {0};
+    char lock[STATUS_FILE_NAME_LEN + 8];
+    size_t start = 0, end = 0, len = 0;
+    spp_sink s;
+    ssize_t n = 0;
+    int i = 0, cnt = 0, lfd = -1, ret = SPP_FAIL;
+
+    spp_sink_init(&s, &out, seg, STATUS_SEGS);
+    for (i = feature < 0 ? 0 : feature; n >= 0 && status_feature_name(i); i++) {
+        if ((n = spp_sink_printf(&s, STATUS_SECTION "%s\n", status_feature_name(i))) >= 0) {
+            n = ((FUNC_STATUS)status_tables[i][1])(&s);
+        }
+        if (feature >= 0) {
+            break;
+        }
+    }
+    if (n < 0 || (cnt = spp_sink_iov(&s, iov + 1, STATUS_SEGS)) < 0) {
+        spp_out_free(&out);
+        return SPP_FAIL;
+    }
+
+    // read, merge and rename as one step against other writers of path
+    snprintf(lock, sizeof(lock), "%s.lock", path);
+    if ((lfd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 || flock(lfd, LOCK_EX) < 0 ||
+            status_read(path, &old) < 0) {
+        goto out;
+    }
+    iov[0].iov_base = old.buf;
+    iov[0].iov_len = 0;
+    iov[cnt + 1].iov_base = old.buf;
+    iov[cnt + 1].iov_len = 0;
+    if (merge) {
+        switch (status_section(old.buf, old.len, status_feature_name(feature), &start, &end)) {
+            case -1:
+                // written before sections existed, start over with all of them
+                flock(lfd, LOCK_UN);
+                close(lfd);
+                spp_out_free(&old);
+                spp_out_free(&out);
+                return status_write(path, -1, 0);
+            case 0:
+                start = end = old.len;
+                // fall through
+            default:
+                iov[0].iov_len = start;
+                iov[cnt + 1].iov_base = old.buf + end;
+                iov[cnt + 1].iov_len = old.len - end;
+                break;
+        }
+    }
+    len = iov[0].iov_len + s.len + iov[cnt + 1].iov_len;
+
+    if (status_same(&old, iov, cnt + 2)) {
+        ret = SPP_OK;
+    } else {
+        ret = status_publish(path, iov, cnt + 2, len);
+    }
+
+out:
+    if (lfd >= 0) {
+        close(lfd);
+    }
+    spp_out_free(&old);
+    spp_out_free(&out);
+    return ret;
 }
 
 static int update(int argc, char **argv)
 {
     DBGMSG("update status\n");
-    FILE    *fp = NULL;
-    int i = 0;
     char path[STATUS_FILE_NAME_LEN] = STATUS_FILE_PATH_PRE;
+    int i = 0;
 
     switch(argc) {
         case 5:
-            fp = fopen(strcat(path, argv[4]), "w+");
-            if (fp == NULL) {
-                SPP_PRINT("Status file %s open fail\n", argv[4]);
-                return SPP_FAIL;
-            }
+            strncat(path, argv[4], sizeof(path) - strlen(path) - 1);
         case 4:
-            if (fp == NULL) {
-                fp = fopen(STATUS_FILE_PATH, "w+");
-                if (fp == NULL) {
-                    SPP_PRINT("Status file %s open fail\n", STATUS_FILE_PATH);
-                    return SPP_FAIL;
-                }
-            }
-            for (i = 0; status_tables[i][0]; i++) {
-                if (!strcmp(argv[3], status_tables[i][0])) {
-                    break;
-                }
-            }
-            if (status_tables[i][0] != NULL) {
-                fprintf(fp, "%s",((FUNC_STATUS)status_tables[i][1])());
-            } else {
+            if ((i = status_lookup(argv[3])) == SPP_FAIL) {
                 help(argc, argv);
+                break;
             }
-            break;
+            // the shared file keeps the other features, a private one has just this
+            return argc == 5 ? status_write(path, i, 0) : status_write(STATUS_FILE_PATH, i, 1);
         case 3:
-            fp = fopen(STATUS_FILE_PATH, "w+");
-            if (fp == NULL) {
-                SPP_PRINT("Status file %s open fail\n", STATUS_FILE_PATH);
-                return SPP_FAIL;
-            }
-            for (i = 0; status_tables[i][0]; i++) {
-                if (status_tables[i][0] != NULL&&strcmp("help", status_tables[i][0])) {
-                fprintf(fp, "%s",((FUNC_STATUS)status_tables[i][1])());
-                }
-            }
-            break;
+            return status_write(STATUS_FILE_PATH, -1, 0);
         default:
-            list_status();
+            list_status(NULL);
+    }
+    return SPP_OK;
+}
+
+/* Hand the collected lines to the client once there are SPP_CHAN_FLUSH of them */
+static void show_chunk(spp_out *out, int last, int *sent)
+{
+    if (!last && out->len < SPP_CHAN_FLUSH) {
+        return;
+    }
+    if (!*sent && out->len < SPP_CHAN_FLUSH) {
+        // small enough to stay buffered, identical requests can join it
+        SPP_PRINT("%s", out->buf ? out->buf : "");
+    } else if (out->len) {
+        spp_putref(out->buf, out->len);
+        spp_flush();
+        *sent = 1;
     }
-    if (fp != NULL) {
-        fclose(fp);
+    spp_out_reset(out);
+}
+
+/*
+ * Print the key=value lines of the given features, or of all of them. A
+ * large dump goes to the client straight from the collect buffer, a
+ * feature at a time so the buffer stays about SPP_CHAN_FLUSH in size.
+ */
+static int show(int argc, char **argv)
+{
+    spp_out out = {0};
+    int i = 0, n = 0, sent = 0;
+
+    for (i = 3; i < argc; i++) {
+        if (status_lookup(argv[i]) == SPP_FAIL) {
+            list_status(NULL);
+            return SPP_FAIL;
+        }
+    }
+    for (i = 3; i < argc; i++) {
+        status_collect(status_lookup(argv[i]), &out);
+        show_chunk(&out, 0, &sent);
+    }
+    for (n = 0; argc <= 3 && status_feature_name(n); n++) {
+        status_collect(n, &out);
+        show_chunk(&out, 0, &sent);
+    }
+    show_chunk(&out, 1, &sent);
+    spp_out_free(&out);
+    return SPP_OK;
+}
+
+/*
+ * Follow status changes through the daemon: a full snapshot first, then
+ * only the changed key=value pairs ("-key" when a key goes away). Every
+ * event starts with "# seq=N full|delta", a gap in N is always followed
+ * by a full snapshot.
+ */
+static int watch(int argc, char **argv)
+{
+    spp_msg_hdr hdr;
+    spp_out req = {0}, payload = {0};
+    uint32_t seq = 0;
+    int fd = -1;
+    int i = 0;
+
+    if (spp_daemon_self()) {
+        SPP_PRINT("status watch is not available inside the daemon\n");
+        return SPP_FAIL;
+    }
+    for (i = 3; i < argc; i++) {
+        if (status_lookup(argv[i]) == SPP_FAIL) {
+            list_status(NULL);
+            return SPP_FAIL;
+        }
+        spp_out_append(&req, argv[i], strlen(argv[i]) + 1);
+    }
+
+    fd = spp_daemon_connect();
+    if (fd < 0) {
+        SPP_PRINT("sppCtrl daemon is not running, try '%s daemon start'\n", argv[0]);
+        spp_out_free(&req);
+        return SPP_FAIL;
     }
+    // watching never ends, do not block other requests
+    spp_unlock();
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SPP_MSG_WATCH;
+    hdr.id = getpid();
+    spp_msg_write(fd, &hdr, req.buf, req.len);
+
+    while (spp_msg_read(fd, &hdr, &payload) == 0) {
+        if (hdr.type == SPP_MSG_OUT) {
+            SPP_PRINT("%s", payload.buf);
+        } else if (hdr.type == SPP_MSG_END) {
+            break;
+        } else if (hdr.type == SPP_MSG_EVT) {
+            SPP_PRINT("# seq=%u %s\n", (uint32_t)hdr.code, (hdr.flags & SPP_EVT_FULL) ? "full" : "delta");
+            SPP_PRINT("%s", payload.buf ? payload.buf : "");
+            fflush(stdout);
+            if (seq && (uint32_t)hdr.code != seq + 1 && !(hdr.flags & SPP_EVT_FULL)) {
+                // lost events, ask for a new snapshot
+                hdr.type = SPP_MSG_WATCH;
+                spp_msg_write(fd, &hdr, req.buf, req.len);
+            }
+            seq = hdr.code;
+        }
+    }
+
+    close(fd);
+    spp_out_free(&req);
+    spp_out_free(&payload);
     return SPP_OK;
 }
 
@@ -102,6 +401,8 @@ static void *cmd[CMD_NUM][CMD_LEN] = {
     {"help", "Show this help page", &help},
     {"update", "update status ex: update [Feature] or update [Feature] \
 <"STATUS_FILE_PATH_PRE"YOUR_FILE_NAME>", &update},
+    {"watch", "stream status changes from the daemon ex: watch [Feature...]", &watch},
+    {"show", "print status ex: show [Feature...]", &show},
     {NULL, NULL, NULL}
 };
 
@@ -0,0 +1,118 @@
+/*
+ * timestamp.c
+ *
+ * The ISO-8601 string only changes once per second, so every thread keeps
+ * the last one it built and rebuilds it when time() moves on. No locking
+ * is needed and the hot path is a time() call and a compare.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+#include <timestamp.h>
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE  CLOCK_MONOTONIC
+#endif
+
+typedef struct {
+    time_t sec;
+    size_t len;
+    char buf[SPP_ISO8601_LEN];
+} TS_CACHE;
+
+static __thread TS_CACHE ts_cache = { (time_t)-1, 0, "" };
+
+static const char digits2[] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+static char *put2(char *p, int v)
+{
+    memcpy(p, &digits2[v * 2], 2);
+    return p + 2;
+}
+
+static uint64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t spp_mono_ns(void)
+{
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+uint64_t spp_mono_coarse_ns(void)
+{
+    return clock_ns(CLOCK_MONOTONIC_COARSE);
+}
+
+static void ts_format(TS_CACHE *c, time_t now)
+{
+    struct tm tm;
+    char *p = c->buf;
+    long off;
+    int year;
+
+    localtime_r(&now, &tm);
+    year = tm.tm_year + 1900;
+    p = put2(p, (year / 100) % 100);
+    p = put2(p, year % 100);
+    *p++ = '-';
+    p = put2(p, tm.tm_mon + 1);
+    *p++ = '-';
+    p = put2(p, tm.tm_mday);
+    *p++ = 'T';
+    p = put2(p, tm.tm_hour);
+    *p++ = ':';
+    p = put2(p, tm.tm_min);
+    *p++ = ':';
+    p = put2(p, tm.tm_sec);
+
+    off = tm.tm_gmtoff / 60;
+    if (off == 0) {
+        *p++ = 'Z';
+    } else {
+        *p++ = off < 0 ? '-' : '+';
+        if (off < 0) {
+            off = -off;
+        }
+        p = put2(p, (off / 60) % 100);
+        *p++ = ':';
+        p = put2(p, off % 60);
+    }
+    *p = '\0';
+    c->len = p - c->buf;
+    c->sec = now;
+}
+
+const char *spp_time_iso8601_cached(void)
+{
+    time_t now = time(NULL);
+
+    if (now != ts_cache.sec) {
+        ts_format(&ts_cache, now);
+    }
+    return ts_cache.buf;
+}
+
+size_t spp_time_iso8601(char *buf, size_t size)
+{
+    const char *s = spp_time_iso8601_cached();
+    size_t n;
+
+    if (size == 0) {
+        return ts_cache.len;
+    }
+    n = ts_cache.len < size - 1 ? ts_cache.len : size - 1;
+    memcpy(buf, s, n);
+    buf[n] = '\0';
+    return ts_cache.len;
+}
@@ -0,0 +1,246 @@
+/*
+ * tokenize.c
+ *
+ * Zero-copy tokenizer used by foreach()/foreachby() and the parsers.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <tokenize.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define DELIM_HAS(d, c) ((d)->map[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+#define TOK_INDEX_STEP  32
+
+void spp_delim_init(spp_delim *d, const char *delim)
+{
+    const unsigned char *p;
+
+    if (!delim || !*delim) {
+        delim = " ";
+    }
+
+    memset(d, 0, sizeof(spp_delim));
+    for (p = (const unsigned char *)delim; *p; p++) {
+        if (DELIM_HAS(d, *p)) {
+            continue;
+        }
+        d->map[*p >> 3] |= 1 << (*p & 7);
+        if (d->nchars >= 0 && d->nchars < (int)sizeof(d->chars)) {
+            d->chars[d->nchars++] = *p;
+        } else {
+            d->nchars = -1;
+        }
+    }
+}
+
+static const char *find_scalar(const char *s, const char *end, const spp_delim *d)
+{
+    while (s < end && !DELIM_HAS(d, *s)) {
+        s++;
+    }
+    return s;
+}
+
+#if defined(__AVX2__)
+static const char *find_simd(const char *s, const char *end, const spp_delim *d)
+{
+    __m256i c[4];
+    int i;
+
+    for (i = 0; i < d->nchars; i++) {
+        c[i] = _mm256_set1_epi8((char)d->chars[i]);
+    }
+    for (; end - s >= 32; s += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)s);
+        __m256i m = _mm256_cmpeq_epi8(v, c[0]);
+        unsigned int mask;
+
+        for (i = 1; i < d->nchars; i++) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c[i]));
+        }
+        mask = (unsigned int)_mm256_movemask_epi8(m);
+        if (mask) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return find_scalar(s, end, d);
+}
+#elif defined(__SSE2__)
+static const char *find_simd(const char *s, const char *end, const spp_delim *d)
+{
+    __m128i c[4];
+    int i;
+
+    for (i = 0; i < d->nchars; i++) {
+        c[i] = _mm_set1_epi8((char)d->chars[i]);
+    }
+    for (; end - s >= 16; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        __m128i m = _mm_cmpeq_epi8(v, c[0]);
+        unsigned int mask;
+
+        for (i = 1; i < d->nchars; i++) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c[i]));
+        }
+        mask = (unsigned int)_mm_movemask_epi8(m);
+        if (mask) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return find_scalar(s, end, d);
+}
+#else
+/* Word at a time search for targets without SIMD (MIPS/ARM routers) */
+#define SWAR_ONES   ((uintptr_t)-1 / 0xff)
+#define SWAR_HIGHS  (SWAR_ONES * 0x80)
+#define SWAR_HAS_ZERO(x)    (((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+
+static const char *find_simd(const char *s, const char *end, const spp_delim *d)
+{
+    uintptr_t c[4];
+    int i;
+
+    for (i = 0; i < d->nchars; i++) {
+        c[i] = SWAR_ONES * d->chars[i];
+    }
+    for (; end - s >= (long)sizeof(uintptr_t); s += sizeof(uintptr_t)) {
+        uintptr_t w, hit = 0;
+
+        memcpy(&w, s, sizeof(w));
+        for (i = 0; i < d->nchars; i++) {
+            hit |= SWAR_HAS_ZERO(w ^ c[i]);
+        }
+        if (hit) {
+            break;
+        }
+    }
+    return find_scalar(s, end, d);
+}
+#endif
+
+const char *spp_delim_find(const char *s, size_t n, const spp_delim *d)
+{
+    if (d->nchars > 0) {
+        return find_simd(s, s + n, d);
+    }
+    return find_scalar(s, s + n, d);
+}
+
+const char *spp_delim_skip(const char *s, size_t n, const spp_delim *d)
+{
+    const char *end = s + n;
+
+    while (s < end && DELIM_HAS(d, *s)) {
+        s++;
+    }
+    return s;
+}
+
+void spp_tok_init(spp_tokenizer *t, const char *s, size_t n, const char *delim)
+{
+    t->cur = s;
+    t->end = s + n;
+    spp_delim_init(&t->delim, delim);
+}
+
+int spp_tok_next(spp_tokenizer *t, spp_tok *tok)
+{
+    const char *e;
+
+    t->cur = spp_delim_skip(t->cur, t->end - t->cur, &t->delim);
+    if (t->cur >= t->end) {
+        return 0;
+    }
+    e = spp_delim_find(t->cur, t->end - t->cur, &t->delim);
+    tok->ptr = t->cur;
+    tok->len = e - t->cur;
+    t->cur = e;
+    return 1;
+}
+
+size_t spp_tok_copy(const spp_tok *tok, char *buf, size_t size)
+{
+    size_t n;
+
+    if (size == 0) {
+        return tok->len;
+    }
+    n = tok->len < size - 1 ? tok->len : size - 1;
+    memcpy(buf, tok->ptr, n);
+    buf[n] = '\0';
+    return tok->len;
+}
+
+int spp_tok_eq(const spp_tok *tok, const char *s)
+{
+    return !strncmp(tok->ptr, s, tok->len) && s[tok->len] == '\0';
+}
+
+int spp_tok_index_build(spp_tok_index *idx, const char *src, const char *delim)
+{
+    spp_tokenizer t;
+    spp_tok tok;
+
+    memset(idx, 0, sizeof(spp_tok_index));
+    idx->src = src;
+    spp_tok_init(&t, src, strlen(src), delim);
+    while (spp_tok_next(&t, &tok)) {
+        if (idx->count == idx->size) {
+            size_t *off = realloc(idx->off, (idx->size + TOK_INDEX_STEP) * 2 * sizeof(size_t));
+            if (off == NULL) {
+                spp_tok_index_free(idx);
+                return -1;
+            }
+            idx->off = off;
+            idx->size += TOK_INDEX_STEP;
+        }
+        idx->off[2 * idx->count] = tok.ptr - src;
+        idx->off[2 * idx->count + 1] = tok.len;
+        idx->count++;
+    }
+    return idx->count;
+}
+
+int spp_tok_field(const spp_tok_index *idx, int i, spp_tok *tok)
+{
+    if (i < 0 || i >= idx->count) {
+        return -1;
+    }
+    tok->ptr = idx->src + idx->off[2 * i];
+    tok->len = idx->off[2 * i + 1];
+    return 0;
+}
+
+void spp_tok_index_free(spp_tok_index *idx)
+{
+    free(idx->off);
+    idx->off = NULL;
+    idx->count = idx->size = 0;
+}
+
+spp_tokenizer *spp_tok_words(spp_tokenizer *t, const char *s, const char *delim)
+{
+    spp_tok_init(t, s, strlen(s), delim);
+    return t;
+}
+
+const char *spp_tok_word(spp_tokenizer *t, char *word, size_t size)
+{
+    spp_tok tok;
+
+    // block scan of spp_tok_next(), one strlen() per loop in spp_tok_words()
+    if (!spp_tok_next(t, &tok)) {
+        *word = '\0';
+        return NULL;
+    }
+    spp_tok_copy(&tok, word, size);
+    return t->cur;
+}
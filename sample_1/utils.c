@@ -10,21 +10,18 @@
 #include <config.h>
 #include <sppCtrl.h>
 #include <utils.h>
+#include <fdcache.h>
 
 char read_proc_by_char(char *path)
 {
-    char state = '0';
-    FILE *fp = NULL;
-    
-    fp = fopen(path, "r");
+    char state[2] = "0";
 
-    if (fp) {
-        state = fgetc(fp);
-        fclose(fp);
-    } else {
+    /* polled in loops, keep the file open and pread() it */
+    if (spp_fdc_read(path, state, sizeof(state)) <= 0) {
         DBGMSG("File:%s open fail\n", path);
+        return '0';
     }
-    return state;
+    return state[0];
 }
 
 int sppcmd_check(void *cmd_tables[CMD_NUM][CMD_LEN], char *cmd)
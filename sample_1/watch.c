@@ -0,0 +1,302 @@
+/*
+ * watch.c
+ *
+ * "status watch" subscriptions. Providers of watched features run once per
+ * refresh no matter how many watchers there are; the new output is diffed
+ * against the previous one and the same delta text goes to every watcher,
+ * only the per-watcher sequence number differs.
+ *
+ * Providers run on the daemon loop, a refresh stalls every connection for
+ * as long as they take. Completed requests ask for one with watch_changed()
+ * and get it at most every WATCH_MIN_GAP_MS, not once per completion batch.
+ *
+ */
+
+#include <config.h>
+#include <sppCtrl.h>
+
+#include <feature_set.h>
+#include <daemon.h>
+#include <kvparse.h>
+#include <timestamp.h>
+
+#define WATCH_MAX_FEATURE   32
+#define WATCH_INTERVAL_MS   1000
+#define WATCH_MIN_GAP_MS    200     /* between refreshes asked for by watch_changed() */
+#define WATCH_MAX_PENDING   (256 * 1024)   /* slower watchers get a resync */
+
+typedef struct {
+    char *text;         /* last provider output */
+    size_t len;
+    spp_kvlist kv;      /* slices into text */
+    int watchers;
+} WATCH_FEATURE;
+
+typedef struct {
+    spp_conn *conn;
+    uint32_t id;
+    uint32_t seq;
+    uint32_t mask;      /* bit i: status feature i */
+    int need_full;
+} WATCHER;
+
+static WATCH_FEATURE features[WATCH_MAX_FEATURE];
+static WATCHER watchers[DAEMON_MAX_CONN];
+static int watcher_count = 0;
+static uint64_t next_refresh = 0;
+static uint64_t last_refresh = 0;
+
+static void watch_send(WATCHER *w, int flags, const char *text, size_t len)
+{
+    spp_msg_hdr hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SPP_MSG_EVT;
+    hdr.id = w->id;
+    hdr.flags = flags;
+    hdr.code = ++w->seq;
+    spp_conn_send(w->conn, &hdr, text, len);
+}
+
+static void watch_send_full(WATCHER *w)
+{
+    spp_out full = {0};
+    int i = 0;
+
+    for (i = 0; i < WATCH_MAX_FEATURE; i++) {
+        if ((w->mask & (1u << i)) && features[i].text) {
+            spp_out_append(&full, features[i].text, features[i].len);
+        }
+    }
+    watch_send(w, SPP_EVT_FULL, full.buf, full.len);
+    w->need_full = 0;
+    spp_out_free(&full);
+}
+
+static void delta_line(spp_out *d, const char *pre, const spp_tok *key, const spp_tok *val)
+{
+    spp_out_puts(d, pre);
+    spp_out_append(d, key->ptr, key->len);
+    if (val) {
+        spp_out_append(d, "=", 1);
+        spp_out_append(d, val->ptr, val->len);
+    }
+    spp_out_append(d, "\n", 1);
+}
+
+static int tok_same(const spp_tok *a, const spp_tok *b)
+{
+    return a->len == b->len && !memcmp(a->ptr, b->ptr, a->len);
+}
+
+/* Changed and new keys as key=value, removed keys as -key */
+static void watch_diff(const spp_kvlist *old, const spp_kvlist *cur, spp_out *d)
+{
+    int i = 0, j = 0;
+
+    for (i = 0; i < cur->count; i++) {
+        // providers print keys in a stable order, try the same slot first
+        if (i < old->count && tok_same(&old->kv[i].key, &cur->kv[i].key)) {
+            j = i;
+        } else {
+            for (j = 0; j < old->count && !tok_same(&old->kv[j].key, &cur->kv[i].key); j++)
+                ;
+        }
+        if (j == old->count || !tok_same(&old->kv[j].val, &cur->kv[i].val)) {
+            delta_line(d, "", &cur->kv[i].key, &cur->kv[i].val);
+        }
+    }
+    for (j = 0; j < old->count; j++) {
+        if (j < cur->count && tok_same(&old->kv[j].key, &cur->kv[j].key)) {
+            continue;
+        }
+        for (i = 0; i < cur->count && !tok_same(&old->kv[j].key, &cur->kv[i].key); i++)
+            ;
+        if (i == cur->count) {
+            delta_line(d, "-", &old->kv[j].key, NULL);
+        }
+    }
+}
+
+/* Run the provider of feature i, returns 1 if the output changed */
+static int feature_update(int i, spp_out *delta)
+{
+    WATCH_FEATURE *f = &features[i];
+    spp_out out = {0};
+    spp_kvlist kv;
+
+    if (status_collect(i, &out) == SPP_FAIL || out.buf == NULL) {
+        spp_out_free(&out);
+        return 0;
+    }
+    if (f->text && f->len == out.len && !memcmp(f->text, out.buf, out.len)) {
+        spp_out_free(&out);
+        return 0;
+    }
+    if (spp_kv_parse(&kv, out.buf, out.len, KV_SEP_EQ) < 0) {
+        spp_out_free(&out);
+        return 0;
+    }
+    if (delta) {
+        watch_diff(&f->kv, &kv, delta);
+    }
+    spp_kv_free(&f->kv);
+    free(f->text);
+    f->kv = kv;
+    f->text = out.buf;
+    f->len = out.len;
+    return 1;
+}
+
+void watch_refresh(void)
+{
+    spp_out delta = {0};
+    WATCHER *w = NULL;
+    int i = 0, j = 0;
+
+    last_refresh = spp_mono_ns();
+    next_refresh = last_refresh + WATCH_INTERVAL_MS * 1000000ULL;
+    if (watcher_count == 0) {
+        return;
+    }
+
+    for (i = 0; i < WATCH_MAX_FEATURE; i++) {
+        if (features[i].watchers == 0) {
+            continue;
+        }
+        spp_out_reset(&delta);
+        if (!feature_update(i, &delta) || delta.len == 0) {
+            continue;
+        }
+        for (j = 0; j < DAEMON_MAX_CONN; j++) {
+            w = &watchers[j];
+            if (w->conn == NULL || !(w->mask & (1u << i)) || w->need_full) {
+                continue;
+            }
+            if (spp_conn_pending(w->conn) > WATCH_MAX_PENDING) {
+                // skip the sequence number, the client sees the gap
+                w->seq++;
+                w->need_full = 1;
+                continue;
+            }
+            watch_send(w, 0, delta.buf, delta.len);
+        }
+    }
+    spp_out_free(&delta);
+}
+
+int watch_add(spp_conn *c, uint32_t id, char **names, int count)
+{
+    WATCHER *w = NULL;
+    uint32_t mask = 0;
+    int i = 0, n = 0;
+
+    for (i = 0; i < count; i++) {
+        if ((n = status_lookup(names[i])) == SPP_FAIL || n >= WATCH_MAX_FEATURE) {
+            return SPP_FAIL;
+        }
+        mask |= 1u << n;
+    }
+    if (count == 0) {
+        for (n = 0; status_feature_name(n) && n < WATCH_MAX_FEATURE; n++) {
+            mask |= 1u << n;
+        }
+    }
+
+    // a repeated WATCH on the same connection is a resync request
+    for (i = 0; i < DAEMON_MAX_CONN; i++) {
+        if (watchers[i].conn == c) {
+            w = &watchers[i];
+            break;
+        }
+    }
+    if (w == NULL) {
+        for (i = 0; i < DAEMON_MAX_CONN && watchers[i].conn; i++)
+            ;
+        if (i == DAEMON_MAX_CONN) {
+            return SPP_FAIL;
+        }
+        w = &watchers[i];
+        memset(w, 0, sizeof(WATCHER));
+        w->conn = c;
+        watcher_count++;
+    } else {
+        for (n = 0; n < WATCH_MAX_FEATURE; n++) {
+            if (w->mask & (1u << n)) {
+                features[n].watchers--;
+            }
+        }
+    }
+    w->id = id;
+    w->mask = mask;
+    w->need_full = 1;
+
+    // bring everyone up to date, then give the new watcher its snapshot
+    watch_refresh();
+    for (n = 0; n < WATCH_MAX_FEATURE; n++) {
+        if (mask & (1u << n)) {
+            if (features[n].watchers++ == 0) {
+                feature_update(n, NULL);
+            }
+        }
+    }
+    watch_send_full(w);
+    return SPP_OK;
+}
+
+void watch_remove(spp_conn *c)
+{
+    int i = 0, n = 0;
+
+    for (i = 0; i < DAEMON_MAX_CONN; i++) {
+        if (watchers[i].conn != c) {
+            continue;
+        }
+        for (n = 0; n < WATCH_MAX_FEATURE; n++) {
+            if ((watchers[i].mask & (1u << n)) && --features[n].watchers == 0) {
+                spp_kv_free(&features[n].kv);
+                free(features[n].text);
+                features[n].text = NULL;
+                features[n].len = 0;
+            }
+        }
+        memset(&watchers[i], 0, sizeof(WATCHER));
+        watcher_count--;
+    }
+}
+
+void watch_writable(spp_conn *c)
+{
+    int i = 0;
+
+    for (i = 0; i < DAEMON_MAX_CONN; i++) {
+        if (watchers[i].conn == c && watchers[i].need_full &&
+                spp_conn_pending(c) < WATCH_MAX_PENDING / 2) {
+            watch_send_full(&watchers[i]);
+        }
+    }
+}
+
+void watch_changed(void)
+{
+    uint64_t at = last_refresh + WATCH_MIN_GAP_MS * 1000000ULL;
+
+    // the loop runs it once watch_timeout() says so
+    if (watcher_count && at < next_refresh) {
+        next_refresh = at;
+    }
+}
+
+int watch_timeout(void)
+{
+    uint64_t now;
+
+    if (watcher_count == 0) {
+        return -1;
+    }
+    now = spp_mono_ns();
+    if (now >= next_refresh) {
+        return 0;
+    }
+    return (int)((next_refresh - now) / 1000000ULL) + 1;
+}